@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# FILE: bench_coro.sh
+# DESCRIPTION: CPU cost of the coroutine upper layer (rdt_sim -C) against the
+#              callback one, on a lossless workload of many small messages
+#              where the upper layer is a large part of the work.  Each mode
+#              runs several times and the cheapest run counts.
+#
+# usage: ./bench_coro.sh [sim_time] [runs]
+
+SIM_TIME=${1:-2000}
+RUNS=${2:-5}
+WORKLOAD="0.01 100 0 0 0 0"
+
+cd "$(dirname "$0")" || exit 1
+make -s rdt_sim || exit 1
+
+printf "%-10s %14s %10s %14s %12s %12s\n" \
+    "upper" "chars" "cpu(s)" "cpu(us/KB)" "suspends" "heap frames"
+for mode in callback coroutine; do
+    opts=""
+    [ $mode = coroutine ] && opts="-C"
+    best=""
+    for run in $(seq $RUNS); do
+        TIMEFORMAT='%3U %3S'
+        { time out=$(echo | ./rdt_sim $opts $SIM_TIME $WORKLOAD); } 2> /tmp/bench_coro.$$
+        read user sys < /tmp/bench_coro.$$
+        chars=$(echo "$out" | sed -n 's/^\t\([0-9]*\) characters delivered/\1/p')
+        coro=$(echo "$out" | sed -n 's/^\t\([0-9]*\) coroutine suspensions, [0-9]* coroutine frames of which \([0-9]*\) came.*/\1 \2/p')
+        line=$(awk -v chars=$chars -v cpu="$user $sys" -v coro="$coro" 'BEGIN {
+            split(cpu, t, " "); split(coro, c, " ");
+            printf "%.3f %.3f %d %s %s", (t[1] + t[2]) * 1e6 / (chars / 1024.0),
+                t[1] + t[2], chars, c[1] == "" ? "-" : c[1], c[2] == "" ? "-" : c[2] }')
+        if [ -z "$best" ] || awk -v a="$line" -v b="$best" \
+               'BEGIN { split(a, x, " "); split(b, y, " "); exit !(x[1] < y[1]) }'; then
+            best=$line
+        fi
+    done
+    read per_kb cpu chars suspends fresh <<< "$best"
+    printf "%-10s %14s %10s %14s %12s %12s\n" $mode $chars $cpu $per_kb $suspends $fresh
+done
+rm -f /tmp/bench_coro.$$
@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# FILE: bench_mtu.sh
+# DESCRIPTION: Goodput and CPU cost of each packet size across loss rates.
+#              Builds rdt_sim_<size> for every size in MTUS (see the Makefile)
+#              and runs them on the same bandwidth-limited workload.
+#
+# usage: ./bench_mtu.sh [sim_time] [bandwidth]
+
+SIM_TIME=${1:-100}
+BANDWIDTH=${2:-200000}
+MSG_ARRIVALINT=0.02
+MSG_SIZE=2000
+LOSS_RATES="0 0.02 0.1"
+
+cd "$(dirname "$0")" || exit 1
+make -s rdt_sim mtu || exit 1
+
+printf "%-14s %6s %14s %10s %10s %14s\n" \
+    "binary" "loss" "goodput(B/s)" "link eff" "cpu(s)" "cpu(us/KB)"
+for bin in rdt_sim rdt_sim_512 rdt_sim_1500 rdt_sim_9000; do
+    for loss in $LOSS_RATES; do
+        TIMEFORMAT='%3U %3S'
+        { time out=$(echo | ./$bin -w $BANDWIDTH $SIM_TIME $MSG_ARRIVALINT $MSG_SIZE \
+                         0 $loss 0 0); } 2> /tmp/bench_mtu.$$
+        read user sys < /tmp/bench_mtu.$$
+        end=$(echo "$out" | sed -n 's/.*Simulation completed at time \([0-9.]*\)s.*/\1/p')
+        chars=$(echo "$out" | sed -n 's/^\t\([0-9]*\) characters delivered/\1/p')
+        bytes=$(echo "$out" | sed -n 's/.*packets (\([0-9]*\) bytes) passed.*/\1/p')
+        awk -v bin=$bin -v loss=$loss -v end=$end -v chars=$chars -v bytes=$bytes \
+            -v cpu="$user $sys" 'BEGIN {
+            split(cpu, t, " ");
+            printf "%-14s %6s %14.0f %9.1f%% %10.3f %14.2f\n", bin, loss, chars / end,
+                bytes ? chars * 100.0 / bytes : 0, t[1] + t[2],
+                chars ? (t[1] + t[2]) * 1e6 / (chars / 1024.0) : 0 }'
+    done
+done
+rm -f /tmp/bench_mtu.$$
@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# FILE: bench_pdes.sh
+# DESCRIPTION: Strong scaling of the parallel rdt_flows: the same run, with
+#              the same seed, on 1 to 64 threads.  Reports the wall time and
+#              the speedup over one thread, and checks that every thread
+#              count gives the results of the single-threaded run.
+#
+# usage: ./bench_pdes.sh [flows] [sim_time] [max_threads]
+
+FLOWS=${1:-10000}
+SIM_TIME=${2:-10}
+MAX_THREADS=${3:-64}
+OPTS="-S 1 -n $FLOWS -r 0.05,0.4 -s 1 -w 10000000 -q 1000000"
+WORKLOAD="$SIM_TIME 1 500 0 0 0 0"
+
+cd "$(dirname "$0")" || exit 1
+make -s rdt_flows || exit 1
+
+echo "$FLOWS flows, $(nproc) cores"
+printf "%8s %10s %10s %14s %10s\n" "threads" "wall(s)" "speedup" "events/s" "results"
+base_wall=""
+base_results=""
+threads=1
+while [ $threads -le $MAX_THREADS ]; do
+    out=$(echo | ./rdt_flows -t $threads $OPTS $WORKLOAD)
+    # everything but the timing line has to match the single-threaded run
+    results=$(echo "$out" | sed -n '/^## Simulation completed/,$p' | grep -v " threads (" | md5sum)
+    read wall rate <<< $(echo "$out" |
+        sed -n 's/^\t\([0-9.]*\)s on [0-9]* threads (\([0-9]*\) events\/s)/\1 \2/p')
+    if [ -z "$base_wall" ]; then
+        base_wall=$wall
+        base_results=$results
+    fi
+    same=identical
+    [ "$results" = "$base_results" ] || same=DIFFERENT
+    speedup=$(awk -v a=$base_wall -v b=$wall 'BEGIN { printf "%.2f", (b > 0 ? a / b : 0) }')
+    printf "%8d %10s %10s %14s %10s\n" $threads $wall $speedup $rate $same
+    threads=$((threads * 2))
+done
@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# FILE: bench_shm.sh
+# DESCRIPTION: Packets per second and latency through the shared memory
+#              rings, with and without the rdt layer, for each wait mode and
+#              for the sender and the receiver on the same core or on two
+#              cores (when the machine has them).
+#
+# usage: ./bench_shm.sh [run_time]
+
+RUN_TIME=${1:-2}
+
+cd "$(dirname "$0")" || exit 1
+make -s rdt_shm || exit 1
+
+PLACEMENTS="0,0"
+if [ "$(nproc)" -gt 1 ]; then
+    PLACEMENTS="0,0 0,1"
+fi
+
+printf "%-6s %-6s %-6s %10s %12s %12s %12s\n" \
+    "layer" "wait" "cpus" "Mpps" "p50(us)" "p99(us)" "p99.9(us)"
+for layer in raw rdt; do
+    for wait in futex busy; do
+        for cpus in $PLACEMENTS; do
+            # the rdt layer gets 1000-byte messages every 50us on average,
+            # the raw rings are filled as fast as possible
+            opts="-c $cpus"
+            workload="0.00005 1000 0 0 0 0"
+            [ $layer = raw ] && opts="$opts -R" && workload="0 1000 0 0 0 0"
+            [ $wait = busy ] && opts="$opts -p"
+            out=$(echo | ./rdt_shm $opts $RUN_TIME $workload)
+            mpps=$(echo "$out" | sed -n 's/^\t\([0-9.]*\) million packets per second.*/\1/p')
+            lat=$(echo "$out" | sed -n 's/.*latency through the ring is \([0-9.]*\)us at p50, \([0-9.]*\)us at p99 and \([0-9.]*\)us at p99.9.*/\1 \2 \3/p' | head -1)
+            printf "%-6s %-6s %-6s %10s %12s %12s %12s\n" $layer $wait $cpus "$mpps" $lat
+        done
+    done
+done
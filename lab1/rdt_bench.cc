@@ -0,0 +1,564 @@
+/*
+ * FILE: rdt_bench.cc
+ * DESCRIPTION: Benchmarks of the rdt layer, with baselines to compare against.
+ *       The micro benchmarks time the building blocks of the protocol on
+ *       their own, in nanoseconds per operation:
+ *
+ *           checksum         the checksum of a full packet
+ *           fill_packet      FillPacket() of a full payload
+ *           parse_packet     checking a packet received and reading its fields
+ *           window           a packet sent, received, acknowledged and taken
+ *                            out of the window again
+ *           timer_chain      a retransmission timer added to a chain of 64
+ *                            and the oldest one removed
+ *           reorder_insert   a packet inserted into the receiver's buffer,
+ *                            in a random order, 64 at a time
+ *
+ *       The macro benchmarks run rdt_sim with a fixed seed at low, medium
+ *       and high loss, reordering and corruption.  They measure the events
+ *       per second of wall time, the goodput and the p99 message latency.
+ *
+ *       Every benchmark is run a number of times, and -o stores the mean and
+ *       the standard deviation of each in a JSON baseline.  -c compares
+ *       against a baseline.  A benchmark is flagged when it is slower by
+ *       more than the threshold and Welch's t-test finds the slowdown
+ *       significant (one-sided, at 1%).  rdt_bench then exits with 1.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <vector>
+#include <list>
+
+#include "rdt_struct.h"
+#include "rdt_packet.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  gloabal variables
+  []------------------------------------------------------------------------[]*/
+
+/* runs of each benchmark, and operations timed per run of a micro one */
+int runs = 5;
+long long micro_ops = 1000000;
+
+/* a slowdown is only flagged beyond this fraction */
+double threshold = 0.05;
+
+/* the simulator run by the macro benchmarks */
+const char *sim_binary = "./rdt_sim";
+
+/* the macro benchmarks: rdt_sim with these arguments */
+struct scenario {
+    const char *name;
+    const char *args;
+};
+
+struct scenario scenarios[] = {
+    {"low", "-S 1 100 0.02 500 0.01 0.01 0.001 0"},
+    {"medium", "-S 1 100 0.02 500 0.05 0.03 0.01 0"},
+    {"high", "-S 1 100 0.02 500 0.2 0.1 0.05 0"},
+};
+
+/* a benchmark and its runs */
+struct result {
+    char name[64];
+    char unit[16];
+    bool lower_is_better;
+    std::vector<double> samples;
+    double mean, stddev;
+    int n;
+};
+
+std::vector<struct result> results;
+
+
+/*[]------------------------------------------------------------------------[]
+  |  the routines of the rdt layer, and those of a driver it calls
+  []------------------------------------------------------------------------[]*/
+
+/* not in the headers, the sender's and the receiver's own */
+void FillPacket(packet *pkt, int size, unsigned int seq, unsigned int ack, char *data);
+struct WindowSlot;
+struct TimerChainBlock;
+std::list<TimerChainBlock>::iterator AddTimer(unsigned int seq, double expire_time, int kind,
+					      std::list<WindowSlot>::iterator slot);
+void EraseTimer(std::list<TimerChainBlock>::iterator block);
+void InsertIntoBuffer(packet *pkt);
+#define TIMER_RETRANSMIT 0
+
+/* the clock moves on by a microsecond an operation, the packets of each side
+   are left where the other side picks them up */
+double bench_time = 0;
+bool timer_set = false;
+struct packet to_receiver, to_sender;
+long long bytes_delivered = 0;
+
+double GetSimulationTime()
+{
+    return bench_time;
+}
+
+void Sender_StartTimer(double timeout)
+{
+    timer_set = true;
+}
+
+void Sender_StopTimer()
+{
+    timer_set = false;
+}
+
+bool Sender_isTimerSet()
+{
+    return timer_set;
+}
+
+void Sender_ToLowerLayer(struct packet *pkt, int size)
+{
+    memcpy(&to_receiver, pkt, sizeof(struct packet));
+}
+
+void Receiver_ToLowerLayer(struct packet *pkt, int size)
+{
+    memcpy(&to_sender, pkt, sizeof(struct packet));
+}
+
+void Receiver_ToUpperLayer(struct message *msg)
+{
+    bytes_delivered += msg->size;
+}
+
+bool Receiver_isCongestionMarked()
+{
+    return false;
+}
+
+void Sender_UpperLayerWritable()
+{
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  micro benchmarks
+  []------------------------------------------------------------------------[]*/
+
+static double wall_clock()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+/* keeps the compiler from dropping the work of a benchmark */
+volatile unsigned long long sink;
+
+static void bench_checksum(long long ops)
+{
+    struct packet pkt;
+    for (int i=0; i<RDT_PKTSIZE; i++)
+	pkt.data[i] = (char) i;
+    unsigned long long sum = 0;
+    for (long long i=0; i<ops; i++) {
+	pkt.data[0] = (char) i;
+	sum += PacketChecksumOver(&pkt, RDT_PKTSIZE);
+    }
+    sink = sum;
+}
+
+static void bench_fill_packet(long long ops)
+{
+    struct packet pkt;
+    char payload[RDT_PKTSIZE];
+    memset(payload, 'x', sizeof(payload));
+    for (long long i=0; i<ops; i++)
+	FillPacket(&pkt, Layout::max_payload, (unsigned int) i, 1, payload);
+    sink = pkt.data[0];
+}
+
+static void bench_parse_packet(long long ops)
+{
+    struct packet sealed, pkt;
+    char payload[RDT_PKTSIZE];
+    memset(payload, 'x', sizeof(payload));
+    FillPacket(&sealed, Layout::max_payload, 1, 1, payload);
+    unsigned long long sum = 0;
+    for (long long i=0; i<ops; i++) {
+	memcpy(&pkt, &sealed, sizeof(pkt));
+	if (PacketChecksumValid(&pkt))
+	    sum += PacketSeq(&pkt) + PacketAck(&pkt) + PacketSize(&pkt);
+    }
+    sink = sum;
+}
+
+static void bench_window(long long ops)
+{
+    struct sender_state *sender = Sender_NewState();
+    struct receiver_state *receiver = Receiver_NewState();
+    Sender_SwapState(sender);
+    Receiver_SwapState(receiver);
+
+    char payload[RDT_PKTSIZE];
+    memset(payload, 'x', sizeof(payload));
+    struct message msg = {Layout::max_payload, payload};
+    for (long long i=0; i<ops; i++) {
+	bench_time += 1e-6;
+	Sender_FromUpperLayer(&msg);
+	Receiver_FromLowerLayer(&to_receiver);
+	Sender_FromLowerLayer(&to_sender);
+    }
+
+    Sender_SwapState(sender);
+    Receiver_SwapState(receiver);
+    Sender_FreeState(sender);
+    Receiver_FreeState(receiver);
+}
+
+static void bench_timer_chain(long long ops)
+{
+    struct sender_state *sender = Sender_NewState();
+    Sender_SwapState(sender);
+
+    /* the blocks are removed through the iterators kept for them, as the
+       sender does with the timers of its window */
+    std::list<TimerChainBlock>::iterator blocks[64];
+    std::list<WindowSlot>::iterator no_slot;
+    for (int i=0; i<64; i++)
+	blocks[i] = AddTimer(i, bench_time + i*1e-6, TIMER_RETRANSMIT, no_slot);
+    for (long long i=0; i<ops; i++) {
+	bench_time += 1e-6;
+	EraseTimer(blocks[i % 64]);
+	blocks[i % 64] = AddTimer(i + 64, bench_time + 64e-6, TIMER_RETRANSMIT, no_slot);
+    }
+
+    Sender_SwapState(sender);
+    Sender_FreeState(sender);
+}
+
+static void bench_reorder_insert(long long ops)
+{
+    /* a fixed random order of 64 seqs, all ahead of the one expected */
+    int order[64];
+    for (int i=0; i<64; i++)
+	order[i] = i;
+    unsigned int lcg = 1;
+    for (int i=63; i>0; i--) {
+	lcg = lcg*1103515245 + 12345;
+	std::swap(order[i], order[(lcg>>16) % (i+1)]);
+    }
+
+    struct packet pkt;
+    char payload[RDT_PKTSIZE];
+    memset(payload, 'x', sizeof(payload));
+    FillPacket(&pkt, Layout::max_payload, 0, 1, payload);
+    struct receiver_state *receiver = NULL;
+    for (long long i=0; i<ops; i++) {
+	if (i%64==0) {
+	    if (receiver!=NULL) {
+		Receiver_SwapState(receiver);
+		Receiver_FreeState(receiver);
+	    }
+	    receiver = Receiver_NewState();
+	    Receiver_SwapState(receiver);
+	}
+	SetPacketSeq(&pkt, 2 + order[i%64]);
+	InsertIntoBuffer(&pkt);
+    }
+    Receiver_SwapState(receiver);
+    Receiver_FreeState(receiver);
+}
+
+struct micro {
+    const char *name;
+    void (*run)(long long ops);
+};
+
+struct micro micros[] = {
+    {"checksum", bench_checksum},
+    {"fill_packet", bench_fill_packet},
+    {"parse_packet", bench_parse_packet},
+    {"window", bench_window},
+    {"timer_chain", bench_timer_chain},
+    {"reorder_insert", bench_reorder_insert},
+};
+
+static struct result *new_result(const char *name, const char *unit, bool lower_is_better)
+{
+    struct result r;
+    snprintf(r.name, sizeof(r.name), "%s", name);
+    snprintf(r.unit, sizeof(r.unit), "%s", unit);
+    r.lower_is_better = lower_is_better;
+    r.mean = r.stddev = 0;
+    r.n = 0;
+    results.push_back(r);
+    return &results.back();
+}
+
+static void run_micros()
+{
+    for (struct micro &m : micros) {
+	struct result *r = new_result(m.name, "ns/op", true);
+	/* one run to warm the caches up */
+	m.run(micro_ops/10);
+	for (int i=0; i<runs; i++) {
+	    double start = wall_clock();
+	    m.run(micro_ops);
+	    r->samples.push_back((wall_clock() - start)*1e9/micro_ops);
+	}
+    }
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  macro benchmarks
+  []------------------------------------------------------------------------[]*/
+
+static void run_macros()
+{
+    for (struct scenario &s : scenarios) {
+	/* events per second, goodput and p99 latency, in this order */
+	size_t first = results.size();
+	char name[64];
+	snprintf(name, sizeof(name), "%s:events", s.name);
+	new_result(name, "events/s", false);
+	snprintf(name, sizeof(name), "%s:goodput", s.name);
+	new_result(name, "B/s", false);
+	snprintf(name, sizeof(name), "%s:p99", s.name);
+	new_result(name, "s", true);
+
+	for (int i=0; i<runs; i++) {
+	    char cmd[512];
+	    snprintf(cmd, sizeof(cmd), "%s -T %s </dev/null", sim_binary, s.args);
+	    FILE *fp = popen(cmd, "r");
+	    if (fp==NULL) {
+		perror(sim_binary);
+		exit(-1);
+	    }
+	    char line[512];
+	    double end = 0, rate = 0, p50, latency = 0;
+	    long long chars = 0;
+	    bool ok = false;
+	    while (fgets(line, sizeof(line), fp)!=NULL) {
+		sscanf(line, "## Simulation completed at time %lfs", &end);
+		if (strstr(line, " characters delivered")!=NULL)
+		    sscanf(line, "%lld", &chars);
+		sscanf(line, "\tmessage latency is %lfs at p50 and %lfs at p99", &p50, &latency);
+		sscanf(line, "\t%*d events handled in %*fs of wall time, %lf per second", &rate);
+		if (strncmp(line, "## Congratulations!", 19)==0)
+		    ok = true;
+	    }
+	    if (pclose(fp)!=0 || !ok || end<=0 || rate<=0) {
+		fprintf(stderr, "%s -T %s did not complete\n", sim_binary, s.args);
+		exit(-1);
+	    }
+	    results[first].samples.push_back(rate);
+	    results[first+1].samples.push_back(chars/end);
+	    results[first+2].samples.push_back(latency);
+	}
+    }
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  statistics and baselines
+  []------------------------------------------------------------------------[]*/
+
+static void summarize(struct result &r)
+{
+    r.n = r.samples.size();
+    double sum = 0;
+    for (double x : r.samples)
+	sum += x;
+    r.mean = sum/r.n;
+    double sq = 0;
+    for (double x : r.samples)
+	sq += (x - r.mean)*(x - r.mean);
+    r.stddev = r.n>1 ? sqrt(sq/(r.n - 1)) : 0;
+}
+
+/* the one-sided critical value of Student's t at 1%, rounding the degrees of
+   freedom down */
+static double t_critical(double df)
+{
+    static const struct {
+	double df, t;
+    } table[] = {
+	{1, 31.821}, {2, 6.965}, {3, 4.541}, {4, 3.747}, {5, 3.365}, {6, 3.143},
+	{7, 2.998}, {8, 2.896}, {9, 2.821}, {10, 2.764}, {12, 2.681}, {15, 2.602},
+	{20, 2.528}, {30, 2.457}, {60, 2.390}, {120, 2.358}};
+    double t = 2.326;
+    for (int i=sizeof(table)/sizeof(table[0])-1; i>=0; i--)
+	if (df<table[i].df)
+	    t = i>0 ? table[i-1].t : table[0].t;
+    return t;
+}
+
+static void write_baseline(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp==NULL) {
+	perror(path);
+	exit(-1);
+    }
+    fprintf(fp, "{\n  \"rdt_bench\": 1,\n  \"packet_size\": %d,\n  \"results\": [\n", RDT_PKTSIZE);
+    for (size_t i=0; i<results.size(); i++) {
+	struct result &r = results[i];
+	fprintf(fp, "    {\"name\": \"%s\", \"unit\": \"%s\", \"better\": \"%s\", "
+		"\"n\": %d, \"mean\": %.9g, \"stddev\": %.9g}%s\n", r.name, r.unit,
+		r.lower_is_better ? "lower" : "higher", r.n, r.mean, r.stddev,
+		i+1<results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    if (fclose(fp)!=0) {
+	perror(path);
+	exit(-1);
+    }
+}
+
+/* the results of a baseline written by write_baseline(), a line each */
+static std::vector<struct result> read_baseline(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp==NULL) {
+	perror(path);
+	exit(-1);
+    }
+    std::vector<struct result> baseline;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)!=NULL) {
+	struct result r;
+	char better[16];
+	if (sscanf(line, " {\"name\": \"%63[^\"]\", \"unit\": \"%15[^\"]\", \"better\": "
+		   "\"%15[^\"]\", \"n\": %d, \"mean\": %lf, \"stddev\": %lf}", r.name, r.unit,
+		   better, &r.n, &r.mean, &r.stddev)!=6)
+	    continue;
+	r.lower_is_better = strcmp(better, "lower")==0;
+	baseline.push_back(r);
+    }
+    fclose(fp);
+    if (baseline.empty()) {
+	fprintf(stderr, "%s: not an rdt_bench baseline\n", path);
+	exit(-1);
+    }
+    return baseline;
+}
+
+/* compare with a baseline, return the number of significant slowdowns */
+static int compare(const char *path)
+{
+    std::vector<struct result> baseline = read_baseline(path);
+    int slower = 0;
+    printf("%-22s %10s %23s %23s %9s\n", "benchmark", "unit", "baseline", "now", "change");
+    for (struct result &r : results) {
+	struct result *b = NULL;
+	for (struct result &c : baseline)
+	    if (strcmp(c.name, r.name)==0)
+		b = &c;
+	if (b==NULL) {
+	    printf("%-22s %10s %23s %14.4g ±%7.2g %9s\n", r.name, r.unit, "-", r.mean,
+		   r.stddev, "new");
+	    continue;
+	}
+	/* positive when worse */
+	double change = b->mean!=0 ? (r.mean - b->mean)/b->mean : 0;
+	if (!r.lower_is_better)
+	    change = -change;
+
+	/* Welch's t-test, or no test when neither side varies */
+	double va = b->stddev*b->stddev/b->n, vb = r.stddev*r.stddev/r.n;
+	bool significant;
+	if (va + vb==0)
+	    significant = change!=0;
+	else {
+	    double t = fabs(r.mean - b->mean)/sqrt(va + vb);
+	    double df = (va + vb)*(va + vb)/
+		((b->n>1 ? va*va/(b->n - 1) : 0) + (r.n>1 ? vb*vb/(r.n - 1) : 0));
+	    significant = t>t_critical(df);
+	}
+	const char *verdict = "";
+	if (change>threshold && significant) {
+	    verdict = "  SLOWER";
+	    slower ++;
+	} else if (change< -threshold && significant)
+	    verdict = "  faster";
+	printf("%-22s %10s %14.4g ±%7.2g %14.4g ±%7.2g %+8.1f%%%s\n", r.name, r.unit,
+	       b->mean, b->stddev, r.mean, r.stddev,
+	       (r.lower_is_better ? change : -change)*100, verdict);
+    }
+    return slower;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main routine
+  []------------------------------------------------------------------------[]*/
+
+int main(int argc, char *argv[])
+{
+    const char *out_file = NULL, *compare_file = NULL;
+    bool micro = true, macro = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:N:t:s:o:c:m:")) != -1) {
+	switch (opt) {
+	case 'n':
+	    runs = atoi(optarg);
+	    break;
+	case 'N':
+	    micro_ops = atoll(optarg);
+	    break;
+	case 't':
+	    threshold = atof(optarg)/100;
+	    break;
+	case 's':
+	    sim_binary = optarg;
+	    break;
+	case 'o':
+	    out_file = optarg;
+	    break;
+	case 'c':
+	    compare_file = optarg;
+	    break;
+	case 'm':
+	    micro = strcmp(optarg, "macro")!=0;
+	    macro = strcmp(optarg, "micro")!=0;
+	    break;
+	default:
+	    runs = 0;
+	    break;
+	}
+    }
+    if (runs<2 || micro_ops<=0 || threshold<0 || optind!=argc) {
+	fprintf(stderr, "usage: %s [-n <runs>] [-N <micro_ops>] [-t <threshold_percent>] "
+		"[-s <rdt_sim>] [-m micro|macro|all] [-o <baseline>] [-c <baseline>]\n", argv[0]);
+	exit(-1);
+    }
+
+    if (micro)
+	run_micros();
+    if (macro)
+	run_macros();
+    for (struct result &r : results)
+	summarize(r);
+
+    int slower = 0;
+    if (compare_file!=NULL)
+	slower = compare(compare_file);
+    else
+	for (struct result &r : results)
+	    printf("%-22s %10s %14.4g ±%7.2g\n", r.name, r.unit, r.mean, r.stddev);
+    if (out_file!=NULL)
+	write_baseline(out_file);
+
+    if (slower>0) {
+	printf("## %d benchmarks are significantly slower than %s\n", slower, compare_file);
+	return 1;
+    }
+    return 0;
+}
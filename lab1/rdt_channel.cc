@@ -0,0 +1,442 @@
+/*
+ * FILE: rdt_channel.cc
+ * DESCRIPTION: The impairment models of rdt_channel.h.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "rdt_channel.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  independent losses
+  []------------------------------------------------------------------------[]*/
+
+ChannelModel::ChannelModel(double loss_rate, double corrupt_rate, double outoforder_rate,
+			   double latency)
+    : loss_rate(loss_rate), corrupt_rate(corrupt_rate), outoforder_rate(outoforder_rate),
+      normal_latency(latency)
+{
+}
+
+bool ChannelModel::lose(double now, int dir)
+{
+    return Channel_Random()<loss_rate;
+}
+
+bool ChannelModel::corrupt(double now, int dir)
+{
+    return Channel_Random()<corrupt_rate;
+}
+
+void ChannelModel::corrupt_bytes(char *data, int size, int dir)
+{
+    for (int i=0; i<size; i++) {
+	data[i] = data[i] + (char)(Channel_Random()*20) - 10;
+    }
+}
+
+double ChannelModel::latency(double now, int dir)
+{
+    if (Channel_Random()<outoforder_rate)
+	return normal_latency*2.0*Channel_Random();
+    return normal_latency;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  Gilbert-Elliott
+  []------------------------------------------------------------------------[]*/
+
+GilbertElliott::GilbertElliott(double p, double r, double loss_good, double loss_bad,
+			       double corrupt_rate, double outoforder_rate, double latency)
+    : ChannelModel(0, corrupt_rate, outoforder_rate, latency),
+      p(p), r(r), loss_good(loss_good), loss_bad(loss_bad), bursts(0)
+{
+    bad[0] = bad[1] = false;
+    memset(pkts, 0, sizeof(pkts));
+    memset(lost, 0, sizeof(lost));
+}
+
+bool GilbertElliott::lose(double now, int dir)
+{
+    if (bad[dir]) {
+	if (Channel_Random()<r)
+	    bad[dir] = false;
+    } else if (Channel_Random()<p) {
+	bad[dir] = true;
+	bursts ++;
+    }
+    pkts[dir][bad[dir]] ++;
+    bool l = Channel_Random() < (bad[dir] ? loss_bad : loss_good);
+    if (l) lost[dir][bad[dir]] ++;
+    return l;
+}
+
+void GilbertElliott::describe(FILE *fp)
+{
+    /* the long-run share of the bad state */
+    double share = p+r>0 ? p/(p+r) : 0;
+    fprintf(fp, "\tGilbert-Elliott losses: p=%g r=%g, %.2f%% in the good state and "
+	    "%.2f%% in the bad one, %.2f%% on average in bursts of %.1f packets\n",
+	    p, r, loss_good*100.0, loss_bad*100.0,
+	    (share*loss_bad + (1-share)*loss_good)*100.0, r>0 ? 1/r : 0.0);
+}
+
+void GilbertElliott::report(FILE *fp)
+{
+    long long good = pkts[0][0] + pkts[1][0], in_bad = pkts[0][1] + pkts[1][1];
+    fprintf(fp, "\t%lld bad-state bursts, %lld of %lld packets sent in the bad state, "
+	    "%lld lost there and %lld in the good state\n",
+	    bursts, in_bad, good + in_bad, lost[0][1] + lost[1][1], lost[0][0] + lost[1][0]);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  periodic outages
+  []------------------------------------------------------------------------[]*/
+
+Outage::Outage(double period, double duration, double loss_rate, double corrupt_rate,
+	       double outoforder_rate, double latency)
+    : ChannelModel(loss_rate, corrupt_rate, outoforder_rate, latency),
+      period(period), duration(duration), lost_in_outage(0)
+{
+}
+
+bool Outage::lose(double now, int dir)
+{
+    double into = now - period*(long long) (now/period);
+    if (now>=period && into<duration) {
+	lost_in_outage ++;
+	return true;
+    }
+    return ChannelModel::lose(now, dir);
+}
+
+void Outage::describe(FILE *fp)
+{
+    fprintf(fp, "\tthe link is down for %.3fs every %.3fs\n", duration, period);
+}
+
+void Outage::report(FILE *fp)
+{
+    fprintf(fp, "\t%lld packets lost in outages\n", lost_in_outage);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  trace replay
+  []------------------------------------------------------------------------[]*/
+
+/* the trace is mapped rather than read, and the pages behind the packets
+   are dropped as they go by, so a trace of any length only takes a window
+   of memory */
+TraceChannel::TraceChannel(const char *path)
+    : ChannelModel(0, 0, 0, 0), path(path), next(0), dropped(0), current(0), wraps(0)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd<0) {
+	perror(path);
+	exit(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st)<0) {
+	perror(path);
+	exit(-1);
+    }
+    map_size = st.st_size;
+    if (map_size<sizeof(struct trace_header) + sizeof(uint32_t)) {
+	fprintf(stderr, "%s: not a trace, or an empty one\n", path);
+	exit(-1);
+    }
+    map = (char*) mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map==MAP_FAILED) {
+	perror(path);
+	exit(-1);
+    }
+    close(fd);
+
+    const struct trace_header *h = (const struct trace_header*) map;
+    if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic))!=0 || h->version!=TRACE_VERSION) {
+	fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+	exit(-1);
+    }
+    records = (const uint32_t*) (map + sizeof(struct trace_header));
+    num_records = (map_size - sizeof(struct trace_header))/sizeof(uint32_t);
+    madvise(map, map_size, MADV_SEQUENTIAL);
+}
+
+TraceChannel::~TraceChannel()
+{
+    munmap(map, map_size);
+}
+
+bool TraceChannel::lose(double now, int dir)
+{
+    if (next==num_records) {
+	next = 0;
+	dropped = 0;
+	wraps ++;
+    }
+    current = records[next++];
+
+    /* drop the whole pages of the window behind */
+    size_t offset = (const char*) &records[next] - map;
+    if (offset - dropped >= 2*TRACE_WINDOW) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t upto = (offset - TRACE_WINDOW)/page*page;
+	madvise(map + dropped, upto - dropped, MADV_DONTNEED);
+	dropped = upto;
+    }
+    return (current & TRACE_LOST)!=0;
+}
+
+bool TraceChannel::corrupt(double now, int dir)
+{
+    return (current & TRACE_CORRUPTED)!=0;
+}
+
+double TraceChannel::latency(double now, int dir)
+{
+    return (current & TRACE_DELAY_MASK)*1e-6;
+}
+
+void TraceChannel::describe(FILE *fp)
+{
+    fprintf(fp, "\tlosses, corruption and delays replayed from %s (%zu packets)\n",
+	    path, num_records);
+}
+
+void TraceChannel::report(FILE *fp)
+{
+    fprintf(fp, "\t%lld packets replayed from the trace",
+	    (long long) wraps*num_records + next);
+    if (wraps>0)
+	fprintf(fp, ", which started over %lld times", wraps);
+    fprintf(fp, "\n");
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  record and replay
+  []------------------------------------------------------------------------[]*/
+
+ChannelRecorder::ChannelRecorder(ChannelModel *model, const char *path)
+    : ChannelModel(0, 0, 0, model->normal()), model(model), path(path), flags(0)
+{
+    fp = fopen(path, "wb");
+    if (fp==NULL) {
+	perror(path);
+	exit(-1);
+    }
+    setvbuf(fp, NULL, _IOFBF, TRACE_WINDOW);
+    struct trace_header h = {};
+    memcpy(h.magic, CHANLOG_MAGIC, sizeof(h.magic));
+    h.version = CHANLOG_VERSION;
+    fwrite(&h, sizeof(h), 1, fp);
+    records[0] = records[1] = 0;
+}
+
+ChannelRecorder::~ChannelRecorder()
+{
+    if (fclose(fp)!=0)
+	perror(path);
+    delete model;
+}
+
+bool ChannelRecorder::lose(double now, int dir)
+{
+    records[dir] ++;
+    flags = dir==CHANNEL_TO_SENDER ? CHANLOG_TO_SENDER : 0;
+    deltas.clear();
+    if (!model->lose(now, dir))
+	return false;
+    flags |= CHANLOG_LOST;
+    fputc(flags, fp);
+    return true;
+}
+
+bool ChannelRecorder::corrupt(double now, int dir)
+{
+    if (!model->corrupt(now, dir))
+	return false;
+    flags |= CHANLOG_CORRUPTED;
+    return true;
+}
+
+void ChannelRecorder::corrupt_bytes(char *data, int size, int dir)
+{
+    deltas.assign(data, data + size);
+    model->corrupt_bytes(data, size, dir);
+    for (int i=0; i<size; i++)
+	deltas[i] = data[i] - deltas[i];
+}
+
+/* the last question about a packet, its record is complete */
+double ChannelRecorder::latency(double now, int dir)
+{
+    double l = model->latency(now, dir);
+    if (l!=normal_latency)
+	flags |= CHANLOG_LATENCY;
+    fputc(flags, fp);
+    if (flags & CHANLOG_LATENCY)
+	fwrite(&l, sizeof(l), 1, fp);
+    if (flags & CHANLOG_CORRUPTED) {
+	uint16_t size = deltas.size();
+	fwrite(&size, sizeof(size), 1, fp);
+	fwrite(deltas.data(), 1, size, fp);
+    }
+    return l;
+}
+
+void ChannelRecorder::describe(FILE *out)
+{
+    model->describe(out);
+    fprintf(out, "\tthe channel decisions are recorded to %s\n", path);
+}
+
+void ChannelRecorder::report(FILE *out)
+{
+    model->report(out);
+    fflush(fp);
+    fprintf(out, "\t%lld packets to the receiver and %lld to the sender recorded, "
+	    "%ld bytes of log\n", records[CHANNEL_TO_RECEIVER], records[CHANNEL_TO_SENDER],
+	    ftell(fp));
+}
+
+/* the log is mapped, and each direction reads its own records from it in
+   order, skipping over those of the other one */
+ChannelReplay::ChannelReplay(const char *path, double loss_rate, double corrupt_rate,
+			     double outoforder_rate, double latency)
+    : ChannelModel(loss_rate, corrupt_rate, outoforder_rate, latency), path(path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd<0) {
+	perror(path);
+	exit(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st)<0) {
+	perror(path);
+	exit(-1);
+    }
+    map_size = st.st_size;
+    if (map_size<sizeof(struct trace_header)) {
+	fprintf(stderr, "%s: not a channel log\n", path);
+	exit(-1);
+    }
+    map = (const unsigned char*) mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map==MAP_FAILED) {
+	perror(path);
+	exit(-1);
+    }
+    close(fd);
+
+    const struct trace_header *h = (const struct trace_header*) map;
+    if (memcmp(h->magic, CHANLOG_MAGIC, sizeof(h->magic))!=0 || h->version!=CHANLOG_VERSION) {
+	fprintf(stderr, "%s: not a version %d channel log\n", path, CHANLOG_VERSION);
+	exit(-1);
+    }
+    for (int dir=0; dir<2; dir++) {
+	next[dir] = sizeof(struct trace_header);
+	current[dir] = NULL;
+	replayed[dir] = beyond[dir] = 0;
+    }
+    madvise((void*) map, map_size, MADV_SEQUENTIAL);
+}
+
+ChannelReplay::~ChannelReplay()
+{
+    munmap((void*) map, map_size);
+}
+
+size_t ChannelReplay::record_size(size_t pos)
+{
+    unsigned char f = map[pos];
+    size_t size = 1;
+    if (f & CHANLOG_LATENCY)
+	size += sizeof(double);
+    if (f & CHANLOG_CORRUPTED) {
+	uint16_t n;
+	if (pos + size + sizeof(n) > map_size)
+	    return map_size - pos;
+	memcpy(&n, map + pos + size, sizeof(n));
+	size += sizeof(n) + n;
+    }
+    return std::min(size, map_size - pos);
+}
+
+bool ChannelReplay::lose(double now, int dir)
+{
+    unsigned char want = dir==CHANNEL_TO_SENDER ? CHANLOG_TO_SENDER : 0;
+    size_t pos = next[dir];
+    while (pos<map_size && (map[pos] & CHANLOG_TO_SENDER)!=want)
+	pos += record_size(pos);
+    if (pos>=map_size) {
+	next[dir] = map_size;
+	current[dir] = NULL;
+	beyond[dir] ++;
+	return ChannelModel::lose(now, dir);
+    }
+    next[dir] = pos + record_size(pos);
+    current[dir] = map + pos;
+    replayed[dir] ++;
+    return (map[pos] & CHANLOG_LOST)!=0;
+}
+
+bool ChannelReplay::corrupt(double now, int dir)
+{
+    if (current[dir]==NULL)
+	return ChannelModel::corrupt(now, dir);
+    return (current[dir][0] & CHANLOG_CORRUPTED)!=0;
+}
+
+void ChannelReplay::corrupt_bytes(char *data, int size, int dir)
+{
+    if (current[dir]==NULL) {
+	ChannelModel::corrupt_bytes(data, size, dir);
+	return;
+    }
+    const unsigned char *p = current[dir] + 1;
+    if (current[dir][0] & CHANLOG_LATENCY)
+	p += sizeof(double);
+    uint16_t n;
+    memcpy(&n, p, sizeof(n));
+    const signed char *delta = (const signed char*) (p + sizeof(n));
+    for (int i=0; i<size && i<n; i++)
+	data[i] = data[i] + delta[i];
+}
+
+double ChannelReplay::latency(double now, int dir)
+{
+    if (current[dir]==NULL)
+	return ChannelModel::latency(now, dir);
+    if (!(current[dir][0] & CHANLOG_LATENCY))
+	return normal_latency;
+    double l;
+    memcpy(&l, current[dir] + 1, sizeof(l));
+    return l;
+}
+
+void ChannelReplay::describe(FILE *fp)
+{
+    fprintf(fp, "\tthe channel decisions are replayed from %s\n", path);
+}
+
+void ChannelReplay::report(FILE *fp)
+{
+    fprintf(fp, "\t%lld packets to the receiver and %lld to the sender replayed",
+	    replayed[CHANNEL_TO_RECEIVER], replayed[CHANNEL_TO_SENDER]);
+    if (beyond[0]+beyond[1]>0)
+	fprintf(fp, ", %lld and %lld past the end of the log",
+		beyond[CHANNEL_TO_RECEIVER], beyond[CHANNEL_TO_SENDER]);
+    fprintf(fp, "\n");
+}
@@ -0,0 +1,239 @@
+/*
+ * FILE: rdt_channel.h
+ * DESCRIPTION: Impairment models of the simulated link, deciding for every
+ *       packet whether it is lost, whether it is corrupted and how long it
+ *       takes.  The default model draws each of these independently at the
+ *       configured rates; the others make losses come in bursts:
+ *
+ *       GilbertElliott   a good and a bad state per direction, with a loss
+ *                        rate of their own
+ *       Outage           the link is down for a while, periodically
+ *       TraceChannel     losses, corruption and delays replayed packet by
+ *                        packet from a trace file (see rdt_mktrace.cc),
+ *                        which is mapped into memory and streamed through
+ *
+ *       Whatever the model decides can be recorded to a channel log
+ *       (ChannelRecorder), and a ChannelReplay makes exactly the same
+ *       decisions again, packet by packet in each direction, for another
+ *       run of the same workload with a different protocol implementation.
+ */
+
+
+#ifndef _RDT_CHANNEL_H_
+#define _RDT_CHANNEL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+
+/* the two directions of the link */
+#define CHANNEL_TO_RECEIVER 0
+#define CHANNEL_TO_SENDER 1
+
+/* a trace file is TRACE_MAGIC and a version, followed by one 32-bit word
+   per packet in the byte order of the machine: the delay of the packet in
+   microseconds, or'ed with the flags */
+#define TRACE_MAGIC "RDTTRACE"
+#define TRACE_VERSION 1
+#define TRACE_LOST 0x80000000u
+#define TRACE_CORRUPTED 0x40000000u
+#define TRACE_DELAY_MASK 0x3fffffffu
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+/* consumed trace pages are dropped from memory this many bytes at a time */
+#define TRACE_WINDOW (1<<20)
+
+/* a channel log is CHANLOG_MAGIC and a version (in a trace_header),
+   followed by a record per packet in the order they were sent: a byte of
+   flags, the latency as a double unless it was the normal one, and for a
+   corrupted packet its size in 16 bits and the change to each of its
+   bytes */
+#define CHANLOG_MAGIC "RDTCHLOG"
+#define CHANLOG_VERSION 1
+#define CHANLOG_TO_SENDER 0x01
+#define CHANLOG_LOST 0x02
+#define CHANLOG_CORRUPTED 0x04
+#define CHANLOG_LATENCY 0x08
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines that the driver provides
+  []------------------------------------------------------------------------[]*/
+
+/* a random number in [0,1] */
+double Channel_Random();
+
+
+/*[]------------------------------------------------------------------------[]
+  |  impairment models
+  []------------------------------------------------------------------------[]*/
+
+/* the fate of a packet is asked for in this order: lose() first, and only
+   for a packet that is not lost corrupt(), corrupt_bytes() if it is
+   corrupted, and then latency().  the default model loses, corrupts and
+   delivers out of order at independent rates; a corrupted packet has every
+   byte changed by up to 10 either way, and a packet out of order takes
+   anything up to twice the normal latency */
+class ChannelModel
+{
+public:
+    ChannelModel(double loss_rate, double corrupt_rate, double outoforder_rate,
+		 double latency);
+    virtual ~ChannelModel() {}
+
+    virtual bool lose(double now, int dir);
+    virtual bool corrupt(double now, int dir);
+    virtual void corrupt_bytes(char *data, int size, int dir);
+    virtual double latency(double now, int dir);
+
+    /* the latency of a packet in order */
+    double normal() { return normal_latency; }
+
+    /* change the rates in the middle of a run */
+    void set_rates(double loss, double corrupt, double outoforder) {
+	loss_rate = loss;
+	corrupt_rate = corrupt;
+	outoforder_rate = outoforder;
+    }
+
+    /* a line each for the inputs and the report of the simulator, nothing
+       for the default model */
+    virtual void describe(FILE *fp) {}
+    virtual void report(FILE *fp) {}
+
+protected:
+    double loss_rate;
+    double corrupt_rate;
+    double outoforder_rate;
+    double normal_latency;
+};
+
+/* every packet moves the state of its direction from good to bad with
+   probability p, or from bad to good with probability r, and is then lost at
+   the rate of that state.  bursts last 1/r packets on average */
+class GilbertElliott : public ChannelModel
+{
+public:
+    GilbertElliott(double p, double r, double loss_good, double loss_bad,
+		   double corrupt_rate, double outoforder_rate, double latency);
+
+    bool lose(double now, int dir);
+    void describe(FILE *fp);
+    void report(FILE *fp);
+
+private:
+    double p, r, loss_good, loss_bad;
+    bool bad[2];
+    long long pkts[2][2];       /* per direction, in the good and bad state */
+    long long lost[2][2];
+    long long bursts;
+};
+
+/* the link is down from every multiple of period on for duration seconds,
+   and loses packets at the loss rate in between */
+class Outage : public ChannelModel
+{
+public:
+    Outage(double period, double duration, double loss_rate, double corrupt_rate,
+	   double outoforder_rate, double latency);
+
+    bool lose(double now, int dir);
+    void describe(FILE *fp);
+    void report(FILE *fp);
+
+private:
+    double period, duration;
+    long long lost_in_outage;
+};
+
+/* every packet, in either direction, takes the next record of the trace.
+   the trace starts over when it runs out */
+class TraceChannel : public ChannelModel
+{
+public:
+    TraceChannel(const char *path);
+    ~TraceChannel();
+
+    bool lose(double now, int dir);
+    bool corrupt(double now, int dir);
+    double latency(double now, int dir);
+    void describe(FILE *fp);
+    void report(FILE *fp);
+
+private:
+    const char *path;
+    char *map;
+    size_t map_size;
+    const uint32_t *records;
+    size_t num_records;
+    size_t next;                /* the record of the next packet */
+    size_t dropped;             /* bytes of the mapping dropped so far */
+    uint32_t current;           /* the record of the packet being decided */
+    long long wraps;
+};
+
+/* records every decision of another model to a channel log */
+class ChannelRecorder : public ChannelModel
+{
+public:
+    ChannelRecorder(ChannelModel *model, const char *path);
+    ~ChannelRecorder();
+
+    bool lose(double now, int dir);
+    bool corrupt(double now, int dir);
+    void corrupt_bytes(char *data, int size, int dir);
+    double latency(double now, int dir);
+    void describe(FILE *fp);
+    void report(FILE *fp);
+
+private:
+    ChannelModel *model;
+    const char *path;
+    FILE *fp;
+    unsigned char flags;        /* of the packet being decided */
+    std::vector<signed char> deltas;
+    long long records[2];
+};
+
+/* replays a channel log: the n-th packet in a direction gets the decisions
+   of the n-th packet recorded in that direction.  a corrupted packet larger
+   than the recorded one keeps the rest of its bytes, and packets past the
+   end of the log fall back on the default model */
+class ChannelReplay : public ChannelModel
+{
+public:
+    ChannelReplay(const char *path, double loss_rate, double corrupt_rate,
+		  double outoforder_rate, double latency);
+    ~ChannelReplay();
+
+    bool lose(double now, int dir);
+    bool corrupt(double now, int dir);
+    void corrupt_bytes(char *data, int size, int dir);
+    double latency(double now, int dir);
+    void describe(FILE *fp);
+    void report(FILE *fp);
+
+private:
+    /* the length of the record at pos */
+    size_t record_size(size_t pos);
+
+    const char *path;
+    const unsigned char *map;
+    size_t map_size;
+    /* per direction: where to look for its next record, the record of the
+       packet being decided (NULL past the end of the log), and the packets
+       replayed and past the end */
+    size_t next[2];
+    const unsigned char *current[2];
+    long long replayed[2];
+    long long beyond[2];
+};
+
+#endif  /* _RDT_CHANNEL_H_ */
@@ -0,0 +1,136 @@
+/*
+ * FILE: rdt_coro.cc
+ * DESCRIPTION: The coroutine frame pool and the connection of rdt_coro.h.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_coro.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  frame pool
+  []------------------------------------------------------------------------[]*/
+
+struct frame_stats frame_stats = {0, 0};
+
+/* a free frame, linked into the list of its size class */
+struct free_frame {
+    struct free_frame *next;
+};
+static struct free_frame *free_frames[FRAME_POOL_MAX/FRAME_CLASS];
+
+void *frame_alloc(size_t size)
+{
+    frame_stats.allocs ++;
+    if (size>FRAME_POOL_MAX) {
+	frame_stats.fresh ++;
+	return ::operator new(size);
+    }
+    int cls = (size-1)/FRAME_CLASS;
+    struct free_frame *f = free_frames[cls];
+    if (f!=NULL) {
+	free_frames[cls] = f->next;
+	return f;
+    }
+    frame_stats.fresh ++;
+    return ::operator new((cls+1)*FRAME_CLASS);
+}
+
+void frame_free(void *frame, size_t size)
+{
+    if (size>FRAME_POOL_MAX) {
+	::operator delete(frame);
+	return;
+    }
+    int cls = (size-1)/FRAME_CLASS;
+    struct free_frame *f = (struct free_frame*) frame;
+    f->next = free_frames[cls];
+    free_frames[cls] = f;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  connection
+  []------------------------------------------------------------------------[]*/
+
+Connection::Connection()
+    : suspensions(0), blocked_since(0), tot_blocked(0), head(0), taken(0)
+{
+}
+
+Task Connection::send(struct message *msg, double deadline, int max_retransmit)
+{
+    while (!Sender_FromUpperLayer(msg, deadline, max_retransmit)) {
+	blocked_since = GetSimulationTime();
+	co_await writable_awaiter{this};
+	tot_blocked += GetSimulationTime() - blocked_since;
+    }
+}
+
+void Connection::writable_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    conn->suspensions ++;
+    conn->blocked_sender = h;
+}
+
+void Connection::writable()
+{
+    if (!blocked_sender) return;
+    Coro_Schedule(blocked_sender, GetSimulationTime());
+    blocked_sender = nullptr;
+}
+
+double Connection::blocked_time()
+{
+    if (blocked_sender)
+	return tot_blocked + GetSimulationTime() - blocked_since;
+    return tot_blocked;
+}
+
+void Connection::deliver(struct message *msg)
+{
+    data.insert(data.end(), msg->data, msg->data + msg->size);
+    sizes.push_back(msg->size);
+    if (waiting_receiver) {
+	Coro_Schedule(waiting_receiver, GetSimulationTime());
+	waiting_receiver = nullptr;
+    }
+}
+
+void Connection::recv_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+    conn->suspensions ++;
+    conn->waiting_receiver = h;
+}
+
+struct message Connection::recv_awaiter::await_resume()
+{
+    /* the message handed out last is done with now */
+    conn->head += conn->taken;
+    if (conn->head==conn->data.size()) {
+	conn->data.clear();
+	conn->head = 0;
+    } else if (conn->head>conn->data.size()/2) {
+	conn->data.erase(conn->data.begin(), conn->data.begin() + conn->head);
+	conn->head = 0;
+    }
+
+    struct message msg;
+    msg.size = conn->sizes.front();
+    msg.data = conn->data.data() + conn->head;
+    conn->sizes.pop_front();
+    conn->taken = msg.size;
+    return msg;
+}
+
+Connection::sleep_awaiter Connection::sleep(double seconds)
+{
+    suspensions ++;
+    return sleep_awaiter{GetSimulationTime() + seconds};
+}
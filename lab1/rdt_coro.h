@@ -0,0 +1,176 @@
+/*
+ * FILE: rdt_coro.h
+ * DESCRIPTION: An awaitable interface to the rdt layer, for upper layers
+ *       written as C++20 coroutines instead of callbacks:
+ *
+ *           co_await conn.send(msg);              // waits while pushed back
+ *           struct message msg = co_await conn.recv();
+ *           co_await conn.sleep(seconds);
+ *
+ *       A coroutine is never resumed from inside an rdt layer routine: the
+ *       connection asks the driver to resume it through Coro_Schedule(),
+ *       from the driver's own event loop.  Coroutine frames come from a
+ *       pool of free lists, so a coroutine per message does not hit the
+ *       heap once the pool is warm.
+ */
+
+
+#ifndef _RDT_CORO_H_
+#define _RDT_CORO_H_
+
+#include <stdlib.h>
+#include <coroutine>
+#include <deque>
+#include <vector>
+
+#include "rdt_struct.h"
+
+
+/* frames are recycled through free lists of FRAME_CLASS-byte size classes
+   up to FRAME_POOL_MAX bytes, larger ones come from the heap every time */
+#define FRAME_CLASS 64
+#define FRAME_POOL_MAX 1024
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines that the driver provides
+  []------------------------------------------------------------------------[]*/
+
+/* resume a suspended coroutine from the event loop at time when (in
+   seconds, the time of GetSimulationTime()) */
+void Coro_Schedule(std::coroutine_handle<> h, double when);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  coroutine frames and tasks
+  []------------------------------------------------------------------------[]*/
+
+struct frame_stats {
+    long long allocs;           /* frames handed out */
+    long long fresh;            /* of which came from the heap */
+};
+extern struct frame_stats frame_stats;
+
+void *frame_alloc(size_t size);
+void frame_free(void *frame, size_t size);
+
+/* a coroutine that starts suspended and owns its frame.  start() runs a
+   top-level one, and co_await runs one to completion inside another */
+class Task
+{
+public:
+    struct promise_type {
+	std::coroutine_handle<> continuation;
+
+	static void *operator new(size_t size) { return frame_alloc(size); }
+	static void operator delete(void *frame, size_t size) { frame_free(frame, size); }
+
+	Task get_return_object() {
+	    return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+	}
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	/* pass control back to the awaiting coroutine, if any */
+	struct final_awaiter {
+	    bool await_ready() noexcept { return false; }
+	    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+		if (h.promise().continuation)
+		    return h.promise().continuation;
+		return std::noop_coroutine();
+	    }
+	    void await_resume() noexcept {}
+	};
+	final_awaiter final_suspend() noexcept { return {}; }
+
+	void return_void() {}
+	void unhandled_exception() { abort(); }
+    };
+
+    Task(Task &&other) : h(other.h) { other.h = nullptr; }
+    Task(const Task &) = delete;
+    ~Task() { if (h) h.destroy(); }
+
+    void start() { h.resume(); }
+    bool done() { return h.done(); }
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+	h.promise().continuation = awaiting;
+	return h;
+    }
+    void await_resume() {}
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) : h(h) {}
+
+    std::coroutine_handle<promise_type> h;
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  connection
+  []------------------------------------------------------------------------[]*/
+
+/* the upper layer's end of the rdt layer, on both the sender and the
+   receiver.  one coroutine may wait in send() and one in recv() at a time */
+class Connection
+{
+public:
+    Connection();
+
+    /* pass a message to the rdt layer, waiting while it pushes back.  the
+       message is the caller's again when this completes */
+    Task send(struct message *msg, double deadline = 0, int max_retransmit = -1);
+
+    /* the next message delivered at the receiver.  its data stays valid
+       until the coroutine suspends again */
+    struct recv_awaiter {
+	Connection *conn;
+	bool await_ready() { return !conn->sizes.empty(); }
+	void await_suspend(std::coroutine_handle<> h);
+	struct message await_resume();
+    };
+    recv_awaiter recv() { return recv_awaiter{this}; }
+
+    /* let the given time pass */
+    struct sleep_awaiter {
+	double until;
+	bool await_ready() { return false; }
+	void await_suspend(std::coroutine_handle<> h) { Coro_Schedule(h, until); }
+	void await_resume() {}
+    };
+    sleep_awaiter sleep(double seconds);
+
+    /* for the driver: call from Sender_UpperLayerWritable() and
+       Receiver_ToUpperLayer() */
+    void writable();
+    void deliver(struct message *msg);
+
+    /* how long send() has been pushed back so far */
+    double blocked_time();
+
+    /* times a coroutine suspended on the connection */
+    long long suspensions;
+
+private:
+    struct writable_awaiter {
+	Connection *conn;
+	bool await_ready() { return false; }
+	void await_suspend(std::coroutine_handle<> h);
+	void await_resume() {}
+    };
+
+    std::coroutine_handle<> blocked_sender;
+    double blocked_since;
+    double tot_blocked;
+
+    /* the delivered messages back to back from head on, with their sizes,
+       and the size of the one last handed out */
+    std::coroutine_handle<> waiting_receiver;
+    std::vector<char> data;
+    size_t head;
+    std::deque<int> sizes;
+    int taken;
+};
+
+#endif  /* _RDT_CORO_H_ */
@@ -0,0 +1,153 @@
+/*
+ * FILE: rdt_duplex.cc
+ * DESCRIPTION: The two connections and the ack bundling of rdt_duplex.h.
+ */
+
+
+#include <string.h>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_duplex.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  connections
+  []------------------------------------------------------------------------[]*/
+
+int running_conn = 0;
+
+/* the sender and the receiver of the connection not running */
+static struct sender_state *idle_sender = NULL;
+static struct receiver_state *idle_receiver = NULL;
+
+void Duplex_Run(int c)
+{
+    if (running_conn==c) return;
+    Sender_SwapState(idle_sender);
+    Receiver_SwapState(idle_receiver);
+    running_conn = c;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  ack bundling
+  []------------------------------------------------------------------------[]*/
+
+static double ack_delay = 0;
+
+/* the acks held at each end, and whether their timer is running */
+static struct held_acks {
+    std::vector<char> bytes;
+    std::vector<int> sizes;
+    bool timer_set;
+} held_acks[2];
+
+static long long duplex_pkts = 0, duplex_data = 0, duplex_acks = 0, acks_on_data = 0;
+
+/* send a packet from end e: a data packet of size bytes, if size is not 0,
+   and the acks held at e along with it */
+static void send_from_end(int e, struct packet *pkt, int size)
+{
+    struct held_acks *h = &held_acks[e];
+    if (h->timer_set) {
+	Duplex_StopAckTimer(e);
+	h->timer_set = false;
+    }
+    struct duplex_packet dp;
+    dp.from = e;
+    dp.data_size = size;
+    if (size>0)
+	dp.wire.assign(pkt->data, pkt->data + size);
+    dp.wire.insert(dp.wire.end(), h->bytes.begin(), h->bytes.end());
+    dp.ack_sizes.swap(h->sizes);
+    h->bytes.clear();
+
+    duplex_pkts ++;
+    duplex_data += size>0;
+    duplex_acks += dp.ack_sizes.size();
+    if (size>0)
+	acks_on_data += dp.ack_sizes.size();
+
+    Duplex_ToLink(&dp);
+}
+
+void Duplex_ToLowerLayer(bool data, struct packet *pkt, int size)
+{
+    int e = data ? running_conn : 1-running_conn;
+    if (data) {
+	send_from_end(e, pkt, size);
+	return;
+    }
+
+    struct held_acks *h = &held_acks[e];
+    if (!h->sizes.empty() && h->bytes.size() + size > RDT_PKTSIZE)
+	send_from_end(e, NULL, 0);
+    h->bytes.insert(h->bytes.end(), pkt->data, pkt->data + size);
+    h->sizes.push_back(size);
+    if (ack_delay==0)
+	send_from_end(e, NULL, 0);
+    else if (!h->timer_set) {
+	Duplex_StartAckTimer(e, ack_delay);
+	h->timer_set = true;
+    }
+}
+
+void Duplex_FromLink(struct duplex_packet *dp, bool marked)
+{
+    /* the data first, whose ack may then ride on what the acks let this end
+       send */
+    struct packet pkt;
+    if (dp->data_size>0) {
+	memcpy(pkt.data, dp->wire.data(), dp->data_size);
+	memset(&pkt.data[dp->data_size], 0, RDT_PKTSIZE-dp->data_size);
+	Duplex_Run(dp->from);
+	Duplex_ReceiverFromLowerLayer(&pkt, marked);
+    }
+    int offset = dp->data_size;
+    for (int size : dp->ack_sizes) {
+	memcpy(pkt.data, &dp->wire[offset], size);
+	memset(&pkt.data[size], 0, RDT_PKTSIZE-size);
+	offset += size;
+	Duplex_Run(1-dp->from);
+	Duplex_SenderFromLowerLayer(&pkt);
+    }
+}
+
+void Duplex_AckTimeout(int end)
+{
+    held_acks[end].timer_set = false;
+    send_from_end(end, NULL, 0);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  setting up and reporting
+  []------------------------------------------------------------------------[]*/
+
+void Duplex_Init(double delay)
+{
+    ack_delay = delay;
+    idle_sender = Sender_NewState();
+    idle_receiver = Receiver_NewState();
+}
+
+void Duplex_Final()
+{
+    Duplex_Run(0);
+    Sender_FreeState(idle_sender);
+    Receiver_FreeState(idle_receiver);
+    idle_sender = NULL;
+    idle_receiver = NULL;
+}
+
+void Duplex_Report(FILE *out)
+{
+    fprintf(out, "\t%lld packets sent for %lld data packets and %lld acks: %lld acks rode "
+	    "on data, the others went in %lld packets of their own\n", duplex_pkts,
+	    duplex_data, duplex_acks, acks_on_data, duplex_pkts - duplex_data);
+    fprintf(out, "\t%.1f%% fewer packets than with every ack in a packet of its own\n",
+	    duplex_data + duplex_acks ?
+	    100.0 - duplex_pkts*100.0/(duplex_data + duplex_acks) : 0.0);
+}
@@ -0,0 +1,89 @@
+/*
+ * FILE: rdt_duplex.h
+ * DESCRIPTION: Full duplex for the simulator: both ends of the link send
+ *       messages, the receiver's end over a second connection (conn 1) with
+ *       a sender and a receiver of its own.  The states of the connection
+ *       not running wait in a pair of idle ones and are swapped in by
+ *       Duplex_Run() whenever one of its handlers is about to run.
+ *
+ *       End 0 is the sender's end of the link and end 1 the receiver's; the
+ *       data packets of connection c leave end c and its acks end 1-c.  An
+ *       end holds the acks it sends for the ack delay, and they ride on the
+ *       first data packet it sends by then, or go out bundled in a packet of
+ *       their own at the end of it (a packet's worth at most).
+ *
+ *       The duplex layer sits behind Sender_ToLowerLayer() and
+ *       Receiver_ToLowerLayer(): the driver passes it what they are given,
+ *       and gets back whole packets to carry over the link, which it hands
+ *       to Duplex_FromLink() at the other end.
+ */
+
+
+#ifndef _RDT_DUPLEX_H_
+#define _RDT_DUPLEX_H_
+
+#include <stdio.h>
+#include <vector>
+
+#include "rdt_struct.h"
+
+
+/* a packet on the link in full duplex: the bytes of the data packet of the
+   connection sending from the end it leaves, if any, followed by those of
+   the acks bundled with it for the connection sending from the other end */
+struct duplex_packet {
+    int from;               /* the end it leaves */
+    int data_size;          /* 0 for acks alone */
+    std::vector<char> wire;
+    std::vector<int> ack_sizes;
+};
+
+/* the connection whose sender and receiver are running */
+extern int running_conn;
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines that the driver provides
+  []------------------------------------------------------------------------[]*/
+
+/* carry a packet over the link from end dp->from, taking what it holds, and
+   pass it to Duplex_FromLink() at the other end unless it gets lost */
+void Duplex_ToLink(struct duplex_packet *dp);
+
+/* start and stop the timer of the acks held at an end, Duplex_AckTimeout()
+   is called when it expires */
+void Duplex_StartAckTimer(int end, double timeout);
+void Duplex_StopAckTimer(int end);
+
+/* pass a data packet to the running receiver, and an ack to the running
+   sender; marked tells whether the link queue has marked the packet */
+void Duplex_ReceiverFromLowerLayer(struct packet *pkt, bool marked);
+void Duplex_SenderFromLowerLayer(struct packet *pkt);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines of the duplex layer
+  []------------------------------------------------------------------------[]*/
+
+/* set up the idle states of connection 1, whose acks wait ack_delay for data
+   to ride on (0 means they go out at once), and free them again */
+void Duplex_Init(double ack_delay);
+void Duplex_Final();
+
+/* make the sender and the receiver of connection c the running ones */
+void Duplex_Run(int c);
+
+/* pass a data packet or an ack of the running connection to its end of the
+   link, only the first size bytes are carried */
+void Duplex_ToLowerLayer(bool data, struct packet *pkt, int size);
+
+/* a packet has reached the end of the link opposite dp->from */
+void Duplex_FromLink(struct duplex_packet *dp, bool marked);
+
+/* the acks held at an end have waited long enough */
+void Duplex_AckTimeout(int end);
+
+/* print how many packets the acks have saved */
+void Duplex_Report(FILE *out);
+
+#endif  /* _RDT_DUPLEX_H_ */
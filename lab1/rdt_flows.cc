@@ -0,0 +1,1485 @@
+/*
+ * FILE: rdt_flows.cc
+ * DESCRIPTION: Simulates many reliable data transfer flows at once, sharing
+ *       one bottleneck link, for fairness and scaling studies.  Each flow
+ *       has its own sender and receiver state (swapped in and out through
+ *       Sender_SwapState() and Receiver_SwapState()), its own message
+ *       generator, start time and round-trip time.  The data packets of all
+ *       flows queue for the bottleneck in one drop-tail queue, half way to
+ *       their receivers, the acks come back over uncongested paths.  Events
+ *       are kept in binary heaps, so a run with thousands of flows costs
+ *       about the same per packet as one with a single flow.
+ *
+ *       The senders, the receivers and the bottleneck are nodes, spread over
+ *       partitions that run on threads of their own.  The partitions advance
+ *       in windows as long as the shortest link delay (the lookahead): no
+ *       packet sent inside a window can arrive at another partition before
+ *       the window ends, so every partition runs its window on its own and
+ *       hands the packets for the others over at the end (conservative
+ *       parallel simulation with YAWNS windows).  Every node draws its own
+ *       random numbers, and events at the same time are ordered by the node
+ *       that scheduled them, so a run gives the same results on any number
+ *       of threads.
+ *
+ *       With a topology file (-T), the flows run across a network of hosts
+ *       and store-and-forward routers instead: every link has a bandwidth,
+ *       a delay, a queue per direction and its own loss and corruption, and
+ *       the routers forward along the shortest paths.  The report gives the
+ *       queueing delay and the drops of every hop.
+ *
+ *       Built with -DRDT_CONN_ID (make rdt_flows_demux), -d makes the
+ *       receivers of every flow one receiver, which tells the flows apart by
+ *       the connection id in the header (Receiver_Demux()) and evicts the
+ *       connections that have been idle for a while.  The report gives the
+ *       cost of a lookup and the memory of an idle connection.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_packet.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+
+
+/* flows listed one by one in the report when there are at most this many,
+   unless asked for */
+#define LIST_FLOWS 16
+
+/* the fields written by different threads are kept on different cache
+   lines */
+#define CACHE_LINE 64
+
+/* hops listed one by one in the report of a topology when there are at most
+   this many, unless asked for */
+#define LIST_PORTS 64
+
+/* the nodes of flow i, and the network nodes after those of every flow: the
+   bottleneck, or the hosts and routers of the topology */
+#define SENDER_NODE(i) (2*(i))
+#define RECEIVER_NODE(i) (2*(i)+1)
+#define NET_NODE(k) (2*num_flows + (k))
+#define BOTTLENECK_NODE NET_NODE(0)
+
+/* random early detection: packets are dropped with a probability that grows
+   up to RED_MAX_P as the average backlog grows from a quarter to three
+   quarters of the queue, and all of them above that.  the average moves
+   RED_WEIGHT of the way to the backlog at every packet */
+#define RED_WEIGHT 0.002
+#define RED_MAX_P 0.1
+
+
+/*[]------------------------------------------------------------------------[]
+  |  event queue
+  []------------------------------------------------------------------------[]*/
+
+enum {EVENT_MSG_ARRIVAL=0, EVENT_TO_BOTTLENECK, EVENT_TO_RECEIVER, EVENT_TO_SENDER,
+      EVENT_SENDER_TIMEOUT, EVENT_TO_NODE, EVENT_EVICT};
+
+struct Event {
+    double sched_time;
+    int event_type;
+    int flow;
+
+    /* the node that scheduled it and the number of events that node had
+       scheduled before, which order the events at the same time */
+    int src;
+    unsigned int src_seq;
+
+    /* the next one in a mailbox */
+    Event *next;
+};
+
+/* a packet on its way to the bottleneck, the receiver or back to the
+   sender.  in a topology, it goes from network node to network node until it
+   is at its destination host, and is an ack on its way to the sender or a
+   data packet on its way to the receiver */
+struct EventPacket : public Event {
+    int at;
+    int dst;
+    bool ack;
+    int size;
+    struct packet pkt;
+};
+
+/* a binary heap of events, earliest first.  events at the same time come out
+   by the node that scheduled them, in the order it scheduled them: unlike the
+   order they were queued in, that does not depend on the partitions */
+class EventQueue
+{
+public:
+    EventQueue() : sim_time(0) {}
+
+    double time() { return sim_time; }
+
+    void schedule(Event *e) {
+	heap.push(entry{e->sched_time, e->src, e->src_seq, e});
+    }
+
+    /* the time of the next event, HUGE_VAL if there is none */
+    double next_time() {
+	return heap.empty() ? HUGE_VAL : heap.top().time;
+    }
+
+    /* advance to the next event before end, NULL if there is none */
+    Event *next_event(double end) {
+	if (heap.empty() || heap.top().time>=end) return NULL;
+	Event *e = heap.top().e;
+	sim_time = heap.top().time;
+	heap.pop();
+	return e;
+    }
+
+private:
+    struct entry {
+	double time;
+	int src;
+	unsigned int src_seq;
+	Event *e;
+    };
+    struct later {
+	bool operator()(const entry &a, const entry &b) const {
+	    if (a.time!=b.time) return a.time>b.time;
+	    if (a.src!=b.src) return a.src>b.src;
+	    return a.src_seq>b.src_seq;
+	}
+    };
+
+    std::priority_queue<entry, std::vector<entry>, later> heap;
+    double sim_time;
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  gloabal variables, statistics, etc.
+  []------------------------------------------------------------------------[]*/
+
+/* the workload, the same for every flow: the upper layer passes messages
+   until sim_time, every msg_arrivalint seconds and of msg_size bytes on
+   average */
+double sim_time;
+double msg_arrivalint;
+int msg_size;
+double outoforder_rate;
+double loss_rate;
+double corrupt_rate;
+int tracing_level;
+
+/* the bottleneck: bandwidth in bytes per second (0 means the link takes no
+   time to transmit a packet) and the bytes its queue holds */
+double link_bandwidth = 0;
+double queue_limit = 64*1024;
+double link_busy_until = 0;
+
+/* the flows, unless read from a flow file: how many, the spread of their
+   round-trip times, and the time over which their starts are spread */
+int num_flows = 1;
+double min_rtt = 0.2;
+double max_rtt = 0.2;
+double start_spread = 0;
+const char *flow_file = NULL;
+bool list_flows = false;
+
+struct flow {
+    double start;               /* when its upper layer starts */
+    double owd;                 /* one-way delay, half the round-trip time */
+    int src_host, dst_host;     /* in a topology */
+    struct sender_state *sender;
+    struct receiver_state *receiver;
+
+    /* the sender timer: when it expires (-1 when it is not set), and the time
+       of the timer event in the queue (-1 when there is none).  the event is
+       only requeued when the timer is moved earlier, and otherwise catches
+       up with it when it comes out */
+    double timer_expire;
+    double timer_queued;
+    Event timer_event;
+
+    /* the upper layer: the recurring message arrival, a message refused by
+       the rdt layer, and the message patterns at both ends */
+    Event arrival_event;
+    struct message *pending_msg;
+    bool blocked;
+    char send_cnt;
+    char verify_cnt;
+
+    long long chars_sent;
+    long long chars_delivered;
+    double last_delivery;
+    bool verification_passed;
+};
+std::vector<struct flow> flows;
+
+/* one receiver for every flow (-d): the receiver nodes all run in the first
+   partition, on the table of its thread, and the connections idle for
+   idle_timeout are evicted every half of it until sim_time.  the flow of a
+   packet comes from its connection id, flow i being connection i+1.  the
+   lookups are timed over LOOKUP_COUNT of them in the end */
+double idle_timeout = -1;
+Event evict_event;
+#define LOOKUP_COUNT 10000000
+thread_local int demux_flow = -1;
+
+/* the topology, NULL for the built-in bottleneck.  every link is a port at
+   each end, with the queue for its direction */
+const char *topology_file = NULL;
+const char *hops_file = NULL;
+
+enum {QUEUE_DROPTAIL=0, QUEUE_RED};
+
+struct port {
+    int to;                     /* the network node at the other end */
+    double bandwidth;           /* bytes per second, 0 for unlimited */
+    double delay;
+    double queue_limit;
+    int discipline;
+    double loss_rate;
+    double corrupt_rate;
+
+    double busy_until;          /* when the queued packets are all sent */
+    double avg_backlog;         /* for RED */
+
+    /* statistics */
+    long long pkts;
+    long long bytes;
+    long long drops;            /* by the queue */
+    long long lost;             /* by the link */
+    double tot_queue_delay;
+    double max_queue_delay;
+};
+
+struct net_node {
+    std::string name;
+    bool router;
+    std::vector<struct port> ports;
+    std::vector<int> route;     /* the port towards every network node, -1
+				   for the unreachable ones */
+};
+std::vector<struct net_node> net;
+
+/* a sender, a receiver or the bottleneck: the partition it runs in, its
+   random number generator and the number of events it has scheduled */
+struct node {
+    int part;
+    unsigned long long rng;
+    unsigned int seq;
+};
+std::vector<struct node> nodes;
+
+/* a share of the nodes, run by one thread.  events between its own nodes go
+   straight into its queue, those from other partitions are left in its
+   mailbox and only taken in between two windows */
+struct partition {
+    EventQueue queue;
+    double next_time;           /* of its first event in the next window */
+
+    /* statistics */
+    long long pkts_passed;
+    long long bytes_passed;
+    long long queue_drops;
+    long long link_bytes;
+    long long events;
+
+    alignas(CACHE_LINE) std::atomic<Event*> mailbox;
+};
+struct partition *parts;
+
+int num_threads = 1;
+unsigned int seed;
+
+/* the window length, no event sent to another partition arrives sooner */
+double lookahead;
+long long windows = 0;
+pthread_barrier_t window_barrier;
+
+/* the partition the thread runs, and its flows whose sender and receiver
+   state is running, -1 for none */
+thread_local struct partition *part = NULL;
+thread_local int running_sender = -1;
+thread_local int running_receiver = -1;
+
+
+/*[]------------------------------------------------------------------------[]
+  |  simulation routines
+  []------------------------------------------------------------------------[]*/
+
+/* generate a random number in [0,1) from a node's own stream (splitmix64),
+   so that the numbers a node draws do not depend on the other nodes */
+static double node_random(int n)
+{
+    unsigned long long z = (nodes[n].rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z>>30))*0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z>>27))*0x94d049bb133111ebULL;
+    z = z ^ (z>>31);
+    return (z>>11)*(1.0/9007199254740992.0);
+}
+
+/* schedule an event of node src at node dst, through dst's mailbox if it
+   runs in another partition */
+static void schedule(Event *e, int src, int dst)
+{
+    e->src = src;
+    e->src_seq = nodes[src].seq++;
+    struct partition *p = &parts[nodes[dst].part];
+    if (p==part) {
+	p->queue.schedule(e);
+	return;
+    }
+    Event *head = p->mailbox.load(std::memory_order_relaxed);
+    do {
+	e->next = head;
+    } while (!p->mailbox.compare_exchange_weak(head, e, std::memory_order_release,
+					       std::memory_order_relaxed));
+}
+
+/* move the events other partitions sent to the running one into its queue */
+static void take_mailbox()
+{
+    Event *e = part->mailbox.exchange(NULL, std::memory_order_acquire);
+    while (e!=NULL) {
+	Event *next = e->next;
+	part->queue.schedule(e);
+	e = next;
+    }
+}
+
+/* generate a message of a flow, the same pattern as in the simulator */
+static struct message *generate_msg(int i)
+{
+    struct flow *f = &flows[i];
+    struct message *msg = (struct message*) malloc(sizeof(struct message));
+    ASSERT(msg!=NULL);
+    msg->size = (int)(node_random(SENDER_NODE(i))*2.0*msg_size);
+    if (msg->size==0) msg->size=1;
+    msg->data = (char*) malloc(msg->size);
+    ASSERT(msg->data!=NULL);
+
+    for (int j=0; j<msg->size; j+=1) {
+	msg->data[j] = '0' + f->send_cnt;
+	f->send_cnt = (f->send_cnt+1) % 10;
+    }
+
+    return msg;
+}
+
+/* free the space of a message */
+static void free_msg(struct message *msg)
+{
+    if (msg->data!=NULL) free(msg->data);
+    if (msg!=NULL) free(msg);
+}
+
+/* make the sender or the receiver of a flow the running one, -1 for none */
+static void run_sender(int i)
+{
+    if (running_sender==i) return;
+    /* the running state goes back to its flow, and the spare it gets in
+       exchange goes to the new flow in exchange for its state */
+    if (running_sender>=0)
+	Sender_SwapState(flows[running_sender].sender);
+    if (i>=0)
+	Sender_SwapState(flows[i].sender);
+    running_sender = i;
+}
+
+static void run_receiver(int i)
+{
+    if (running_receiver==i) return;
+    if (running_receiver>=0)
+	Receiver_SwapState(flows[running_receiver].receiver);
+    if (i>=0)
+	Receiver_SwapState(flows[i].receiver);
+    running_receiver = i;
+}
+
+/* the flow of the running receiver, or of the packet being demultiplexed */
+static int receiving_flow()
+{
+    return idle_timeout>0 ? demux_flow : running_receiver;
+}
+
+/* get simulation time (in seconds) - for every sender and receiver */
+double GetSimulationTime()
+{
+    return part->queue.time();
+}
+
+/* start the running sender's timer with a specified timeout (in seconds).
+   the timer is cancelled with Sender_StopTimer() is called or a new
+   Sender_StartTimer() is called before the current timer expires.
+   Sender_Timeout() will be called when the timer expires. */
+void Sender_StartTimer(double timeout)
+{
+    struct flow *f = &flows[running_sender];
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Sender %d): the timer is started (expires at %.2fs).\n",
+		GetSimulationTime(), running_sender, GetSimulationTime() + timeout);
+
+    f->timer_expire = GetSimulationTime() + timeout;
+    if (f->timer_queued<0 || f->timer_expire<f->timer_queued) {
+	f->timer_event.sched_time = f->timer_expire;
+	f->timer_queued = f->timer_expire;
+	schedule(&f->timer_event, SENDER_NODE(running_sender), SENDER_NODE(running_sender));
+    }
+}
+
+/* stop the running sender's timer */
+void Sender_StopTimer()
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Sender %d): the timer is stopped.\n",
+		GetSimulationTime(), running_sender);
+
+    flows[running_sender].timer_expire = -1;
+}
+
+/* check whether the running sender's timer is being set,
+   return true if the timer is set, return false otherwise */
+bool Sender_isTimerSet()
+{
+    return flows[running_sender].timer_expire>=0;
+}
+
+/* tell the running sender's upper layer that a message refused by
+   Sender_FromUpperLayer() can be passed again */
+void Sender_UpperLayerWritable()
+{
+    struct flow *f = &flows[running_sender];
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Sender %d): the rdt layer is writable again.\n",
+		GetSimulationTime(), running_sender);
+
+    if (f->blocked) {
+	f->blocked = false;
+	f->arrival_event.sched_time = GetSimulationTime();
+	schedule(&f->arrival_event, SENDER_NODE(running_sender), SENDER_NODE(running_sender));
+    }
+}
+
+/* corrupt a packet, as it leaves node n */
+static void corrupt_packet(EventPacket *e, int n)
+{
+    for (int j=0; j<e->size; j++) {
+	e->pkt.data[j] = e->pkt.data[j] + (char)(node_random(n)*20) - 10;
+    }
+}
+
+/* random early detection at a port, whether to drop a packet that finds
+   backlog bytes in the queue */
+static bool red_drop(struct port *p, double backlog, int n)
+{
+    p->avg_backlog += RED_WEIGHT*(backlog - p->avg_backlog);
+    double min_th = p->queue_limit/4, max_th = p->queue_limit*3/4;
+    if (p->avg_backlog<min_th) return false;
+    if (p->avg_backlog>=max_th) return true;
+    return node_random(n) < RED_MAX_P*(p->avg_backlog - min_th)/(max_th - min_th);
+}
+
+/* send a packet on from network node k: it queues for the port the route to
+   its destination goes through, and the link may lose or corrupt it on the
+   way to the next node */
+static void forward(EventPacket *e, int k)
+{
+    struct net_node *n = &net[k];
+    struct port *p = &n->ports[n->route[e->dst]];
+    double now = GetSimulationTime();
+
+    double backlog = 0, transmit = 0;
+    if (p->bandwidth>0) {
+	backlog = std::max(p->busy_until - now, 0.0)*p->bandwidth;
+	transmit = e->size/p->bandwidth;
+    }
+    bool drop = p->discipline==QUEUE_RED && red_drop(p, backlog, NET_NODE(k));
+    if (drop || backlog + e->size > p->queue_limit) {
+	p->drops ++;
+	part->queue_drops ++;
+	delete e;
+	return;
+    }
+    double departure = std::max(now, p->busy_until) + transmit;
+    p->busy_until = departure;
+    p->pkts ++;
+    p->bytes += e->size;
+    p->tot_queue_delay += departure - transmit - now;
+    p->max_queue_delay = std::max(p->max_queue_delay, departure - transmit - now);
+
+    if (node_random(NET_NODE(k))<p->loss_rate) {
+	p->lost ++;
+	delete e;
+	return;
+    }
+    if (node_random(NET_NODE(k))<p->corrupt_rate)
+	corrupt_packet(e, NET_NODE(k));
+
+    e->at = p->to;
+    e->sched_time = departure + p->delay;
+    schedule(e, NET_NODE(k), NET_NODE(p->to));
+}
+
+/* lose, corrupt or reorder a packet leaving node src at the configured rates.
+   without a topology, it arrives at node dst after delay, and a packet out of
+   order takes between half and one and a half times the delay.  in a
+   topology, it enters the network at its host, and a packet out of order is
+   held there for up to the one-way delay of its flow first */
+static void pass_packet(int type, int i, struct packet *pkt, int size, int src, int dst,
+			double delay)
+{
+    /* packet lost at rate "loss_rate" */
+    if (node_random(src)<loss_rate) return;
+
+    EventPacket *e = new EventPacket;
+    e->event_type = type;
+    e->flow = i;
+    e->size = size;
+    memcpy(&e->pkt.data, pkt->data, size);
+    memset(&e->pkt.data[size], 0, RDT_PKTSIZE-size);
+
+    /* packet corrupted at rate "corrupt_rate" */
+    if (node_random(src)<corrupt_rate)
+	corrupt_packet(e, src);
+
+    part->pkts_passed ++;
+    part->bytes_passed += size;
+
+    /* schedule the packet arrival event at the other side */
+    bool reordered = node_random(src)<outoforder_rate;
+    if (topology_file==NULL) {
+	if (reordered)
+	    e->sched_time = GetSimulationTime() + delay*(0.5 + node_random(src));
+	else
+	    e->sched_time = GetSimulationTime() + delay;
+	schedule(e, src, dst);
+	return;
+    }
+
+    e->event_type = EVENT_TO_NODE;
+    e->ack = type==EVENT_TO_SENDER;
+    e->at = e->ack ? flows[i].dst_host : flows[i].src_host;
+    e->dst = e->ack ? flows[i].src_host : flows[i].dst_host;
+    if (reordered) {
+	e->sched_time = GetSimulationTime() + flows[i].owd*node_random(src);
+	schedule(e, src, NET_NODE(e->at));
+    } else {
+	forward(e, e->at);
+    }
+}
+
+/* pass a packet to the lower layer at the running sender, it goes to the
+   bottleneck first */
+void Sender_ToLowerLayer(struct packet *pkt, int size)
+{
+    ASSERT(size>0 && size<=RDT_PKTSIZE);
+    pass_packet(EVENT_TO_BOTTLENECK, running_sender, pkt, size, SENDER_NODE(running_sender),
+		BOTTLENECK_NODE, flows[running_sender].owd/2);
+}
+
+/* a packet at the bottleneck queues behind the packets of every flow, and is
+   dropped if the queue is full */
+static void bottleneck(EventPacket *e)
+{
+    double now = GetSimulationTime();
+    double departure = now;
+    if (link_bandwidth>0) {
+	double backlog = std::max(link_busy_until - now, 0.0)*link_bandwidth;
+	if (backlog + e->size > queue_limit) {
+	    part->queue_drops ++;
+	    delete e;
+	    return;
+	}
+	departure = std::max(now, link_busy_until) + e->size/link_bandwidth;
+	link_busy_until = departure;
+	part->link_bytes += e->size;
+    }
+    e->event_type = EVENT_TO_RECEIVER;
+    e->sched_time = departure + flows[e->flow].owd/2;
+    schedule(e, BOTTLENECK_NODE, RECEIVER_NODE(e->flow));
+}
+
+/* pass a packet to the lower layer at the running receiver, the way back is
+   not congested */
+void Receiver_ToLowerLayer(struct packet *pkt, int size)
+{
+    ASSERT(size>0 && size<=RDT_PKTSIZE);
+    int i = receiving_flow();
+    pass_packet(EVENT_TO_SENDER, i, pkt, size, RECEIVER_NODE(i), SENDER_NODE(i), flows[i].owd);
+}
+
+/* no packet is ever marked congestion experienced */
+bool Receiver_isCongestionMarked()
+{
+    return false;
+}
+
+/* deliver a message to the running receiver's upper layer */
+void Receiver_ToUpperLayer(struct message *msg)
+{
+    struct flow *f = &flows[receiving_flow()];
+    for (int i=0; i<msg->size; i++) {
+	/* message verification */
+	if (msg->data[i] != '0' + f->verify_cnt)
+	    f->verification_passed = false;
+	f->verify_cnt = (f->verify_cnt+1) % 10;
+    }
+
+    f->chars_delivered += msg->size;
+    f->last_delivery = GetSimulationTime();
+}
+
+/* a packet arrives at the receiver or the sender of its flow */
+static void to_receiver(EventPacket *e)
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Receiver %d): the lower layer informs the rdt layer that a packet is received from the link.\n", GetSimulationTime(), e->flow);
+
+    /* the flow the packet belongs to is only known from its header, which
+       the receiver checks before anything is done for it */
+    if (idle_timeout>0) {
+	demux_flow = PacketConn(&e->pkt) - 1;
+	Receiver_Demux(&e->pkt);
+	delete e;
+	return;
+    }
+    run_receiver(e->flow);
+    Receiver_FromLowerLayer(&e->pkt);
+    delete e;
+}
+
+static void to_sender(EventPacket *e)
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Sender %d): the lower layer informs the rdt layer that a packet is received from the link.\n", GetSimulationTime(), e->flow);
+
+    run_sender(e->flow);
+    Sender_FromLowerLayer(&e->pkt);
+    delete e;
+}
+
+/* handle an event of the running partition */
+static void handle_event(Event *e)
+{
+    struct flow *f = &flows[e->flow];
+    part->events ++;
+
+    switch (e->event_type) {
+    case EVENT_MSG_ARRIVAL:
+	{
+	    if (tracing_level>=1)
+		fprintf(stdout, "Time %.2fs (Sender %d): the upper layer instructs rdt layer to send out a message.\n", GetSimulationTime(), e->flow);
+
+	    run_sender(e->flow);
+	    /* the upper layer honors backpressure: a refused message is
+	       held, and no new message is generated until it is taken */
+	    if (f->pending_msg==NULL)
+		f->pending_msg = generate_msg(e->flow);
+	    if (!Sender_FromUpperLayer(f->pending_msg)) {
+		f->blocked = true;
+		break;
+	    }
+	    f->chars_sent += f->pending_msg->size;
+	    free_msg(f->pending_msg);
+	    f->pending_msg = NULL;
+
+	    /* schedule the recurring event */
+	    if (GetSimulationTime() < sim_time) {
+		e->sched_time = GetSimulationTime() +
+		    msg_arrivalint*2.0*node_random(SENDER_NODE(e->flow));
+		schedule(e, SENDER_NODE(e->flow), SENDER_NODE(e->flow));
+	    }
+	}
+	break;
+
+    case EVENT_TO_BOTTLENECK:
+	bottleneck((EventPacket*) e);
+	break;
+
+    case EVENT_TO_RECEIVER:
+	to_receiver((EventPacket*) e);
+	break;
+
+    case EVENT_TO_SENDER:
+	to_sender((EventPacket*) e);
+	break;
+
+    case EVENT_TO_NODE:
+	{
+	    /* a packet on the way through the topology, or at its
+	       destination host */
+	    EventPacket *p = (EventPacket*) e;
+	    if (p->at!=p->dst)
+		forward(p, p->at);
+	    else if (p->ack)
+		to_sender(p);
+	    else
+		to_receiver(p);
+	}
+	break;
+
+    case EVENT_SENDER_TIMEOUT:
+	{
+	    /* a timer event overtaken by an earlier one.  both share the
+	       flow's event, so the time is the one it was queued for */
+	    if (GetSimulationTime()!=f->timer_queued)
+		break;
+	    f->timer_queued = -1;
+	    if (f->timer_expire<0)
+		break;
+	    /* the timer was moved later since, catch up with it */
+	    if (f->timer_expire>GetSimulationTime()) {
+		e->sched_time = f->timer_queued = f->timer_expire;
+		schedule(e, SENDER_NODE(e->flow), SENDER_NODE(e->flow));
+		break;
+	    }
+
+	    if (tracing_level>=1)
+		fprintf(stdout, "Time %.2fs (Sender %d): the timer expires.\n", GetSimulationTime(), e->flow);
+	    f->timer_expire = -1;
+	    run_sender(e->flow);
+	    Sender_Timeout();
+	}
+	break;
+
+    case EVENT_EVICT:
+	Receiver_Evict(idle_timeout);
+	if (GetSimulationTime() < sim_time) {
+	    e->sched_time = GetSimulationTime() + idle_timeout/2;
+	    schedule(e, RECEIVER_NODE(0), RECEIVER_NODE(0));
+	}
+	break;
+
+    default:
+	fprintf(stderr, "undefined event %d\n", e->event_type);
+	break;
+    }
+}
+
+/* the thread of a partition.  every window starts at the earliest event of
+   any partition and lasts the lookahead, and the partitions meet at a
+   barrier before and after it */
+static void *run_partition(void *arg)
+{
+    part = (struct partition*) arg;
+    for (;;) {
+	take_mailbox();
+	part->next_time = part->queue.next_time();
+	pthread_barrier_wait(&window_barrier);
+
+	double start = HUGE_VAL;
+	for (int p=0; p<num_threads; p++)
+	    start = std::min(start, parts[p].next_time);
+	if (start==HUGE_VAL)
+	    break;
+	if (part==&parts[0])
+	    windows ++;
+
+	Event *e;
+	while ((e = part->queue.next_event(start + lookahead))!=NULL)
+	    handle_event(e);
+	pthread_barrier_wait(&window_barrier);
+    }
+
+    /* the running states go back to their flows */
+    run_sender(-1);
+    run_receiver(-1);
+    return NULL;
+}
+
+/* read "<start_time> <rtt>" lines, '#' starts a comment */
+static void read_flow_file(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp==NULL) {
+	perror(path);
+	exit(-1);
+    }
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp)!=NULL) {
+	lineno ++;
+	char *comment = strchr(line, '#');
+	if (comment!=NULL) *comment = '\0';
+	double start, rtt;
+	char extra;
+	int n = sscanf(line, "%lf %lf %c", &start, &rtt, &extra);
+	if (n<=0) continue;
+	if (n!=2 || start<0 || rtt<=0) {
+	    fprintf(stderr, "%s:%d: expected <start_time> <rtt>\n", path, lineno);
+	    exit(-1);
+	}
+	struct flow f = {};
+	f.start = start;
+	f.owd = rtt/2;
+	flows.push_back(f);
+    }
+    fclose(fp);
+    if (flows.empty()) {
+	fprintf(stderr, "%s: no flows\n", path);
+	exit(-1);
+    }
+}
+
+/* the network node of a name in a topology file, -1 if there is none */
+static int find_node(std::map<std::string, int> &names, const char *name)
+{
+    std::map<std::string, int>::iterator it = names.find(name);
+    return it==names.end() ? -1 : it->second;
+}
+
+/* the routes towards network node dst, along the paths of least delay.  a
+   packet only passes through routers, never through another host */
+static void compute_routes(int dst)
+{
+    std::vector<double> dist(net.size(), HUGE_VAL);
+    typedef std::pair<double, int> item;
+    std::priority_queue<item, std::vector<item>, std::greater<item> > todo;
+    dist[dst] = 0;
+    todo.push(item(0, dst));
+    while (!todo.empty()) {
+	item top = todo.top();
+	todo.pop();
+	int k = top.second;
+	if (top.first>dist[k] || (k!=dst && !net[k].router))
+	    continue;
+	/* the links go both ways, so the neighbours of k reach dst through k
+	   on their port back to it */
+	for (size_t j=0; j<net[k].ports.size(); j++) {
+	    int m = net[k].ports[j].to;
+	    double d = dist[k] + net[k].ports[j].delay;
+	    if (d>=dist[m]) continue;
+	    dist[m] = d;
+	    int best = -1;
+	    for (size_t q=0; q<net[m].ports.size(); q++)
+		if (net[m].ports[q].to==k &&
+		    (best<0 || net[m].ports[q].delay<net[m].ports[best].delay))
+		    best = q;
+	    net[m].route[dst] = best;
+	    todo.push(item(d, m));
+	}
+    }
+}
+
+/* the one-way delay from network node k to dst, along its route */
+static double path_delay(int k, int dst)
+{
+    double delay = 0;
+    while (k!=dst) {
+	struct port *p = &net[k].ports[net[k].route[dst]];
+	delay += p->delay;
+	k = p->to;
+    }
+    return delay;
+}
+
+/* read a topology, '#' starts a comment:
+       host <name>
+       router <name>
+       link <name> <name> <bandwidth> <delay> <queue_bytes> [droptail|red] [<loss_rate> [<corrupt_rate>]]
+       flow <host> <host> [<start_time>] */
+static void read_topology(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp==NULL) {
+	perror(path);
+	exit(-1);
+    }
+    std::map<std::string, int> names;
+    char line[512];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp)!=NULL) {
+	lineno ++;
+	char *comment = strchr(line, '#');
+	if (comment!=NULL) *comment = '\0';
+	char kind[16], a[128], b[128], discipline[16] = "droptail", extra;
+	if (sscanf(line, "%15s", kind)!=1) continue;
+
+	if (strcmp(kind, "host")==0 || strcmp(kind, "router")==0) {
+	    if (sscanf(line, "%*s %127s %c", a, &extra)!=1) {
+		fprintf(stderr, "%s:%d: expected %s <name>\n", path, lineno, kind);
+		exit(-1);
+	    }
+	    if (find_node(names, a)>=0) {
+		fprintf(stderr, "%s:%d: %s is defined twice\n", path, lineno, a);
+		exit(-1);
+	    }
+	    struct net_node n;
+	    n.name = a;
+	    n.router = kind[0]=='r';
+	    names[a] = net.size();
+	    net.push_back(n);
+
+	} else if (strcmp(kind, "link")==0) {
+	    struct port p = {};
+	    p.discipline = QUEUE_DROPTAIL;
+	    int n = sscanf(line, "%*s %127s %127s %lf %lf %lf %15s %lf %lf %c", a, b,
+			   &p.bandwidth, &p.delay, &p.queue_limit, discipline,
+			   &p.loss_rate, &p.corrupt_rate, &extra);
+	    int ka = find_node(names, a), kb = find_node(names, b);
+	    if (n<5 || n>8 || ka<0 || kb<0 || ka==kb || p.bandwidth<0 || p.delay<=0 ||
+		p.queue_limit<RDT_PKTSIZE || p.loss_rate<0 || p.loss_rate>1 ||
+		p.corrupt_rate<0 || p.corrupt_rate>1) {
+		fprintf(stderr, "%s:%d: expected link <name> <name> <bandwidth> <delay> "
+			"<queue_bytes> [droptail|red] [<loss_rate> [<corrupt_rate>]] between "
+			"two defined nodes, with a delay and a queue that holds a packet\n",
+			path, lineno);
+		exit(-1);
+	    }
+	    if (strcmp(discipline, "red")==0) {
+		p.discipline = QUEUE_RED;
+	    } else if (strcmp(discipline, "droptail")!=0) {
+		fprintf(stderr, "%s:%d: unknown queue discipline %s\n", path, lineno, discipline);
+		exit(-1);
+	    }
+	    p.to = kb;
+	    net[ka].ports.push_back(p);
+	    p.to = ka;
+	    net[kb].ports.push_back(p);
+
+	} else if (strcmp(kind, "flow")==0) {
+	    struct flow f = {};
+	    int n = sscanf(line, "%*s %127s %127s %lf %c", a, b, &f.start, &extra);
+	    f.src_host = find_node(names, a);
+	    f.dst_host = find_node(names, b);
+	    if (n<2 || n>3 || f.start<0 || f.src_host<0 || f.dst_host<0 ||
+		f.src_host==f.dst_host || net[f.src_host].router || net[f.dst_host].router) {
+		fprintf(stderr, "%s:%d: expected flow <host> <host> [<start_time>] between "
+			"two defined hosts\n", path, lineno);
+		exit(-1);
+	    }
+	    flows.push_back(f);
+
+	} else {
+	    fprintf(stderr, "%s:%d: unknown line %s\n", path, lineno, kind);
+	    exit(-1);
+	}
+    }
+    fclose(fp);
+    if (flows.empty()) {
+	fprintf(stderr, "%s: no flows\n", path);
+	exit(-1);
+    }
+
+    /* static routing tables, and the delays of the flows along them */
+    for (size_t k=0; k<net.size(); k++)
+	net[k].route.assign(net.size(), -1);
+    for (size_t k=0; k<net.size(); k++)
+	if (!net[k].router)
+	    compute_routes(k);
+    for (size_t i=0; i<flows.size(); i++) {
+	struct flow *f = &flows[i];
+	if (net[f->src_host].route[f->dst_host]<0) {
+	    fprintf(stderr, "%s: no route from %s to %s\n", path,
+		    net[f->src_host].name.c_str(), net[f->dst_host].name.c_str());
+	    exit(-1);
+	}
+	f->owd = (path_delay(f->src_host, f->dst_host) + path_delay(f->dst_host, f->src_host))/2;
+    }
+}
+
+/* write the statistics of every hop of the topology as comma-separated
+   values */
+static void write_hops(const char *path, double end)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp==NULL) {
+	perror(path);
+	return;
+    }
+    fprintf(fp, "from,to,packets,bytes,queue_drops,link_losses,mean_queue_delay,"
+	    "max_queue_delay,utilization\n");
+    for (size_t k=0; k<net.size(); k++)
+	for (size_t j=0; j<net[k].ports.size(); j++) {
+	    struct port *p = &net[k].ports[j];
+	    fprintf(fp, "%s,%s,%lld,%lld,%lld,%lld,%.9f,%.9f,%.6f\n", net[k].name.c_str(),
+		    net[p->to].name.c_str(), p->pkts, p->bytes, p->drops, p->lost,
+		    p->pkts>0 ? p->tot_queue_delay/p->pkts : 0.0, p->max_queue_delay,
+		    p->bandwidth>0 && end>0 ? p->bytes/(p->bandwidth*end) : 0.0);
+	}
+    fclose(fp);
+}
+
+/* Jain's fairness index of the samples, 1 when they are all equal and 1/n
+   when one of them takes everything */
+static double jain_index(const std::vector<double> &x)
+{
+    double sum = 0, sum_sq = 0;
+    for (size_t i=0; i<x.size(); i++) {
+	sum += x[i];
+	sum_sq += x[i]*x[i];
+    }
+    return sum_sq>0 ? sum*sum/(x.size()*sum_sq) : 1.0;
+}
+
+static double wall_time();
+
+/* the time a lookup takes in the table of the running thread, of every
+   connection of ids, or of ids that are not in it, in a shuffled order */
+static double time_lookups(std::vector<unsigned int> &ids)
+{
+    if (ids.empty()) return 0;
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(seed));
+    long long rounds = std::max(LOOKUP_COUNT/(long long) ids.size(), 1LL);
+    long long found = 0;
+    double start = wall_time();
+    for (long long r=0; r<rounds; r++)
+	for (unsigned int id : ids)
+	    found += Receiver_HasConnection(id);
+    double wall = wall_time() - start;
+    /* the count keeps the lookups from being optimized away */
+    if (found<0) fprintf(stdout, "%lld\n", found);
+    return wall/(rounds*ids.size());
+}
+
+static double wall_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main simulation control routine
+  []------------------------------------------------------------------------[]*/
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+	{"flows", required_argument, NULL, 'n'},
+	{"rtt", required_argument, NULL, 'r'},
+	{"start-spread", required_argument, NULL, 's'},
+	{"flow-file", required_argument, NULL, 'f'},
+	{"bandwidth", required_argument, NULL, 'w'},
+	{"queue", required_argument, NULL, 'q'},
+	{"list", no_argument, NULL, 'l'},
+	{"threads", required_argument, NULL, 't'},
+	{"seed", required_argument, NULL, 'S'},
+	{"topology", required_argument, NULL, 'T'},
+	{"hops", required_argument, NULL, 'o'},
+	{"demux", required_argument, NULL, 'd'},
+	{NULL, 0, NULL, 0}
+    };
+    bool seeded = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:r:s:f:w:q:lt:S:T:o:d:", long_options, NULL)) != -1) {
+	switch (opt) {
+	case 'n':
+	    num_flows = atoi(optarg);
+	    if (num_flows<=0) {
+		fprintf(stderr, "invalid <flows>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'r':
+	    if (sscanf(optarg, "%lf,%lf", &min_rtt, &max_rtt)==1)
+		max_rtt = min_rtt;
+	    if (min_rtt<=0 || max_rtt<min_rtt) {
+		fprintf(stderr, "invalid <min_rtt>[,<max_rtt>]\n");
+		exit(-1);
+	    }
+	    break;
+	case 's':
+	    start_spread = atof(optarg);
+	    if (start_spread<0) {
+		fprintf(stderr, "invalid <start_spread>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'f':
+	    flow_file = optarg;
+	    break;
+	case 'w':
+	    link_bandwidth = atof(optarg);
+	    if (link_bandwidth<0) {
+		fprintf(stderr, "invalid <bandwidth>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'q':
+	    queue_limit = atof(optarg);
+	    if (queue_limit<RDT_PKTSIZE) {
+		fprintf(stderr, "invalid <queue_bytes>, it must hold a packet\n");
+		exit(-1);
+	    }
+	    break;
+	case 'l':
+	    list_flows = true;
+	    break;
+	case 't':
+	    num_threads = atoi(optarg);
+	    if (num_threads<=0) {
+		fprintf(stderr, "invalid <threads>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'S':
+	    seed = strtoul(optarg, NULL, 0);
+	    seeded = true;
+	    break;
+	case 'T':
+	    topology_file = optarg;
+	    break;
+	case 'o':
+	    hops_file = optarg;
+	    break;
+	case 'd':
+#ifndef RDT_CONN_ID
+	    fprintf(stderr, "built without connection ids, use rdt_flows_demux (make rdt_flows_demux)\n");
+	    exit(-1);
+#endif
+	    idle_timeout = atof(optarg);
+	    if (idle_timeout<=0) {
+		fprintf(stderr, "invalid <idle_timeout>\n");
+		exit(-1);
+	    }
+	    break;
+	default:
+	    argc = 0;
+	    break;
+	}
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    if (argc!=8) {
+	fprintf(stderr, "usage: %s [-n <flows>] [-r <min_rtt>[,<max_rtt>]] [-s <start_spread>] "
+		"[-f <flow_file>] [-w <bandwidth>] [-q <queue_bytes>] [-l] "
+		"[-t <threads>] [-S <seed>] [-T <topology_file> [-o <hops_file>]] [-d <idle_timeout>] "
+		"<sim_time> <mean_msg_arrivalint> <mean_msg_size> "
+		"<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level>\n",
+		argv[0]);
+	exit(-1);
+    }
+
+    sim_time = atof(argv[1]);
+    if (sim_time<=0) {
+	fprintf(stderr, "invalid <sim_time>\n");
+	exit(-1);
+    }
+    msg_arrivalint = atof(argv[2]);
+    if (msg_arrivalint<=0) {
+	fprintf(stderr, "invalid <msg_arrivalint>\n");
+	exit(-1);
+    }
+    msg_size = atoi(argv[3]);
+    if (msg_size<=0) {
+	fprintf(stderr, "invalid <msg_size>\n");
+	exit(-1);
+    }
+    outoforder_rate = atof(argv[4]);
+    if (outoforder_rate<0 || outoforder_rate>1) {
+	fprintf(stderr, "invalid <outoforder_rate>\n");
+	exit(-1);
+    }
+    loss_rate = atof(argv[5]);
+    if (loss_rate<0 || loss_rate>1) {
+	fprintf(stderr, "invalid <loss_rate>\n");
+	exit(-1);
+    }
+    corrupt_rate = atof(argv[6]);
+    if (corrupt_rate<0 || corrupt_rate>1) {
+	fprintf(stderr, "invalid <corrupt_rate>\n");
+	exit(-1);
+    }
+    tracing_level = atoi(argv[7]);
+    if (tracing_level<0 || tracing_level>2) {
+	fprintf(stderr, "invalid <tracing_level>\n");
+	exit(-1);
+    }
+
+    if (idle_timeout>0 && topology_file!=NULL) {
+	fprintf(stderr, "-d excludes -T\n");
+	exit(-1);
+    }
+
+    /* the flows, spread evenly over the round-trip times and start times */
+    if (topology_file!=NULL) {
+	if (flow_file!=NULL || link_bandwidth>0) {
+	    fprintf(stderr, "the flows and the links of a topology are in its file\n");
+	    exit(-1);
+	}
+	read_topology(topology_file);
+    } else if (flow_file!=NULL) {
+	read_flow_file(flow_file);
+    } else {
+	flows.resize(num_flows);
+	for (int i=0; i<num_flows; i++) {
+	    double at = num_flows>1 ? (double) i/(num_flows-1) : 0;
+	    flows[i].start = start_spread*i/num_flows;
+	    flows[i].owd = (min_rtt + (max_rtt-min_rtt)*at)/2;
+	}
+    }
+    num_flows = flows.size();
+
+    /* the random number generators start from the seed */
+    if (!seeded)
+	seed = getpid()+getppid();
+
+    fprintf(stdout, "## Reliable data transfer simulation of %d flows with:\n"
+	    "\tsimulation time is %.3f seconds\n"
+	    "\taverage message arrival interval is %.3f seconds per flow\n"
+	    "\taverage message size is %d bytes\n"
+	    "\taverage out-of-order delivery rate is %.2f%%\n"
+	    "\taverage loss rate is %.2f%%\n"
+	    "\taverage corrupt rate is %.2f%%\n"
+	    "\ttracing level is %d\n"
+	    "\t%d threads, random seed is %u\n",
+	    num_flows, sim_time, msg_arrivalint, msg_size, outoforder_rate*100.0,
+	    loss_rate*100.0, corrupt_rate*100.0, tracing_level, num_threads, seed);
+    if (topology_file!=NULL) {
+	size_t num_links = 0;
+	for (size_t k=0; k<net.size(); k++)
+	    num_links += net[k].ports.size();
+	fprintf(stdout, "\ttopology %s of %zu nodes and %zu links\n", topology_file,
+		net.size(), num_links/2);
+    } else {
+	fprintf(stdout, "\tbottleneck of %.0f bytes/s (0 is unlimited) with a %.0f-byte queue\n",
+		link_bandwidth, queue_limit);
+    }
+    if (idle_timeout>0)
+	fprintf(stdout, "\tone receiver for every flow, evicting connections idle for %.3fs\n",
+		idle_timeout);
+    fprintf(stdout, "Please review these inputs and press <enter> to proceed.\n");
+    fgetc(stdin);
+
+    /* the nodes.  without a topology, the flows go in equal shares of
+       consecutive ones and the bottleneck in the first partition.  in a
+       topology, the hosts and routers go in equal shares, and the sender and
+       receiver of a flow in the partitions of their hosts */
+    parts = new partition[num_threads]();
+    int num_net = topology_file!=NULL ? net.size() : 1;
+    nodes.resize(2*num_flows + num_net);
+    for (int k=0; k<num_net; k++)
+	nodes[NET_NODE(k)].part = (long long) k*num_threads/num_net;
+    for (int i=0; i<num_flows; i++) {
+	if (topology_file!=NULL) {
+	    nodes[SENDER_NODE(i)].part = nodes[NET_NODE(flows[i].src_host)].part;
+	    nodes[RECEIVER_NODE(i)].part = nodes[NET_NODE(flows[i].dst_host)].part;
+	} else {
+	    nodes[SENDER_NODE(i)].part = (long long) i*num_threads/num_flows;
+	    nodes[RECEIVER_NODE(i)].part = idle_timeout>0 ? 0 : nodes[SENDER_NODE(i)].part;
+	}
+    }
+    for (size_t n=0; n<nodes.size(); n++) {
+	nodes[n].rng = ((unsigned long long) seed << 32) + n;
+	nodes[n].seq = 0;
+    }
+
+    /* no packet between two partitions takes less than the lookahead: in a
+       topology the delay of a link, otherwise half of the one-way delay of
+       its flow, and a packet out of order a quarter */
+    lookahead = HUGE_VAL;
+    if (topology_file!=NULL) {
+	for (size_t k=0; k<net.size(); k++)
+	    for (size_t j=0; j<net[k].ports.size(); j++)
+		lookahead = std::min(lookahead, net[k].ports[j].delay);
+    } else {
+	for (int i=0; i<num_flows; i++)
+	    lookahead = std::min(lookahead, flows[i].owd/4);
+    }
+
+    /* intialize the flows, the senders and the receivers only say so when
+       traced */
+    for (int i=0; i<num_flows; i++) {
+	struct flow *f = &flows[i];
+	part = &parts[nodes[SENDER_NODE(i)].part];
+	f->sender = Sender_NewState();
+	f->receiver = idle_timeout>0 ? NULL : Receiver_NewState();
+	f->timer_expire = f->timer_queued = -1;
+	f->timer_event.event_type = EVENT_SENDER_TIMEOUT;
+	f->timer_event.flow = i;
+	f->arrival_event.event_type = EVENT_MSG_ARRIVAL;
+	f->arrival_event.flow = i;
+	f->pending_msg = NULL;
+	f->blocked = false;
+	f->send_cnt = f->verify_cnt = 0;
+	f->chars_sent = f->chars_delivered = 0;
+	f->last_delivery = f->start;
+	f->verification_passed = true;
+	run_sender(i);
+	Sender_SetConnId(i+1);
+	if (tracing_level>=1) {
+	    Sender_Init();
+	    if (f->receiver!=NULL) {
+		run_receiver(i);
+		Receiver_Init();
+	    }
+	}
+
+	/* scheduling the recurring message arrival event */
+	if (f->start<sim_time) {
+	    f->arrival_event.sched_time = f->start;
+	    schedule(&f->arrival_event, SENDER_NODE(i), SENDER_NODE(i));
+	}
+    }
+    run_sender(-1);
+    run_receiver(-1);
+    if (idle_timeout>0) {
+	part = &parts[0];
+	evict_event.event_type = EVENT_EVICT;
+	evict_event.flow = 0;
+	evict_event.sched_time = idle_timeout/2;
+	schedule(&evict_event, RECEIVER_NODE(0), RECEIVER_NODE(0));
+    }
+
+    /* main simulation cycle, the first partition runs on this thread */
+    double wall_start = wall_time();
+    pthread_barrier_init(&window_barrier, NULL, num_threads);
+    std::vector<pthread_t> threads(num_threads);
+    for (int p=1; p<num_threads; p++)
+	if (pthread_create(&threads[p], NULL, run_partition, &parts[p])!=0) {
+	    perror("pthread_create");
+	    exit(-1);
+	}
+    run_partition(&parts[0]);
+    for (int p=1; p<num_threads; p++)
+	pthread_join(threads[p], NULL);
+    pthread_barrier_destroy(&window_barrier);
+    double wall = wall_time() - wall_start;
+
+    /* finalize the senders and the receivers */
+    long long tot_chars_sent = 0, tot_chars_delivered = 0;
+    bool passed = true;
+    std::vector<double> goodput(num_flows);
+    for (int i=0; i<num_flows; i++) {
+	struct flow *f = &flows[i];
+	if (tracing_level>=1) {
+	    part = &parts[nodes[SENDER_NODE(i)].part];
+	    run_sender(i);
+	    Sender_Final();
+	    if (f->receiver!=NULL) {
+		run_receiver(i);
+		Receiver_Final();
+	    }
+	}
+	tot_chars_sent += f->chars_sent;
+	tot_chars_delivered += f->chars_delivered;
+	if (!f->verification_passed || f->chars_sent!=f->chars_delivered)
+	    passed = false;
+	goodput[i] = f->last_delivery>f->start ?
+	    f->chars_delivered/(f->last_delivery - f->start) : 0;
+    }
+    run_sender(-1);
+    run_receiver(-1);
+
+    long long tot_pkts_passed = 0, tot_bytes_passed = 0, tot_queue_drops = 0;
+    long long link_bytes = 0, tot_events = 0;
+    double end = 0;
+    for (int p=0; p<num_threads; p++) {
+	tot_pkts_passed += parts[p].pkts_passed;
+	tot_bytes_passed += parts[p].bytes_passed;
+	tot_queue_drops += parts[p].queue_drops;
+	link_bytes += parts[p].link_bytes;
+	tot_events += parts[p].events;
+	end = std::max(end, parts[p].queue.time());
+    }
+
+    fprintf(stdout, "\n");
+    fprintf(stdout, "## Simulation completed at time %.2fs with\n"
+	    "\t%d flows, %lld characters sent, %lld characters delivered\n"
+	    "\t%lld packets (%lld bytes) passed between the senders and the receivers, "
+	    "%lld dropped by the %s\n"
+	    "\taggregate goodput is %.0f bytes/s",
+	    end, num_flows, tot_chars_sent, tot_chars_delivered,
+	    tot_pkts_passed, tot_bytes_passed, tot_queue_drops,
+	    topology_file!=NULL ? "queues" : "bottleneck queue", end>0 ? tot_chars_delivered/end : 0.0);
+    if (link_bandwidth>0)
+	fprintf(stdout, ", the bottleneck is %.1f%% utilized",
+		end>0 ? link_bytes*100.0/(link_bandwidth*end) : 0.0);
+    fprintf(stdout, "\n");
+
+    std::vector<double> sorted = goodput;
+    std::sort(sorted.begin(), sorted.end());
+    fprintf(stdout, "\tper-flow goodput is %.0f bytes/s at the least, %.0f at the median, "
+	    "%.0f at the most\n"
+	    "\tJain's fairness index is %.4f\n"
+	    "\t%lld events in %lld windows of %.4fs\n"
+	    "\t%.2fs on %d threads (%.0f events/s)\n",
+	    sorted.front(), sorted[num_flows/2], sorted.back(), jain_index(goodput),
+	    tot_events, windows, lookahead, wall, num_threads, wall>0 ? tot_events/wall : 0.0);
+
+    if (list_flows || num_flows<=LIST_FLOWS) {
+	fprintf(stdout, "\t%6s %10s %10s %12s %14s\n", "flow", "start(s)", "rtt(s)",
+		"delivered", "goodput(B/s)");
+	for (int i=0; i<num_flows; i++)
+	    fprintf(stdout, "\t%6d %10.3f %10.3f %12lld %14.0f\n", i, flows[i].start,
+		    flows[i].owd*2, flows[i].chars_delivered, goodput[i]);
+    }
+
+    /* the table of the one receiver, which is the one of this thread, with
+       the first partition */
+    if (idle_timeout>0) {
+	struct receiver_table_stats t;
+	Receiver_TableStats(&t);
+	std::vector<unsigned int> present, absent;
+	for (int i=0; i<num_flows; i++)
+	    if (Receiver_HasConnection(i+1))
+		present.push_back(i+1);
+	for (size_t i=0; i<present.size(); i++)
+	    absent.push_back(num_flows+1+i);
+	double hit = time_lookups(present), miss = time_lookups(absent);
+	fprintf(stdout, "\tthe receiver made %lld connections, %lld of them again from a "
+		"tombstone, and evicted %lld, %zu at the peak and %zu in the end, of which %zu "
+		"hold a reorder buffer\n", t.created, t.resumed, t.evicted, t.peak_connections,
+		t.connections, t.buffers);
+	fprintf(stdout, "\t%lld packets demultiplexed, %.2f slots probed per lookup, %lld "
+		"dropped as corrupted before it\n", t.lookups,
+		t.lookups>0 ? (double) t.probes/t.lookups : 0.0, t.corrupted);
+	fprintf(stdout, "\t%.1fns per lookup of a connection in the table, %.1fns of one "
+		"not in it, %zu connections in %zu slots\n", hit*1e9, miss*1e9,
+		t.connections, t.slots);
+	fprintf(stdout, "\t%.1f bytes of table per idle connection at the peak, in slots of "
+		"%zu bytes, and %zu tombstones held in the end\n", t.peak_connections>0 ?
+		(double) t.slots*t.slot_size/t.peak_connections : 0.0, t.slot_size,
+		t.tombstones);
+    }
+
+    /* every hop of the topology, the queueing delay is the time a packet
+       waits for the ones ahead of it */
+    if (topology_file!=NULL) {
+	size_t num_ports = 0;
+	for (size_t k=0; k<net.size(); k++)
+	    num_ports += net[k].ports.size();
+	if (list_flows || num_ports<=LIST_PORTS) {
+	    fprintf(stdout, "\t%-24s %10s %8s %8s %12s %12s %6s\n", "hop", "packets", "drops",
+		    "lost", "queue(ms)", "max(ms)", "util");
+	    for (size_t k=0; k<net.size(); k++)
+		for (size_t j=0; j<net[k].ports.size(); j++) {
+		    struct port *p = &net[k].ports[j];
+		    std::string hop = net[k].name + "->" + net[p->to].name;
+		    fprintf(stdout, "\t%-24s %10lld %8lld %8lld %12.3f %12.3f %5.1f%%\n",
+			    hop.c_str(), p->pkts, p->drops, p->lost,
+			    p->pkts>0 ? p->tot_queue_delay*1000/p->pkts : 0.0,
+			    p->max_queue_delay*1000,
+			    p->bandwidth>0 && end>0 ? p->bytes*100.0/(p->bandwidth*end) : 0.0);
+		}
+	}
+	if (hops_file!=NULL)
+	    write_hops(hops_file, end);
+    }
+
+    for (int i=0; i<num_flows; i++) {
+	Sender_FreeState(flows[i].sender);
+	Receiver_FreeState(flows[i].receiver);
+    }
+
+    if (passed)
+	fprintf(stdout, "## Congratulations! Every flow is error-free, loss-free, and in order.\n");
+    else
+	fprintf(stdout, "## Something is wrong! Some flow is NOT error-free, loss-free, and in order.\n");
+
+    return 0;
+}
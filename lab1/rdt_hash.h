@@ -0,0 +1,133 @@
+/*
+ * FILE: rdt_hash.h
+ * DESCRIPTION: A streaming 64-bit hash (XXH64) of a byte stream that comes
+ *       in pieces of any size, for checking a transfer end to end.  It
+ *       gives the same value as the reference xxHash implementation with
+ *       the same seed, on a little-endian machine.
+ */
+
+
+#ifndef _RDT_HASH_H_
+#define _RDT_HASH_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+
+#define XXH_PRIME1 0x9e3779b185ebca87ull
+#define XXH_PRIME2 0xc2b2ae3d27d4eb4full
+#define XXH_PRIME3 0x165667b19e3779f9ull
+#define XXH_PRIME4 0x85ebca77c2b2ae63ull
+#define XXH_PRIME5 0x27d4eb2f165667c5ull
+
+struct stream_hash {
+    uint64_t seed;
+    uint64_t acc[4];            /* the four lanes of the 32-byte stripes */
+    uint64_t total;             /* bytes hashed so far */
+    unsigned char stripe[32];   /* the bytes of a stripe not yet complete */
+    int buffered;
+};
+
+static inline uint64_t hash_rotl(uint64_t x, int r)
+{
+    return (x<<r) | (x>>(64-r));
+}
+
+static inline uint64_t hash_read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input*XXH_PRIME2;
+    return hash_rotl(acc, 31)*XXH_PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t h, uint64_t acc)
+{
+    h ^= hash_round(0, acc);
+    return h*XXH_PRIME1 + XXH_PRIME4;
+}
+
+static inline void hash_stripe(struct stream_hash *h, const unsigned char *p)
+{
+    for (int i=0; i<4; i++)
+	h->acc[i] = hash_round(h->acc[i], hash_read64(p + 8*i));
+}
+
+static inline void hash_init(struct stream_hash *h, uint64_t seed)
+{
+    h->seed = seed;
+    h->acc[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+    h->acc[1] = seed + XXH_PRIME2;
+    h->acc[2] = seed;
+    h->acc[3] = seed - XXH_PRIME1;
+    h->total = 0;
+    h->buffered = 0;
+}
+
+static inline void hash_update(struct stream_hash *h, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char*) data;
+    h->total += size;
+
+    /* complete the stripe left over from before */
+    if (h->buffered>0) {
+	size_t n = std::min(size, (size_t) (32 - h->buffered));
+	memcpy(h->stripe + h->buffered, p, n);
+	h->buffered += n;
+	p += n;
+	size -= n;
+	if (h->buffered<32)
+	    return;
+	hash_stripe(h, h->stripe);
+	h->buffered = 0;
+    }
+    for (; size>=32; p+=32, size-=32)
+	hash_stripe(h, p);
+    memcpy(h->stripe, p, size);
+    h->buffered = size;
+}
+
+static inline uint64_t hash_final(const struct stream_hash *h)
+{
+    uint64_t v;
+    if (h->total>=32) {
+	v = hash_rotl(h->acc[0], 1) + hash_rotl(h->acc[1], 7) +
+	    hash_rotl(h->acc[2], 12) + hash_rotl(h->acc[3], 18);
+	for (int i=0; i<4; i++)
+	    v = hash_merge(v, h->acc[i]);
+    } else
+	v = h->seed + XXH_PRIME5;
+    v += h->total;
+
+    const unsigned char *p = h->stripe, *end = h->stripe + h->buffered;
+    for (; p+8<=end; p+=8) {
+	v ^= hash_round(0, hash_read64(p));
+	v = hash_rotl(v, 27)*XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (p+4<=end) {
+	uint32_t w;
+	memcpy(&w, p, sizeof(w));
+	v ^= w*XXH_PRIME1;
+	v = hash_rotl(v, 23)*XXH_PRIME2 + XXH_PRIME3;
+	p += 4;
+    }
+    for (; p<end; p++) {
+	v ^= (*p)*XXH_PRIME5;
+	v = hash_rotl(v, 11)*XXH_PRIME1;
+    }
+
+    v ^= v>>33;
+    v *= XXH_PRIME2;
+    v ^= v>>29;
+    v *= XXH_PRIME3;
+    v ^= v>>32;
+    return v;
+}
+
+#endif  /* _RDT_HASH_H_ */
@@ -0,0 +1,364 @@
+/*
+ * FILE: rdt_host.cc
+ * DESCRIPTION: The pieces shared by the backends that run the sender and the
+ *       receiver in real time outside of the simulator.  See rdt_host.h.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_host.h"
+
+
+/* most messages passed by one call of host_feed_sender(), so that a
+   saturated upper layer does not starve the lower layer */
+#define MAX_FEED 64
+
+
+/*[]------------------------------------------------------------------------[]
+  |  gloabal variables, statistics, etc.
+  []------------------------------------------------------------------------[]*/
+
+double run_time;
+double msg_arrivalint;
+int msg_size;
+double outoforder_rate;
+double loss_rate;
+double corrupt_rate;
+int tracing_level;
+double reorder_delay = 0.002;
+
+struct host_stats sender_stats = {0, 0, 0, 0, 0, 0, 0, 0, 0, true};
+struct host_stats receiver_stats = {0, 0, 0, 0, 0, 0, 0, 0, 0, true};
+
+/* the time the run started at */
+static struct timespec start_time;
+
+/* the upper layer at the sender: the time the next message is due, whether
+   the rdt layer takes messages, and a message it refused */
+static double next_arrival = 0;
+static bool rdt_writable = true;
+static struct message *pending_msg = NULL;
+static unsigned int upper_layer_seed = 1;
+
+
+/*[]------------------------------------------------------------------------[]
+  |  workload
+  []------------------------------------------------------------------------[]*/
+
+void host_parse_workload(int argc, char *argv[], const char *options)
+{
+    if (argc!=8) {
+	fprintf(stderr, "usage: %s %s"
+		"<run_time> <mean_msg_arrivalint> <mean_msg_size> "
+		"<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level>\n",
+		argv[0], options);
+	exit(-1);
+    }
+
+    run_time = atof(argv[1]);
+    if (run_time<=0) {
+	fprintf(stderr, "invalid <run_time>\n");
+	exit(-1);
+    }
+    msg_arrivalint = atof(argv[2]);
+    if (msg_arrivalint<0) {
+	fprintf(stderr, "invalid <msg_arrivalint>\n");
+	exit(-1);
+    }
+    msg_size = atoi(argv[3]);
+    if (msg_size<=0) {
+	fprintf(stderr, "invalid <msg_size>\n");
+	exit(-1);
+    }
+    outoforder_rate = atof(argv[4]);
+    if (outoforder_rate<0 || outoforder_rate>1) {
+	fprintf(stderr, "invalid <outoforder_rate>\n");
+	exit(-1);
+    }
+    loss_rate = atof(argv[5]);
+    if (loss_rate<0 || loss_rate>1) {
+	fprintf(stderr, "invalid <loss_rate>\n");
+	exit(-1);
+    }
+    corrupt_rate = atof(argv[6]);
+    if (corrupt_rate<0 || corrupt_rate>1) {
+	fprintf(stderr, "invalid <corrupt_rate>\n");
+	exit(-1);
+    }
+    tracing_level = atoi(argv[7]);
+    if (tracing_level<0 || tracing_level>2) {
+	fprintf(stderr, "invalid <tracing_level>\n");
+	exit(-1);
+    }
+}
+
+void host_confirm_workload(const char *title, const char *backend)
+{
+    fprintf(stdout, "## %s with:\n"
+	    "\trun time is %.3f seconds\n"
+	    "\taverage message arrival interval is %.6f seconds%s\n"
+	    "\taverage message size is %d bytes\n"
+	    "\taverage out-of-order delivery rate is %.2f%% (held back up to %.3fs)\n"
+	    "\taverage loss rate is %.2f%%\n"
+	    "\taverage corrupt rate is %.2f%%\n"
+	    "%s"
+	    "\ttracing level is %d\n"
+	    "Please review these inputs and press <enter> to proceed.\n",
+	    title, run_time, msg_arrivalint,
+	    msg_arrivalint>0 ? "" : " (as fast as possible)",
+	    msg_size, outoforder_rate*100.0, reorder_delay, loss_rate*100.0,
+	    corrupt_rate*100.0, backend, tracing_level);
+    fgetc(stdin);
+    fflush(stdout);
+}
+
+void host_start_clock()
+{
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    upper_layer_seed = (unsigned int) start_time.tv_nsec;
+}
+
+/* seconds elapsed since the run started - for both the sender and the
+   receiver */
+double GetSimulationTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start_time.tv_sec) + (now.tv_nsec-start_time.tv_nsec)/1e9;
+}
+
+double host_random(unsigned int *seed)
+{
+    return(rand_r(seed)*1.0/RAND_MAX);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  upper layer
+  []------------------------------------------------------------------------[]*/
+
+/* generate a message, the same pattern as in the simulator */
+static struct message *generate_msg()
+{
+    static char cnt = 0;
+
+    struct message *msg = (struct message*) malloc(sizeof(struct message));
+    ASSERT(msg!=NULL);
+    msg->size = (int)(host_random(&upper_layer_seed)*2.0*msg_size);
+    if (msg->size==0) msg->size=1;
+    msg->data = (char*) malloc(msg->size);
+    ASSERT(msg->data!=NULL);
+
+    for (int i=0; i<msg->size; i+=1) {
+	msg->data[i] = '0' + cnt;
+	cnt = (cnt+1) % 10;
+    }
+
+    return msg;
+}
+
+/* free the space of a message */
+static void free_msg(struct message *msg)
+{
+    if (msg->data!=NULL) free(msg->data);
+    if (msg!=NULL) free(msg);
+}
+
+double host_feed_sender()
+{
+    double now = GetSimulationTime();
+    if (now>=run_time) {
+	/* the run is over, a message still held is never sent */
+	if (pending_msg!=NULL) {
+	    free_msg(pending_msg);
+	    pending_msg = NULL;
+	}
+	return -1;
+    }
+
+    for (int i=0; i<MAX_FEED && rdt_writable && next_arrival<=now; i++) {
+	if (tracing_level>=1)
+	    fprintf(stdout, "Time %.6fs (Sender): the upper layer instructs rdt layer to send out a message.\n", now);
+
+	if (pending_msg==NULL)
+	    pending_msg = generate_msg();
+	if (!Sender_FromUpperLayer(pending_msg)) {
+	    if (tracing_level>=1)
+		fprintf(stdout, "Time %.6fs (Sender): the rdt layer pushes back, the message is held.\n", now);
+	    rdt_writable = false;
+	    break;
+	}
+	sender_stats.chars_sent += pending_msg->size;
+	free_msg(pending_msg);
+	pending_msg = NULL;
+
+	if (msg_arrivalint>0)
+	    next_arrival = now + msg_arrivalint*2.0*host_random(&upper_layer_seed);
+    }
+
+    /* a refused message waits for Sender_UpperLayerWritable(), but the end of
+       the run still has to be noticed */
+    if (!rdt_writable || next_arrival>run_time)
+	return run_time;
+    return next_arrival;
+}
+
+/* tell the upper layer that a message refused by Sender_FromUpperLayer()
+   can be passed again */
+void Sender_UpperLayerWritable()
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.6fs (Sender): the rdt layer is writable again.\n",
+		GetSimulationTime());
+
+    rdt_writable = true;
+}
+
+/* deliver a message to the upper layer at the receiver */
+void Receiver_ToUpperLayer(struct message *msg)
+{
+    static char cnt = 0;
+
+    for (int i=0; i<msg->size; i++) {
+	/* message verification */
+	if (msg->data[i] != '0' + cnt) {
+	    receiver_stats.verification_passed = false;
+	}
+	cnt = (cnt+1) % 10;
+
+	if (tracing_level>=2)
+	    fputc(msg->data[i], stdout);
+    }
+
+    receiver_stats.chars_delivered += msg->size;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  impairment layer
+  []------------------------------------------------------------------------[]*/
+
+Impairment::Impairment(struct host_stats *stats, unsigned int seed)
+    : stats(stats), seed(seed), order(0)
+{
+}
+
+bool Impairment::impair(const struct packet *pkt, int size, struct packet *out, bool *reordered)
+{
+    ASSERT(size>0 && size<=RDT_PKTSIZE);
+    stats->pkts_sent ++;
+    stats->bytes_sent += size;
+
+    /* packet lost at rate "loss_rate" */
+    if (host_random(&seed)<loss_rate) {
+	stats->pkts_lost ++;
+	return false;
+    }
+
+    memcpy(out->data, pkt->data, size);
+
+    /* packet corrupted at rate "corrupt_rate" */
+    if (host_random(&seed)<corrupt_rate) {
+	for (int i=0; i<size; i++) {
+	    out->data[i] = out->data[i] + (char)(host_random(&seed)*20) - 10;
+	}
+	stats->pkts_corrupted ++;
+    }
+
+    /* packet delivered out of order at rate "outoforder_rate" */
+    *reordered = host_random(&seed)<outoforder_rate;
+    if (*reordered)
+	stats->pkts_reordered ++;
+    return true;
+}
+
+double Impairment::reorder_hold()
+{
+    return reorder_delay*host_random(&seed);
+}
+
+bool Impairment::pass(const struct packet *pkt, int size, double now, struct packet *out)
+{
+    bool reordered;
+    if (!impair(pkt, size, out, &reordered))
+	return false;
+    if (!reordered)
+	return true;
+
+    held_pkt h;
+    h.release = now + reorder_hold();
+    h.order = order ++;
+    h.size = size;
+    memcpy(h.pkt.data, out->data, size);
+    held.push(h);
+    return false;
+}
+
+bool Impairment::release(double now, struct packet *out, int *size)
+{
+    if (held.empty() || held.top().release>now)
+	return false;
+    *size = held.top().size;
+    memcpy(out->data, held.top().pkt.data, *size);
+    held.pop();
+    return true;
+}
+
+double Impairment::next_release()
+{
+    return held.empty() ? -1 : held.top().release;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  report
+  []------------------------------------------------------------------------[]*/
+
+double host_cpu_time()
+{
+    struct rusage self_usage, child_usage;
+    getrusage(RUSAGE_SELF, &self_usage);
+    getrusage(RUSAGE_CHILDREN, &child_usage);
+    return self_usage.ru_utime.tv_sec + self_usage.ru_utime.tv_usec/1e6
+	+ self_usage.ru_stime.tv_sec + self_usage.ru_stime.tv_usec/1e6
+	+ child_usage.ru_utime.tv_sec + child_usage.ru_utime.tv_usec/1e6
+	+ child_usage.ru_stime.tv_sec + child_usage.ru_stime.tv_usec/1e6;
+}
+
+void host_report(double elapsed, double cpu_time)
+{
+    struct host_stats &s = sender_stats, &r = receiver_stats;
+    fprintf(stdout, "\n");
+    fprintf(stdout, "## Transfer completed after %.2fs with\n"
+	    "\t%lld characters sent\n"
+	    "\t%lld characters delivered\n"
+	    "\t%lld packets (%lld bytes) sent by the sender, %lld packets (%lld bytes) by the receiver\n"
+	    "\t%lld lost, %lld corrupted and %lld held back by the impairment layer, %lld dropped by a full lower layer\n"
+	    "\tthroughput is %.0f bytes/s, using %.3fs of CPU (%.2f us per KB delivered)\n",
+	    elapsed, s.chars_sent, r.chars_delivered,
+	    s.pkts_sent, s.bytes_sent, r.pkts_sent, r.bytes_sent,
+	    s.pkts_lost + r.pkts_lost, s.pkts_corrupted + r.pkts_corrupted,
+	    s.pkts_reordered + r.pkts_reordered, s.pkts_dropped + r.pkts_dropped,
+	    r.chars_delivered/elapsed, cpu_time,
+	    r.chars_delivered ? cpu_time*1e6/(r.chars_delivered/1024.0) : 0.0);
+}
+
+int host_verdict()
+{
+    if (receiver_stats.verification_passed &&
+	sender_stats.chars_sent==receiver_stats.chars_delivered) {
+	fprintf(stdout, "## Congratulations! This session is error-free, loss-free, and in order.\n");
+	return 0;
+    }
+    fprintf(stdout, "## Something is wrong! This session is NOT error-free, loss-free, and in order.\n");
+    return -1;
+}
@@ -0,0 +1,127 @@
+/*
+ * FILE: rdt_host.h
+ * DESCRIPTION: The pieces shared by the backends that run the sender and the
+ *       receiver in real time outside of the simulator: the workload given
+ *       on the command line, the upper layer generating and verifying the
+ *       messages, the impairment layer, and the final report.
+ */
+
+
+#ifndef _RDT_HOST_H_
+#define _RDT_HOST_H_
+
+#include <queue>
+#include <vector>
+
+#include "rdt_struct.h"
+
+
+/* the workload, from the same positional arguments as the simulator except
+   that the first one is the run time in real seconds, and a mean message
+   arrival interval of 0 passes messages as fast as the rdt layer takes them */
+extern double run_time;
+extern double msg_arrivalint;
+extern int msg_size;
+extern double outoforder_rate;
+extern double loss_rate;
+extern double corrupt_rate;
+extern int tracing_level;
+
+/* an out-of-order packet is held back for a random time up to this long
+   (in seconds), the others go out right away */
+extern double reorder_delay;
+
+/* statistics of one side, the receiver process passes its own to the sender
+   at the end */
+struct host_stats {
+    long long chars_sent;
+    long long chars_delivered;
+    long long pkts_sent;
+    long long bytes_sent;
+    long long pkts_lost;
+    long long pkts_corrupted;
+    long long pkts_reordered;
+    long long pkts_dropped;     /* refused by a full lower layer */
+    long long pkts_received;
+    bool verification_passed;
+};
+extern struct host_stats sender_stats;
+extern struct host_stats receiver_stats;
+
+/* parse the positional arguments argv[1..7], exit with the usage if they are
+   not valid; options describes the backend's own options in the usage */
+void host_parse_workload(int argc, char *argv[], const char *options);
+
+/* print the workload and the lines describing the backend, then wait for
+   <enter> */
+void host_confirm_workload(const char *title, const char *backend);
+
+/* start the clock behind GetSimulationTime(), shared by processes forked
+   after it */
+void host_start_clock();
+
+/* a random number in [0,1] from a private seed, so that threads do not share
+   one sequence */
+double host_random(unsigned int *seed);
+
+/* the upper layer at the sender: passes messages while they are due and the
+   rdt layer takes them.  returns the time it wants to run again, or -1 once
+   the run is over */
+double host_feed_sender();
+
+/* the CPU time used by this process and its waited-for children */
+double host_cpu_time();
+
+/* print the common part of the final report */
+void host_report(double elapsed, double cpu_time);
+
+/* print the verdict, and return the exit code */
+int host_verdict();
+
+
+/* the impairment layer in front of one side's lower layer: loses, corrupts
+   and holds back packets at the rates given on the command line, counting
+   them in the side's statistics */
+class Impairment
+{
+public:
+    Impairment(struct host_stats *stats, unsigned int seed);
+
+    /* pass a packet on its way to the lower layer.  return true if it goes
+       out right away, as copied (and maybe corrupted) into out */
+    bool pass(const struct packet *pkt, int size, double now, struct packet *out);
+
+    /* lose, corrupt and pick out of order one packet without holding it
+       back: return false if it is lost, otherwise copy it into out and set
+       reordered when it is to be delivered out of order */
+    bool impair(const struct packet *pkt, int size, struct packet *out, bool *reordered);
+
+    /* how long to hold back an out-of-order packet, up to reorder_delay */
+    double reorder_hold();
+
+    /* take a held back packet whose time has come, return false if none */
+    bool release(double now, struct packet *out, int *size);
+
+    /* release time of the next held back packet, -1 if none is held */
+    double next_release();
+
+private:
+    struct held_pkt {
+	double release;
+	long long order;
+	int size;
+	struct packet pkt;
+    };
+    struct later_release {
+	bool operator()(const held_pkt &a, const held_pkt &b) const {
+	    return a.release>b.release || (a.release==b.release && a.order>b.order);
+	}
+    };
+
+    struct host_stats *stats;
+    unsigned int seed;
+    std::priority_queue<held_pkt, std::vector<held_pkt>, later_release> held;
+    long long order;
+};
+
+#endif  /* _RDT_HOST_H_ */
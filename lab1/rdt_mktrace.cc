@@ -0,0 +1,148 @@
+/*
+ * FILE: rdt_mktrace.cc
+ * DESCRIPTION: Converts a text trace of a link into the binary trace that
+ *       rdt_sim -R replays (see rdt_channel.h).  Each line of the text is a
+ *       packet, in the order they are sent:
+ *
+ *           <delay>              delivered after delay seconds
+ *           <delay> corrupt      delivered corrupted
+ *           lost                 lost
+ *
+ *       and '#' starts a comment.  With -w, it converts a text trace of
+ *       messages into the workload trace that rdt_sim -W replays (see
+ *       rdt_workload.h) instead, a line per message in the order they arrive:
+ *
+ *           <interval> <size>    size bytes, interval seconds after the
+ *                                message before
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdt_channel.h"
+#include "rdt_workload.h"
+
+
+/* convert a text trace of messages, from in to out */
+static void make_workload(FILE *in, FILE *out, const char *name)
+{
+    struct trace_header h = {};
+    memcpy(h.magic, WORKLOAD_MAGIC, sizeof(h.magic));
+    h.version = WORKLOAD_VERSION;
+    fwrite(&h, sizeof(h), 1, out);
+
+    char line[256];
+    long long lineno = 0, messages = 0, bytes = 0;
+    double duration = 0;
+    while (fgets(line, sizeof(line), in)!=NULL) {
+	lineno ++;
+	char *comment = strchr(line, '#');
+	if (comment!=NULL) *comment = '\0';
+
+	double interval;
+	long long size;
+	char extra;
+	int n = sscanf(line, "%lf %lld %c", &interval, &size, &extra);
+	if (n<=0) continue;
+	if (n!=2 || interval<0 || interval*1e6>UINT32_MAX || size<=0 || size>UINT32_MAX) {
+	    fprintf(stderr, "%s:%lld: expected <interval> <size>, with an interval under "
+		    "%.0fs\n", name, lineno, UINT32_MAX*1e-6);
+	    exit(-1);
+	}
+	struct workload_record record;
+	record.interval = (uint32_t) (interval*1e6 + 0.5);
+	record.size = (uint32_t) size;
+	fwrite(&record, sizeof(record), 1, out);
+	messages ++;
+	bytes += size;
+	duration += interval;
+    }
+    if (messages==0) {
+	fprintf(stderr, "%s: no messages\n", name);
+	exit(-1);
+    }
+    fprintf(stdout, "%lld messages, %lld bytes over %.3fs\n", messages, bytes, duration);
+}
+
+int main(int argc, char *argv[])
+{
+    bool workload = argc==4 && strcmp(argv[1], "-w")==0;
+    if (workload) {
+	argv ++;
+	argc --;
+    }
+    if (argc!=3) {
+	fprintf(stderr, "usage: %s [-w] <text_trace> <trace_file>\n", argv[0]);
+	exit(-1);
+    }
+    FILE *in = strcmp(argv[1], "-")==0 ? stdin : fopen(argv[1], "r");
+    if (in==NULL) {
+	perror(argv[1]);
+	exit(-1);
+    }
+    FILE *out = fopen(argv[2], "wb");
+    if (out==NULL) {
+	perror(argv[2]);
+	exit(-1);
+    }
+
+    if (workload) {
+	make_workload(in, out, argv[1]);
+	if (in!=stdin) fclose(in);
+	if (fclose(out)!=0) {
+	    perror(argv[2]);
+	    exit(-1);
+	}
+	return 0;
+    }
+
+    struct trace_header h = {};
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    h.version = TRACE_VERSION;
+    fwrite(&h, sizeof(h), 1, out);
+
+    char line[256];
+    long long lineno = 0, packets = 0, lost = 0, corrupted = 0;
+    while (fgets(line, sizeof(line), in)!=NULL) {
+	lineno ++;
+	char *comment = strchr(line, '#');
+	if (comment!=NULL) *comment = '\0';
+
+	char word[16], extra;
+	double delay;
+	uint32_t record;
+	if (sscanf(line, "%15s %c", word, &extra)==1 && strcmp(word, "lost")==0) {
+	    record = TRACE_LOST;
+	    lost ++;
+	} else {
+	    int n = sscanf(line, "%lf %15s %c", &delay, word, &extra);
+	    if (n<=0) continue;
+	    if ((n==2 && strcmp(word, "corrupt")!=0) || n>2 ||
+		delay<0 || delay*1e6>TRACE_DELAY_MASK) {
+		fprintf(stderr, "%s:%lld: expected <delay> [corrupt] or lost, with a delay "
+			"under %.0fs\n", argv[1], lineno, TRACE_DELAY_MASK*1e-6);
+		exit(-1);
+	    }
+	    record = (uint32_t) (delay*1e6 + 0.5);
+	    if (n==2) {
+		record |= TRACE_CORRUPTED;
+		corrupted ++;
+	    }
+	}
+	fwrite(&record, sizeof(record), 1, out);
+	packets ++;
+    }
+    if (in!=stdin) fclose(in);
+    if (fclose(out)!=0) {
+	perror(argv[2]);
+	exit(-1);
+    }
+    if (packets==0) {
+	fprintf(stderr, "%s: no packets\n", argv[1]);
+	exit(-1);
+    }
+    fprintf(stdout, "%lld packets, %lld lost and %lld corrupted\n", packets, lost, corrupted);
+    return 0;
+}
@@ -0,0 +1,586 @@
+/*
+ * FILE: rdt_mt.cc
+ * DESCRIPTION: Runs the reliable data transfer sender and receiver on their
+ *       own threads in one process, in place of the simulator, with a
+ *       third thread playing the link.  The threads pass packets through
+ *       the lock-free rings of rdt_ring.h: the sender and the receiver
+ *       push to the channel thread, which loses, corrupts and reorders them
+ *       like the impairment layer of the other backends, delays them by the
+ *       link latency, and pushes them on to the other side.  Each thread
+ *       keeps its timers in its own timer wheel on the real clock: the
+ *       sender timer at the sender, and the packets on the link at the
+ *       channel.  Each thread may be pinned to a core.
+ * NOTE: Linux only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <algorithm>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_host.h"
+#include "rdt_ring.h"
+
+
+/* the timer wheel: slots of WHEEL_TICK seconds each, WHEEL_SLOTS of them (a
+   power of two) to a turn */
+#define WHEEL_TICK 20e-6
+#define WHEEL_SLOTS 1024
+
+/* most packets taken from a ring before the timers are checked again */
+#define MAX_DRAIN 256
+
+/* the cycles of one ACK in this many are kept for the percentiles */
+#define CYCLE_SAMPLE_EVERY 16
+
+/* how long the sender may keep retransmitting after the run is over */
+#define DRAIN_TIMEOUT 10.0
+
+
+/*[]------------------------------------------------------------------------[]
+  |  timer wheel
+  []------------------------------------------------------------------------[]*/
+
+/* a timer, linked into the slot of the tick it expires in */
+struct wheel_timer {
+    struct wheel_timer *prev;
+    struct wheel_timer *next;
+    long long tick;
+};
+
+/* a hashed timer wheel.  a timer lands in the slot of its tick modulo
+   WHEEL_SLOTS, one further out than a turn stays there for later turns.
+   timers in a slot expire in the order they were scheduled.  each thread has
+   its own, so it needs no locking */
+class TimerWheel
+{
+public:
+    TimerWheel() : current(0), count(0) {
+	for (int i=0; i<WHEEL_SLOTS; i++)
+	    slots[i].prev = slots[i].next = &slots[i];
+    }
+
+    bool pending(struct wheel_timer *t) { return t->next!=NULL; }
+
+    /* (re)schedule a timer to expire at time when, at most a tick late */
+    void schedule(struct wheel_timer *t, double when) {
+	if (pending(t))
+	    cancel(t);
+	t->tick = std::max((long long) ceil(when/WHEEL_TICK), current);
+	link(&slots[t->tick & (WHEEL_SLOTS-1)], t);
+	count ++;
+    }
+
+    void cancel(struct wheel_timer *t) {
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->prev = t->next = NULL;
+	count --;
+    }
+
+    /* expire the timers due by now, calling fire(t) for each of them, which
+       may schedule timers again */
+    template <typename F> void advance(double now, F fire) {
+	long long until = (long long) floor(now/WHEEL_TICK);
+	for (; current<=until; current++) {
+	    if (count==0) {
+		current = until+1;
+		break;
+	    }
+	    /* the slot is moved aside first, so fire() may change it */
+	    struct wheel_timer *slot = &slots[current & (WHEEL_SLOTS-1)], batch;
+	    if (slot->next==slot) continue;
+	    batch.next = slot->next;
+	    batch.prev = slot->prev;
+	    batch.next->prev = batch.prev->next = &batch;
+	    slot->prev = slot->next = slot;
+	    while (batch.next!=&batch) {
+		struct wheel_timer *t = batch.next;
+		t->prev->next = t->next;
+		t->next->prev = t->prev;
+		if (t->tick>current) {
+		    link(slot, t);
+		    continue;
+		}
+		t->prev = t->next = NULL;
+		count --;
+		fire(t);
+	    }
+	}
+    }
+
+    /* the start of the next tick with a timer in its slot, -1 if there are
+       no timers.  a timer of a later turn makes it early, never late */
+    double next_deadline() {
+	if (count==0) return -1;
+	for (long long tick=current; tick<current+WHEEL_SLOTS; tick++) {
+	    struct wheel_timer *slot = &slots[tick & (WHEEL_SLOTS-1)];
+	    if (slot->next!=slot)
+		return tick*WHEEL_TICK;
+	}
+	return (current+WHEEL_SLOTS)*WHEEL_TICK;
+    }
+
+private:
+    static void link(struct wheel_timer *slot, struct wheel_timer *t) {
+	t->prev = slot->prev;
+	t->next = slot;
+	slot->prev->next = t;
+	slot->prev = t;
+    }
+
+    struct wheel_timer slots[WHEEL_SLOTS];
+    long long current;          /* the next tick to expire */
+    long long count;
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  gloabal variables, statistics, etc.
+  []------------------------------------------------------------------------[]*/
+
+/* spin on the rings instead of sleeping on the futex */
+bool busy_poll = false;
+
+/* the one-way latency of the link (in seconds), on top of which an
+   out-of-order packet is held back */
+double link_latency = 0;
+
+/* the cores the sender, the receiver and the channel threads are pinned to,
+   -1 for none */
+int sender_cpu = -1;
+int receiver_cpu = -1;
+int channel_cpu = -1;
+
+/* the rings between the threads, named after where the packets go, what each
+   thread sleeps on, and whether the run is over */
+struct mt_rings {
+    struct ring sender_out;
+    struct ring to_receiver;
+    struct ring receiver_out;
+    struct ring to_sender;
+    struct ring_waiter sender_waiter;
+    struct ring_waiter receiver_waiter;
+    struct ring_waiter channel_waiter;
+    alignas(CACHE_LINE) std::atomic<unsigned int> done;
+};
+struct mt_rings *rings = NULL;
+
+/* the sender thread: its ring ends, the sender timer in its wheel, and the
+   cost of Sender_FromLowerLayer() */
+struct ring_producer sender_out;
+struct ring_consumer sender_in;
+TimerWheel sender_wheel;
+struct wheel_timer sender_timer = {NULL, NULL, 0};
+long long acks_taken = 0;
+unsigned long long ack_cycles = 0;
+std::vector<double> ack_cycle_samples;
+
+/* the receiver thread's ring ends */
+struct ring_producer receiver_out;
+struct ring_consumer receiver_in;
+
+/* packets the channel thread found the next ring full for, and passed on */
+long long channel_dropped = 0;
+long long channel_passed = 0;
+
+/* when the sender finished, and the cycle counter over the whole run */
+double elapsed;
+unsigned long long run_cycles;
+
+
+/*[]------------------------------------------------------------------------[]
+  |  helpers
+  []------------------------------------------------------------------------[]*/
+
+/* the CPU's cycle counter, or nanoseconds where there is none */
+static inline unsigned long long cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/* the p-th percentile of the samples */
+static double percentile(std::vector<double> &samples, double p)
+{
+    if (samples.empty()) return 0;
+    size_t k = (size_t)(p*(samples.size()-1));
+    std::nth_element(samples.begin(), samples.begin()+k, samples.end());
+    return samples[k];
+}
+
+/* the earlier of two deadlines, -1 standing for none */
+static double earlier(double a, double b)
+{
+    if (a<0) return b;
+    if (b<0) return a;
+    return std::min(a, b);
+}
+
+/* pin the calling thread */
+static void pin_to(int cpu)
+{
+    if (cpu<0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)!=0)
+	perror("sched_setaffinity");
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  transport routines
+  []------------------------------------------------------------------------[]*/
+
+/* start the sender timer with a specified timeout (in seconds).
+   the timer is cancelled with Sender_StopTimer() is called or a new
+   Sender_StartTimer() is called before the current timer expires.
+   Sender_Timeout() will be called when the timer expires. */
+void Sender_StartTimer(double timeout)
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.6fs (Sender): the timer is started (expires at %.6fs).\n",
+		GetSimulationTime(), GetSimulationTime() + timeout);
+
+    sender_wheel.schedule(&sender_timer, GetSimulationTime() + timeout);
+}
+
+/* stop the sender timer */
+void Sender_StopTimer()
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.6fs (Sender): the timer is stopped.\n",
+		GetSimulationTime());
+
+    if (sender_wheel.pending(&sender_timer))
+	sender_wheel.cancel(&sender_timer);
+}
+
+/* check whether the sender timer is being set,
+   return true if the timer is set, return false otherwise */
+bool Sender_isTimerSet()
+{
+    return sender_wheel.pending(&sender_timer);
+}
+
+/* pass a packet to the lower layer at the sender, only the first size bytes
+   of the packet are carried over the link */
+void Sender_ToLowerLayer(struct packet *pkt, int size)
+{
+    if (!ring_push(&sender_out, pkt, size, GetSimulationTime()))
+	sender_stats.pkts_dropped ++;
+}
+
+/* pass a packet to the lower layer at the receiver, only the first size bytes
+   of the packet are carried over the link */
+void Receiver_ToLowerLayer(struct packet *pkt, int size)
+{
+    if (!ring_push(&receiver_out, pkt, size, GetSimulationTime()))
+	receiver_stats.pkts_dropped ++;
+}
+
+/* no packet is ever marked congestion experienced */
+bool Receiver_isCongestionMarked()
+{
+    return false;
+}
+
+/* pass the packets in the incoming ring to one side's rdt layer, return how
+   many there were */
+static int receive_packets(struct ring_consumer *in, bool is_sender)
+{
+    struct ring_slot *slot;
+    int n = 0;
+    while (n<MAX_DRAIN && (slot = ring_peek(in))!=NULL) {
+	struct packet pkt;
+	int size = slot->size;
+	memcpy(pkt.data, slot->pkt.data, size);
+	in->tail ++;
+	n ++;
+
+	/* the rest of the packet handed to the rdt layer is zeroed */
+	memset(&pkt.data[size], 0, RDT_PKTSIZE-size);
+	if (tracing_level>=1)
+	    fprintf(stdout, "Time %.6fs (%s): the lower layer informs the rdt layer that a packet is received from the link.\n",
+		    GetSimulationTime(), is_sender ? "Sender" : "Receiver");
+	if (is_sender) {
+	    sender_stats.pkts_received ++;
+	    unsigned long long start = cycles();
+	    Sender_FromLowerLayer(&pkt);
+	    unsigned long long spent = cycles() - start;
+	    ack_cycles += spent;
+	    if (acks_taken++ % CYCLE_SAMPLE_EVERY==0)
+		ack_cycle_samples.push_back(spent);
+	} else {
+	    receiver_stats.pkts_received ++;
+	    Receiver_FromLowerLayer(&pkt);
+	}
+    }
+    if (n>0)
+	ring_release(in);
+    return n;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  threads
+  []------------------------------------------------------------------------[]*/
+
+/* the sender passes messages to the rdt layer for run_time seconds and stops
+   once every packet is acknowledged, then ends the run */
+static void *sender_thread(void *)
+{
+    pin_to(sender_cpu);
+    Sender_Init();
+
+    bool generating = true;
+    for (;;) {
+	int received = receive_packets(&sender_in, true);
+
+	double now = GetSimulationTime();
+	sender_wheel.advance(now, [now](struct wheel_timer *) {
+	    if (tracing_level>=1)
+		fprintf(stdout, "Time %.6fs (Sender): the timer expires.\n", now);
+	    Sender_Timeout();
+	});
+
+	double due = generating ? host_feed_sender() : -1;
+	if (due<0) generating = false;
+	ring_publish(&sender_out, busy_poll);
+
+	now = GetSimulationTime();
+	if (!generating) {
+	    /* done once nothing is left in flight */
+	    if (!Sender_isTimerSet())
+		break;
+	    if (now>run_time+DRAIN_TIMEOUT) {
+		fprintf(stdout, "Time %.6fs (Sender): gave up waiting for the last acknowledgements.\n", now);
+		break;
+	    }
+	}
+
+	if (received==0 && (due<0 || due>now)) {
+	    double deadline = earlier(sender_wheel.next_deadline(), due);
+	    if (!generating)
+		deadline = earlier(deadline, run_time+DRAIN_TIMEOUT);
+	    ring_wait(&rings->sender_waiter, &sender_in, 1, &rings->done, deadline, busy_poll);
+	}
+    }
+
+    Sender_Final();
+    elapsed = GetSimulationTime();
+    fflush(stdout);
+
+    /* tell the others, and wake them up if they sleep */
+    rings->done.store(1, std::memory_order_release);
+    ring_wake(&rings->receiver_waiter);
+    ring_wake(&rings->channel_waiter);
+    return NULL;
+}
+
+/* the receiver runs until the sender is done */
+static void *receiver_thread(void *)
+{
+    pin_to(receiver_cpu);
+    Receiver_Init();
+
+    while (!rings->done.load(std::memory_order_acquire)) {
+	int received = receive_packets(&receiver_in, false);
+	ring_publish(&receiver_out, busy_poll);
+	if (received==0)
+	    ring_wait(&rings->receiver_waiter, &receiver_in, 1, &rings->done, -1, busy_poll);
+    }
+
+    Receiver_Final();
+    fflush(stdout);
+    return NULL;
+}
+
+/* a packet on the link, from the channel thread's pool */
+struct link_pkt {
+    struct wheel_timer timer;   /* first, so that the timer leads to it */
+    int size;
+    bool to_receiver;
+    struct packet pkt;
+};
+
+/* the channel impairs the packets each side sends, delays them by the link
+   latency in its timer wheel, and passes them on, until the sender is done */
+static void *channel_thread(void *)
+{
+    pin_to(channel_cpu);
+
+    Impairment forward(&sender_stats, (unsigned int) cycles());
+    Impairment backward(&receiver_stats, (unsigned int) cycles() + 1);
+    TimerWheel wheel;
+    std::vector<struct link_pkt*> pool;
+    struct ring_consumer in[2];
+    struct ring_producer to_receiver, to_sender;
+    ring_attach(&in[0], &rings->sender_out);
+    ring_attach(&in[1], &rings->receiver_out);
+    ring_attach(&to_receiver, &rings->to_receiver, &rings->receiver_waiter);
+    ring_attach(&to_sender, &rings->to_sender, &rings->sender_waiter);
+
+    while (!rings->done.load(std::memory_order_acquire)) {
+	int taken = 0;
+	for (int i=0; i<2; i++) {
+	    Impairment &channel = i==0 ? forward : backward;
+	    struct ring_slot *slot;
+	    int n = 0;
+	    while (n<MAX_DRAIN && (slot = ring_peek(&in[i]))!=NULL) {
+		struct link_pkt *lp;
+		if (pool.empty()) {
+		    lp = new struct link_pkt;
+		    lp->timer.prev = lp->timer.next = NULL;
+		} else {
+		    lp = pool.back();
+		    pool.pop_back();
+		}
+		bool reordered;
+		if (channel.impair(&slot->pkt, slot->size, &lp->pkt, &reordered)) {
+		    lp->size = slot->size;
+		    lp->to_receiver = i==0;
+		    double delay = link_latency + (reordered ? channel.reorder_hold() : 0);
+		    wheel.schedule(&lp->timer, slot->sent_time + delay);
+		} else {
+		    pool.push_back(lp);
+		}
+		in[i].tail ++;
+		n ++;
+	    }
+	    if (n>0)
+		ring_release(&in[i]);
+	    taken += n;
+	}
+
+	wheel.advance(GetSimulationTime(), [&](struct wheel_timer *t) {
+	    struct link_pkt *lp = (struct link_pkt*) t;
+	    if (ring_push(lp->to_receiver ? &to_receiver : &to_sender, &lp->pkt, lp->size,
+			  GetSimulationTime()))
+		channel_passed ++;
+	    else
+		channel_dropped ++;
+	    pool.push_back(lp);
+	});
+	ring_publish(&to_receiver, busy_poll);
+	ring_publish(&to_sender, busy_poll);
+
+	if (taken==0)
+	    ring_wait(&rings->channel_waiter, in, 2, &rings->done, wheel.next_deadline(), busy_poll);
+    }
+
+    for (size_t i=0; i<pool.size(); i++)
+	delete pool[i];
+    return NULL;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main control routine
+  []------------------------------------------------------------------------[]*/
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+	{"latency", required_argument, NULL, 'L'},
+	{"reorder-delay", required_argument, NULL, 'l'},
+	{"busy-poll", no_argument, NULL, 'p'},
+	{"cpus", required_argument, NULL, 'c'},
+	{NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "L:l:pc:", long_options, NULL)) != -1) {
+	switch (opt) {
+	case 'L':
+	    link_latency = atof(optarg);
+	    if (link_latency<0) {
+		fprintf(stderr, "invalid <latency>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'l':
+	    reorder_delay = atof(optarg);
+	    if (reorder_delay<0) {
+		fprintf(stderr, "invalid <reorder_delay>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'p':
+	    busy_poll = true;
+	    break;
+	case 'c':
+	    if (sscanf(optarg, "%d,%d,%d", &sender_cpu, &receiver_cpu, &channel_cpu)!=3 ||
+		sender_cpu<0 || receiver_cpu<0 || channel_cpu<0) {
+		fprintf(stderr, "invalid <sender_cpu>,<receiver_cpu>,<channel_cpu>\n");
+		exit(-1);
+	    }
+	    break;
+	default:
+	    argc = 0;
+	    break;
+	}
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    host_parse_workload(argc, argv, "[-L <latency>] [-l <reorder_delay>] [-p] "
+			"[-c <sender_cpu>,<receiver_cpu>,<channel_cpu>] ");
+    char backend[256];
+    snprintf(backend, sizeof(backend),
+	     "\tlink latency is %.6f seconds\n"
+	     "\t%s while waiting for packets\n"
+	     "\tsender on cpu %d, receiver on cpu %d, channel on cpu %d (-1 is not pinned)\n",
+	     link_latency, busy_poll ? "busy-polling" : "sleeping on a futex",
+	     sender_cpu, receiver_cpu, channel_cpu);
+    host_confirm_workload("Reliable data transfer between threads", backend);
+
+    rings = new struct mt_rings();
+    ring_attach(&sender_out, &rings->sender_out, &rings->channel_waiter);
+    ring_attach(&sender_in, &rings->to_sender);
+    ring_attach(&receiver_out, &rings->receiver_out, &rings->channel_waiter);
+    ring_attach(&receiver_in, &rings->to_receiver);
+
+    host_start_clock();
+    unsigned long long start_cycles = cycles();
+
+    pthread_t threads[3];
+    ASSERT(pthread_create(&threads[0], NULL, channel_thread, NULL)==0);
+    ASSERT(pthread_create(&threads[1], NULL, receiver_thread, NULL)==0);
+    ASSERT(pthread_create(&threads[2], NULL, sender_thread, NULL)==0);
+    for (int i=0; i<3; i++)
+	pthread_join(threads[i], NULL);
+    run_cycles = cycles() - start_cycles;
+
+    /* the report only shows the drops of both sides together, so the ones
+       of the channel go in with the sender's */
+    sender_stats.pkts_dropped += channel_dropped;
+    host_report(elapsed, host_cpu_time());
+
+    double cycles_per_second = run_cycles/GetSimulationTime();
+    double mean = acks_taken ? (double) ack_cycles/acks_taken : 0;
+    fprintf(stdout, "\t%.3f million packets per second through the channel\n"
+	    "\t%lld ACKs taken by Sender_FromLowerLayer() at %.0f cycles (%.0f ns) each on average,\n"
+	    "\t%.0f cycles at p50 and %.0f cycles at p99\n",
+	    channel_passed/elapsed/1e6, acks_taken, mean, mean/cycles_per_second*1e9,
+	    percentile(ack_cycle_samples, 0.5), percentile(ack_cycle_samples, 0.99));
+    return host_verdict();
+}
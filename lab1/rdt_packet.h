@@ -0,0 +1,236 @@
+/*
+ * FILE: rdt_packet.h
+ * DESCRIPTION: The packet layout shared by the sender and the receiver.
+ *
+ *       |<- flag|size ->|<- seq(4 bytes) ->|<- ack(4 bytes) ->|<- checksum(2 bytes) ->|<- payload ->|
+ *
+ * The layout is a template on the packet size, so every offset below is a compile-time constant and code built for
+ * a different RDT_PKTSIZE gets its own constant-folded copy. The size field is a single byte while the payload
+ * still fits in seven bits of it, and grows to two bytes for larger packets (e.g. a 1500 or 9000 byte MTU). Its top
+ * bit is a flag, which an ack sets to echo a congestion mark (ECE).
+ *
+ * Built with -DRDT_CONN_ID, the header ends with a 4-byte connection id, which the sender stamps on its packets
+ * and the receiver echoes in its acks, so that one receiver can tell many senders apart (see Receiver_Demux()).
+ *
+ * Seqs and acks are 32-bit serial numbers (RFC 1982), compared with SeqBefore() and SeqAfter() so that they wrap
+ * around. The first seq is RDT_FIRST_SEQ, which a build may set close to the wrap to get there early.
+ */
+
+
+#ifndef _RDT_PACKET_H_
+#define _RDT_PACKET_H_
+
+#include <string.h>
+
+#include "rdt_struct.h"
+#include "rdt_profile.h"
+
+template<int PktSize>
+struct PacketLayout {
+    static constexpr int size_bytes = PktSize - 11 <= 127 ? 1 : 2;
+    /* the size takes the bits of the field below the flag */
+    static constexpr unsigned int flag_bit = 1u << (size_bytes * 8 - 1);
+    static constexpr int seq_offset = size_bytes;
+    static constexpr int ack_offset = seq_offset + 4;
+    static constexpr int checksum_offset = ack_offset + 4;
+#ifdef RDT_CONN_ID
+    static constexpr int conn_bytes = 4;
+#else
+    static constexpr int conn_bytes = 0;
+#endif
+    static constexpr int conn_offset = checksum_offset + 2;
+    static constexpr int header_size = conn_offset + conn_bytes;
+    static constexpr int max_payload = PktSize - header_size;
+
+    static_assert(max_payload > 0, "packet too small to hold the header");
+    static_assert(max_payload < flag_bit, "payload size does not fit in the size field");
+
+    static unsigned int SizeField(const char *data) {
+        if (size_bytes == 1)
+            return (unsigned char) data[0];
+        unsigned short field;
+        memcpy(&field, data, sizeof(field));
+        return field;
+    }
+
+    static void SetSizeField(char *data, unsigned int field) {
+        if (size_bytes == 1) {
+            data[0] = (char) field;
+        } else {
+            unsigned short value = field;
+            memcpy(data, &value, sizeof(value));
+        }
+    }
+
+    static int Size(const char *data) { return SizeField(data) & (flag_bit - 1); }
+
+    /* the flag is left as it is */
+    static void SetSize(char *data, int size) { SetSizeField(data, (SizeField(data) & flag_bit) | size); }
+
+    static bool Flag(const char *data) { return SizeField(data) & flag_bit; }
+
+    static void SetFlag(char *data, bool flag) {
+        SetSizeField(data, flag ? SizeField(data) | flag_bit : SizeField(data) & ~flag_bit);
+    }
+
+    static unsigned int Get32(const char *data, int offset) {
+        unsigned int value;
+        memcpy(&value, data + offset, sizeof(value));
+        return value;
+    }
+
+    static void Set32(char *data, int offset, unsigned int value) {
+        memcpy(data + offset, &value, sizeof(value));
+    }
+
+    static unsigned short Checksum(const char *data) {
+        unsigned short value;
+        memcpy(&value, data + checksum_offset, sizeof(value));
+        return value;
+    }
+
+    static void SetChecksum(char *data, unsigned short value) {
+        memcpy(data + checksum_offset, &value, sizeof(value));
+    }
+};
+
+typedef PacketLayout<RDT_PKTSIZE> Layout;
+
+/* header accessors for the layout of this build */
+inline int PacketSize(const packet *pkt) { return Layout::Size(pkt->data); }
+
+inline void SetPacketSize(packet *pkt, int size) { Layout::SetSize(pkt->data, size); }
+
+inline unsigned int PacketSeq(const packet *pkt) { return Layout::Get32(pkt->data, Layout::seq_offset); }
+
+inline void SetPacketSeq(packet *pkt, unsigned int seq) { Layout::Set32(pkt->data, Layout::seq_offset, seq); }
+
+inline unsigned int PacketAck(const packet *pkt) { return Layout::Get32(pkt->data, Layout::ack_offset); }
+
+inline void SetPacketAck(packet *pkt, unsigned int ack) { Layout::Set32(pkt->data, Layout::ack_offset, ack); }
+
+inline unsigned short PacketChecksum(const packet *pkt) { return Layout::Checksum(pkt->data); }
+
+/* 0, which is no connection, in a build without connection ids */
+inline unsigned int PacketConn(const packet *pkt) {
+    return Layout::conn_bytes > 0 ? Layout::Get32(pkt->data, Layout::conn_offset) : 0;
+}
+
+inline void SetPacketConn(packet *pkt, unsigned int conn) {
+    if (Layout::conn_bytes > 0)
+        Layout::Set32(pkt->data, Layout::conn_offset, conn);
+}
+
+/* the seq of the first data packet, which the receiver acks first */
+#ifndef RDT_FIRST_SEQ
+#define RDT_FIRST_SEQ 1u
+#endif
+
+/* a is before b when b is less than half of the sequence space ahead of it */
+inline bool SeqBefore(unsigned int a, unsigned int b) { return (int) (a - b) < 0; }
+
+inline bool SeqAfter(unsigned int a, unsigned int b) { return (int) (a - b) > 0; }
+
+inline unsigned int SeqMax(unsigned int a, unsigned int b) { return SeqAfter(a, b) ? a : b; }
+
+/* seq 0 stands for control packets, so data skips it on the wrap */
+inline unsigned int SeqNext(unsigned int seq) { return seq + 1 != 0 ? seq + 1 : 1; }
+
+inline char *PacketPayload(packet *pkt) { return pkt->data + Layout::header_size; }
+
+/* The flags of an ack, in the top bit of its size field; the payload is left alone, and data packets carry none */
+#define ACK_FLAG_ECE 0x01   /* the packet acked was marked congestion experienced */
+
+inline unsigned char AckFlags(const packet *pkt) { return Layout::Flag(pkt->data) ? ACK_FLAG_ECE : 0; }
+
+inline void SetAckFlags(packet *pkt, unsigned char flags) { Layout::SetFlag(pkt->data, flags & ACK_FLAG_ECE); }
+
+/* bytes actually carried over the link, header included */
+inline int PacketLength(const packet *pkt) { return Layout::header_size + PacketSize(pkt); }
+
+/**
+ * @brief The internet checksum, summed four bytes at a time. Folding the 32-bit words gives the same result as
+ * summing 16-bit words, and an odd trailing byte is padded with zero as before.
+ */
+inline unsigned short checksum(const char *data, int size) {
+    unsigned long long sum = 0;
+    while (size >= 4) {
+        unsigned int word;
+        memcpy(&word, data, sizeof(word));
+        sum += word;
+        data += 4;
+        size -= 4;
+    }
+    if (size >= 2) {
+        unsigned short half;
+        memcpy(&half, data, sizeof(half));
+        sum += half;
+        data += 2;
+        size -= 2;
+    }
+    if (size > 0) {
+        char left_over[2] = {*data, 0};
+        unsigned short half;
+        memcpy(&half, left_over, sizeof(half));
+        sum += half;
+    }
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+/* Same as above with the length known at compile time: the loop has a constant trip count, which the compiler unrolls
+   (the eleven bytes of a bare header become two words, a half word and a byte), and the tails are resolved at compile
+   time. Full packets and bare headers (acks and probes) are the common lengths and take this path. */
+template<int Size>
+inline unsigned short checksum(const char *data) {
+    unsigned long long sum = 0;
+    for (int i = 0; i < Size / 4; i++) {
+        unsigned int word;
+        memcpy(&word, data + i * 4, sizeof(word));
+        sum += word;
+    }
+    if constexpr (Size % 4 >= 2) {
+        unsigned short half;
+        memcpy(&half, data + Size / 4 * 4, sizeof(half));
+        sum += half;
+    }
+    if constexpr (Size % 2 != 0) {
+        char left_over[2] = {data[Size - 1], 0};
+        unsigned short half;
+        memcpy(&half, left_over, sizeof(half));
+        sum += half;
+    }
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+inline unsigned short PacketChecksumOver(const packet *pkt, int length) {
+    PROFILE(PROF_CHECKSUM);
+    if (length == Layout::header_size)
+        return checksum<Layout::header_size>(pkt->data);
+    if (length == RDT_PKTSIZE)
+        return checksum<RDT_PKTSIZE>(pkt->data);
+    return checksum(pkt->data, length);
+}
+
+/* compute the checksum with the checksum field zeroed, then store it */
+inline void SealPacket(packet *pkt) {
+    Layout::SetChecksum(pkt->data, 0);
+    Layout::SetChecksum(pkt->data, PacketChecksumOver(pkt, PacketLength(pkt)));
+}
+
+/* false if the size field is out of range or the checksum does not match; the checksum field is left zeroed */
+inline bool PacketChecksumValid(packet *pkt) {
+    int size = PacketSize(pkt);
+    if (size < 0 || size > Layout::max_payload)
+        return false;
+    unsigned short pkt_checksum = PacketChecksum(pkt);
+    Layout::SetChecksum(pkt->data, 0);
+    return pkt_checksum == PacketChecksumOver(pkt, PacketLength(pkt));
+}
+
+#endif  /* _RDT_PACKET_H_ */
@@ -0,0 +1,215 @@
+/*
+ * FILE: rdt_plugin.cc
+ * DESCRIPTION: Wraps the sender and the receiver it is linked with into a
+ *       protocol plugin (see rdt_plugin.h).  Every connection opened has a
+ *       sender state and a receiver state of its own, swapped in whenever
+ *       one of its handlers runs (Sender_SwapState() and
+ *       Receiver_SwapState()), and the routines of rdt_sender.h and
+ *       rdt_receiver.h go to the driver of the connection that is running.
+ *
+ *       Besides the handlers, the sender and the receiver must therefore
+ *       provide the routines of rdt_sender.h and rdt_receiver.h for drivers
+ *       running several of them: Sender_NewState(), Sender_SwapState() and
+ *       Sender_FreeState(), and Receiver_NewState(), Receiver_SwapState()
+ *       and Receiver_FreeState().  A sender and a receiver without them do
+ *       not link into a plugin (-Wl,--no-undefined in the Makefile).
+ *
+ *       Built with -fvisibility=hidden, so that nothing but the entry point
+ *       is seen from outside: the sender and the receiver of one plugin do
+ *       not clash with those of another, nor with the ones linked into the
+ *       driver.
+ * NOTE: Single-threaded.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_plugin.h"
+
+
+/* the name the plugin goes by, the directory of its sources by default (see
+   the Makefile) */
+#ifndef RDT_PLUGIN_NAME
+#define RDT_PLUGIN_NAME "rdt"
+#endif
+
+
+/*[]------------------------------------------------------------------------[]
+  |  connections
+  []------------------------------------------------------------------------[]*/
+
+struct plugin_conn {
+    struct rdt_driver driver;
+    struct sender_state *sender;
+    struct receiver_state *receiver;
+};
+
+/* the connection whose states are running, NULL for none */
+static struct plugin_conn *running = NULL;
+
+/* make the states of c the running ones, the way rdt_flows does: the
+   running states go back to their connection, and the spares they get in
+   exchange go to c in exchange for its own */
+static void run(struct plugin_conn *c)
+{
+    if (running==c) return;
+    if (running!=NULL) {
+	Sender_SwapState(running->sender);
+	Receiver_SwapState(running->receiver);
+    }
+    if (c!=NULL) {
+	Sender_SwapState(c->sender);
+	Receiver_SwapState(c->receiver);
+    }
+    running = c;
+}
+
+static void *plugin_open(const struct rdt_driver *driver)
+{
+    struct plugin_conn *c = new plugin_conn;
+    c->driver = *driver;
+    c->sender = Sender_NewState();
+    c->receiver = Receiver_NewState();
+    return c;
+}
+
+static void plugin_close(void *conn)
+{
+    struct plugin_conn *c = (struct plugin_conn*) conn;
+    if (running==c)
+	run(NULL);
+    Sender_FreeState(c->sender);
+    Receiver_FreeState(c->receiver);
+    delete c;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  handlers
+  []------------------------------------------------------------------------[]*/
+
+static void plugin_sender_init(void *conn)
+{
+    run((struct plugin_conn*) conn);
+    Sender_Init();
+}
+
+static void plugin_sender_final(void *conn)
+{
+    run((struct plugin_conn*) conn);
+    Sender_Final();
+}
+
+static bool plugin_sender_from_upper_layer(void *conn, struct message *msg, double deadline,
+					   int max_retransmit)
+{
+    run((struct plugin_conn*) conn);
+    return Sender_FromUpperLayer(msg, deadline, max_retransmit);
+}
+
+static void plugin_sender_from_lower_layer(void *conn, struct packet *pkt)
+{
+    run((struct plugin_conn*) conn);
+    Sender_FromLowerLayer(pkt);
+}
+
+static void plugin_sender_timeout(void *conn)
+{
+    run((struct plugin_conn*) conn);
+    Sender_Timeout();
+}
+
+static void plugin_receiver_init(void *conn)
+{
+    run((struct plugin_conn*) conn);
+    Receiver_Init();
+}
+
+static void plugin_receiver_final(void *conn)
+{
+    run((struct plugin_conn*) conn);
+    Receiver_Final();
+}
+
+static void plugin_receiver_from_lower_layer(void *conn, struct packet *pkt)
+{
+    run((struct plugin_conn*) conn);
+    Receiver_FromLowerLayer(pkt);
+}
+
+static const struct rdt_protocol protocol = {
+    RDT_PLUGIN_ABI, RDT_PKTSIZE, RDT_PLUGIN_NAME,
+    plugin_open, plugin_close,
+    plugin_sender_init, plugin_sender_final, plugin_sender_from_upper_layer,
+    plugin_sender_from_lower_layer, plugin_sender_timeout,
+    plugin_receiver_init, plugin_receiver_final, plugin_receiver_from_lower_layer
+};
+
+extern "C" __attribute__((visibility("default"))) const struct rdt_protocol *rdt_plugin()
+{
+    return &protocol;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  the routines the rdt layer calls, for the running connection
+  []------------------------------------------------------------------------[]*/
+
+double GetSimulationTime()
+{
+    return running->driver.time(running->driver.ctx);
+}
+
+void Sender_StartTimer(double timeout)
+{
+    running->driver.start_timer(running->driver.ctx, timeout);
+}
+
+void Sender_StopTimer()
+{
+    running->driver.stop_timer(running->driver.ctx);
+}
+
+bool Sender_isTimerSet()
+{
+    return running->driver.is_timer_set(running->driver.ctx);
+}
+
+void Sender_ToLowerLayer(struct packet *pkt, int size)
+{
+    running->driver.sender_to_lower(running->driver.ctx, pkt, size);
+}
+
+void Sender_UpperLayerWritable()
+{
+    running->driver.upper_layer_writable(running->driver.ctx);
+}
+
+int Sender_NumPaths()
+{
+    return running->driver.num_paths(running->driver.ctx);
+}
+
+void Sender_ToPath(int path, struct packet *pkt, int size)
+{
+    running->driver.sender_to_path(running->driver.ctx, path, pkt, size);
+}
+
+void Receiver_ToLowerLayer(struct packet *pkt, int size)
+{
+    running->driver.receiver_to_lower(running->driver.ctx, pkt, size);
+}
+
+void Receiver_ToUpperLayer(struct message *msg)
+{
+    running->driver.receiver_to_upper(running->driver.ctx, msg);
+}
+
+bool Receiver_isCongestionMarked()
+{
+    return running->driver.is_congestion_marked(running->driver.ctx);
+}
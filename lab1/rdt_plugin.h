@@ -0,0 +1,83 @@
+/*
+ * FILE: rdt_plugin.h
+ * DESCRIPTION: The binary interface of protocol plugins, shared objects that
+ *       carry a sender and a receiver of their own, so that the simulator
+ *       can load several implementations and run them on the same workload
+ *       and the same channel (rdt_sim -X).  A plugin exports RDT_PLUGIN_ENTRY,
+ *       which returns its rdt_protocol: the handlers of the rdt layer as
+ *       function pointers, each taking the opaque state of a connection.
+ *       The driver hands its own routines over in an rdt_driver when it
+ *       opens a connection.
+ *
+ *       rdt_plugin.cc turns any sender and receiver written against
+ *       rdt_sender.h and rdt_receiver.h into a plugin (see the Makefile).
+ *       RDT_PLUGIN_ABI goes up with every change to the two structures
+ *       below, and the driver refuses plugins of another version or of
+ *       another packet size.
+ */
+
+
+#ifndef _RDT_PLUGIN_H_
+#define _RDT_PLUGIN_H_
+
+#include "rdt_struct.h"
+
+
+#define RDT_PLUGIN_ABI 3
+
+/* the symbol of the entry point, a function of type rdt_plugin_entry */
+#define RDT_PLUGIN_ENTRY "rdt_plugin"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines that the driver provides, for every connection
+  []------------------------------------------------------------------------[]*/
+
+/* the routines of rdt_sender.h and rdt_receiver.h that the rdt layer calls,
+   each given the ctx of the connection */
+struct rdt_driver {
+    void *ctx;
+    double (*time)(void *ctx);
+    void (*start_timer)(void *ctx, double timeout);
+    void (*stop_timer)(void *ctx);
+    bool (*is_timer_set)(void *ctx);
+    void (*sender_to_lower)(void *ctx, struct packet *pkt, int size);
+    void (*upper_layer_writable)(void *ctx);
+    void (*receiver_to_lower)(void *ctx, struct packet *pkt, int size);
+    void (*receiver_to_upper)(void *ctx, struct message *msg);
+    bool (*is_congestion_marked)(void *ctx);
+    int (*num_paths)(void *ctx);
+    void (*sender_to_path)(void *ctx, int path, struct packet *pkt, int size);
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines that the plugin provides
+  []------------------------------------------------------------------------[]*/
+
+/* the handlers of rdt_sender.h and rdt_receiver.h, on the state of a
+   connection returned by open().  the driver passed to open() must stay
+   valid until close() */
+struct rdt_protocol {
+    int abi;                    /* RDT_PLUGIN_ABI the plugin is built with */
+    int packet_size;            /* and its RDT_PKTSIZE */
+    const char *name;
+
+    void *(*open)(const struct rdt_driver *driver);
+    void (*close)(void *conn);
+
+    void (*sender_init)(void *conn);
+    void (*sender_final)(void *conn);
+    bool (*sender_from_upper_layer)(void *conn, struct message *msg, double deadline,
+				    int max_retransmit);
+    void (*sender_from_lower_layer)(void *conn, struct packet *pkt);
+    void (*sender_timeout)(void *conn);
+
+    void (*receiver_init)(void *conn);
+    void (*receiver_final)(void *conn);
+    void (*receiver_from_lower_layer)(void *conn, struct packet *pkt);
+};
+
+typedef const struct rdt_protocol *(*rdt_plugin_entry)();
+
+#endif  /* _RDT_PLUGIN_H_ */
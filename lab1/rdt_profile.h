@@ -0,0 +1,171 @@
+/*
+ * FILE: rdt_profile.h
+ * DESCRIPTION: Scoped timers on the hot paths of the simulator and the
+ *       protocol, built in with -DRDT_PROFILE (make rdt_sim_profile) and
+ *       compiled out otherwise.  PROFILE(id) times the rest of the block it
+ *       is in with the time stamp counter, and the scopes open at the time
+ *       make up the call path it is counted under.  PROFILE_BEGIN(id) and
+ *       PROFILE_END(id) do the same for a stretch that is not a block of
+ *       its own.  PROFILE_PEAK(id, n) keeps the largest n seen.
+ *
+ *       Profile_Report() prints, for every scope, the calls, the cycles per
+ *       call and the share of the run, with and without the scopes within,
+ *       and Profile_Folded() writes every call path with the cycles spent
+ *       in it in the folded format of flamegraph.pl.
+ * NOTE: Single-threaded.
+ */
+
+
+#ifndef _RDT_PROFILE_H_
+#define _RDT_PROFILE_H_
+
+/* the scopes */
+enum {PROF_RUN=0, PROF_SCHEDULE, PROF_NEXT_EVENT,
+      PROF_EV_FROMUPPERLAYER, PROF_EV_SENDER_FROMLOWERLAYER, PROF_EV_SENDER_TIMEOUT,
+      PROF_EV_RECEIVER_FROMLOWERLAYER, PROF_EV_COROUTINE_RESUME, PROF_EV_END_FROMLOWERLAYER,
+      PROF_EV_ACK_DELAY,
+      PROF_SENDER_FROMLOWERLAYER, PROF_RETRANSMIT, PROF_STOP_RECEIVED_PACKET_TIMER,
+      PROF_RECEIVER_FROMLOWERLAYER, PROF_INSERT_INTO_BUFFER, PROF_CHECKSUM, PROF_COUNT};
+
+/* the peaks */
+enum {PROF_PEAK_EVENTS=0, PROF_PEAK_WINDOW, PROF_PEAK_SENDER_BUFFER,
+      PROF_PEAK_RECEIVER_BUFFER, PROF_PEAK_COUNT};
+
+#ifdef RDT_PROFILE
+
+#include <stdio.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+static inline unsigned long long profile_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000ull + t.tv_nsec;
+#endif
+}
+
+inline const char *profile_names[PROF_COUNT] = {
+    "simulation", "EventChain::schedule", "EventChain::next_event",
+    "event:sender_from_upper_layer", "event:sender_from_lower_layer", "event:sender_timeout",
+    "event:receiver_from_lower_layer", "event:coroutine_resume", "event:end_from_lower_layer",
+    "event:ack_delay",
+    "Sender_FromLowerLayer", "Retransmit", "StopReceivedPacketTimer",
+    "Receiver_FromLowerLayer", "InsertIntoBuffer", "checksum"};
+
+inline const char *profile_peak_names[PROF_PEAK_COUNT] = {
+    "events in the event chain", "packets in the sender window",
+    "packets in the sender buffer", "packets in the receiver buffer"};
+
+/* a node per call path, the root (node 0) being outside of every scope */
+struct profile_node {
+    int id;
+    int parent;
+    int child[PROF_COUNT];      /* the nodes of the scopes opened within */
+    unsigned long long calls;
+    unsigned long long cycles;  /* in the scope, and in the scopes within */
+    unsigned long long inner;
+};
+
+inline std::vector<struct profile_node> profile_nodes(1, {-1, -1, {}, 0, 0, 0});
+inline int profile_current = 0;
+inline unsigned long long profile_peaks[PROF_PEAK_COUNT];
+
+/* open the scope id within the current one, return when */
+static inline unsigned long long profile_enter(int id)
+{
+    if (profile_nodes[profile_current].child[id]==0) {
+	struct profile_node n = {id, profile_current, {}, 0, 0, 0};
+	profile_nodes.push_back(n);
+	profile_nodes[profile_current].child[id] = profile_nodes.size() - 1;
+    }
+    profile_current = profile_nodes[profile_current].child[id];
+    return profile_clock();
+}
+
+/* close the current scope, opened at start */
+static inline void profile_exit(unsigned long long start)
+{
+    unsigned long long elapsed = profile_clock() - start;
+    struct profile_node &n = profile_nodes[profile_current];
+    n.calls ++;
+    n.cycles += elapsed;
+    profile_current = n.parent;
+    profile_nodes[profile_current].inner += elapsed;
+}
+
+class ProfileScope
+{
+public:
+    ProfileScope(int id) { start = profile_enter(id); }
+    ~ProfileScope() { profile_exit(start); }
+
+private:
+    unsigned long long start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE(id) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(id)
+#define PROFILE_BEGIN(id) unsigned long long profile_start_##id = profile_enter(id)
+#define PROFILE_END(id) profile_exit(profile_start_##id)
+#define PROFILE_PEAK(id, n) do { \
+	unsigned long long _n = (n); \
+	if (_n>profile_peaks[id]) profile_peaks[id] = _n; \
+    } while (0)
+
+/* the summary, of a run that took wall_time seconds */
+static inline void Profile_Report(FILE *fp, double wall_time)
+{
+    unsigned long long calls[PROF_COUNT] = {}, cycles[PROF_COUNT] = {}, self[PROF_COUNT] = {};
+    for (size_t i=1; i<profile_nodes.size(); i++) {
+	struct profile_node &n = profile_nodes[i];
+	calls[n.id] += n.calls;
+	cycles[n.id] += n.cycles;
+	self[n.id] += n.cycles - n.inner;
+    }
+    double total = cycles[PROF_RUN]>0 ? cycles[PROF_RUN] : 1;
+    fprintf(fp, "## Profile, %.0f cycles per second\n", total/wall_time);
+    fprintf(fp, "\t%-32s %12s %12s %8s %8s\n", "scope", "calls", "cycles/call", "total", "self");
+    for (int id=0; id<PROF_COUNT; id++) {
+	if (calls[id]==0) continue;
+	fprintf(fp, "\t%-32s %12llu %12.1f %7.2f%% %7.2f%%\n", profile_names[id], calls[id],
+		cycles[id]*1.0/calls[id], cycles[id]*100.0/total, self[id]*100.0/total);
+    }
+    for (int id=0; id<PROF_PEAK_COUNT; id++)
+	fprintf(fp, "\tpeak %s is %llu\n", profile_peak_names[id], profile_peaks[id]);
+}
+
+/* the call paths, a line each: the scopes from the outermost one separated
+   by ';', and the cycles spent in the innermost one itself */
+static inline void Profile_Folded(FILE *fp)
+{
+    for (size_t i=1; i<profile_nodes.size(); i++) {
+	struct profile_node &n = profile_nodes[i];
+	if (n.cycles==n.inner) continue;
+	int path[64], depth = 0;
+	for (int j=i; j>0 && depth<64; j=profile_nodes[j].parent)
+	    path[depth++] = profile_nodes[j].id;
+	for (int d=depth-1; d>=0; d--)
+	    fprintf(fp, "%s%c", profile_names[path[d]], d>0 ? ';' : ' ');
+	fprintf(fp, "%llu\n", n.cycles - n.inner);
+    }
+}
+
+#else
+
+#define PROFILE(id)
+#define PROFILE_BEGIN(id)
+#define PROFILE_END(id)
+#define PROFILE_PEAK(id, n)
+
+#endif  /* RDT_PROFILE */
+
+#endif  /* _RDT_PROFILE_H_ */
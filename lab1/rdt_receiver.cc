@@ -1,16 +1,10 @@
 /*
  * FILE: rdt_receiver.cc
  * DESCRIPTION: Reliable data transfer receiver.
- * NOTE: This implementation assumes there is no packet loss, corruption, or 
- *       reordering.  You will need to enhance it to deal with all these 
- *       situations.  In this implementation, the packet format is laid out as 
- *       the following:
- *       
- *       |<-  1 byte  ->|<-             the rest            ->|
- *       | payload size |<-             payload             ->|
- *
- *       The first byte of each packet indicates the size of the payload
- *       (excluding this single-byte header)
+ * NOTE: The packet format, a header of flag and payload size, seq, ack and
+ *       checksum (and a connection id with -DRDT_CONN_ID) followed by the
+ *       payload, is laid out by PacketLayout<RDT_PKTSIZE> in rdt_packet.h,
+ *       together with the accessors and the checksum the receiver uses.
  */
 
 
@@ -20,14 +14,58 @@
 #include <algorithm>
 #include <iostream>
 #include <list>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
 
 #include "rdt_struct.h"
+#include "rdt_packet.h"
 #include "rdt_receiver.h"
+#include "rdt_profile.h"
 
 //#define DEBUG
+/* A seq or forward ack this far ahead of the receiver can only come from a corrupted packet that slipped past the
+   16-bit checksum, skipping to it would stall the receiver for billions of packets */
+#define RECEIVE_WINDOW (1 << 16)
 
-unsigned int ack = 1;
-std::list <packet> buffer;
+/* the state of a receiver.  the running one lives in "running" and the code
+   below reaches it under the plain names, a driver running several receivers
+   swaps the others in and out with Receiver_SwapState() */
+struct receiver_state {
+    unsigned int ack = RDT_FIRST_SEQ;
+    std::list <packet> buffer;
+
+    /* packets abandoned by the sender that have been skipped over */
+    unsigned long long pkts_skipped = 0;
+};
+
+/* built with -DRDT_PARALLEL, every thread has a running state of its own,
+   for drivers that run receivers on several threads at once */
+#ifdef RDT_PARALLEL
+#define RUNNING_STATE static thread_local
+#else
+#define RUNNING_STATE static
+#endif
+
+RUNNING_STATE struct receiver_state running;
+
+RUNNING_STATE unsigned int &ack = running.ack;
+RUNNING_STATE std::list <packet> &buffer = running.buffer;
+RUNNING_STATE unsigned long long &pkts_skipped = running.pkts_skipped;
+
+struct receiver_state *Receiver_NewState() {
+    return new receiver_state();
+}
+
+void Receiver_FreeState(struct receiver_state *s) {
+    delete s;
+}
+
+void Receiver_SwapState(struct receiver_state *s) {
+    std::swap(running.ack, s->ack);
+    running.buffer.swap(s->buffer);
+    std::swap(running.pkts_skipped, s->pkts_skipped);
+}
 
 /* receiver initialization, called once at the very beginning */
 void Receiver_Init() {
@@ -40,51 +78,32 @@ void Receiver_Init() {
    memory you allocated in Receiver_init(). */
 void Receiver_Final() {
     fprintf(stdout, "At %.2fs: receiver finalizing ...\n", GetSimulationTime());
-}
-
-inline unsigned short checksum(unsigned short *data, int size) {
-    long long sum = 0;
-    while (size > 1) {
-        sum += *data++;
-        size -= 2;
-    }
-
-    if (size > 0) {
-        char left_over[2] = {0};
-        left_over[0] = *(char *) data;
-        sum += *(unsigned short *) left_over;
-    }
-
-    while (sum >> 16)
-        sum = (sum & 0xffff) + (sum >> 16);
-    return ~sum;
+    if (pkts_skipped > 0)
+        fprintf(stdout, "\t%llu packets abandoned by the sender have been skipped\n", pkts_skipped);
 }
 
 message *pkt2msg(packet *pkt) {
-    /* 1-byte header indicating the size of the payload */
-    int header_size = 11;
-
     /* construct a message and deliver to the upper layer */
     struct message *msg = (struct message *) malloc(sizeof(struct message));
     ASSERT(msg != NULL);
 
-    msg->size = pkt->data[0];
+    msg->size = PacketSize(pkt);
 
     /* sanity check in case the packet is corrupted */
     if (msg->size < 0) msg->size = 0;
-    if (msg->size > RDT_PKTSIZE - header_size) msg->size = RDT_PKTSIZE - header_size;
+    if (msg->size > Layout::max_payload) msg->size = Layout::max_payload;
 
     msg->data = (char *) malloc(msg->size);
     ASSERT(msg->data != NULL);
 
-    memcpy(msg->data, pkt->data + header_size, msg->size);
+    memcpy(msg->data, PacketPayload(pkt), msg->size);
 
     return msg;
 }
 
 void SendToUpperLayer(packet *pkt) {
 #ifdef DEBUG
-    printf("Send pkt(seq = %d, size = %d) to upper\n", *(unsigned int *) &pkt->data[1], pkt->data[0]);
+    printf("Send pkt(seq = %d, size = %d) to upper\n", PacketSeq(pkt), PacketSize(pkt));
 #endif
     message *msg = pkt2msg(pkt);
     Receiver_ToUpperLayer(msg);
@@ -93,40 +112,57 @@ void SendToUpperLayer(packet *pkt) {
     free(msg);
 }
 
+/* Packets past a hole mostly arrive in order behind each other, all the more when a faster path keeps filling the
+   buffer while a slower one holds the hole, so the place of a packet is looked for from the back */
 void InsertIntoBuffer(packet *pkt) {
-    int seq = *(unsigned int *) &pkt->data[1];
-    int another_seq;
-    auto iter = std::find_if(buffer.begin(), buffer.end(), [seq, &another_seq](packet &another) {
-        another_seq = *(unsigned int *) &another.data[1];
-        return another_seq >= seq;
-    });
+    PROFILE(PROF_INSERT_INTO_BUFFER);
+    unsigned int seq = PacketSeq(pkt);
+    auto iter = buffer.end();
+    while (iter != buffer.begin() && !SeqBefore(PacketSeq(&*std::prev(iter)), seq))
+        --iter;
 
-    if (another_seq == seq) return;
+    if (iter != buffer.end() && PacketSeq(&*iter) == seq) return;
 
     buffer.insert(iter, *pkt);
+    PROFILE_PEAK(PROF_PEAK_RECEIVER_BUFFER, buffer.size());
 }
 
-inline bool PacketNotCorrupted(packet *pkt) {
-    constexpr static int header_size = 11;
-    unsigned int size = pkt->data[0];
-    if (size < 0 || size > RDT_PKTSIZE)
+/* static, so it is never merged with the sender's check of the same name */
+static inline bool PacketNotCorrupted(packet *pkt) {
+    if ((PacketSeq(pkt) != 0 && SeqAfter(PacketSeq(pkt), ack + RECEIVE_WINDOW)) ||
+        SeqAfter(PacketAck(pkt), ack + RECEIVE_WINDOW))
         return false;
-    int pkt_checksum = *(unsigned short *) &pkt->data[9];
-    /* Set the checksum to zero first, then calculate the checksum */
-    *(unsigned short *) &pkt->data[9] = 0;
-    int real_checksum = checksum((unsigned short *) pkt, pkt->data[0] + header_size);
-    return pkt_checksum == real_checksum;
+    return PacketChecksumValid(pkt);
+}
+
+/**
+ * @brief Skip ahead to the forward cumulative ack announced by the sender. Buffered packets before it are still
+ * delivered in order, the missing ones have been abandoned and will never come.
+ * @param fwd every seq below it has been either acknowledged or abandoned by the sender
+ */
+void SkipTo(unsigned int fwd) {
+    while (SeqBefore(ack, fwd)) {
+        if (!buffer.empty() && PacketSeq(&buffer.front()) == ack) {
+            SendToUpperLayer(&buffer.front());
+            buffer.pop_front();
+        } else {
+#ifdef DEBUG
+            printf("Skip abandoned pkt(seq = %d)\n", ack);
+#endif
+            ++pkts_skipped;
+        }
+        ack = SeqNext(ack);
+    }
 }
 
 /* event handler, called when a packet is passed from the lower layer at the 
    receiver */
 void Receiver_FromLowerLayer(struct packet *pkt) {
-    int header_size = 11;
-    unsigned int seq = *(unsigned int *) &pkt->data[1];
+    PROFILE(PROF_RECEIVER_FROMLOWERLAYER);
+    unsigned int seq = PacketSeq(pkt);
 #ifdef DEBUG
-    unsigned int size = pkt->data[0];
-    printf("Receive pkt from sender(seq = %d, checksum = %d, size = %d)\n", seq, *(unsigned short *) &pkt->data[9],
-           size);
+    printf("Receive pkt from sender(seq = %d, checksum = %d, size = %d)\n", seq, PacketChecksum(pkt),
+           PacketSize(pkt));
 #endif
     if (!PacketNotCorrupted(pkt)) {
 #ifdef DEBUG
@@ -135,19 +171,27 @@ void Receiver_FromLowerLayer(struct packet *pkt) {
         return;
     }
 
+    unsigned int fwd = PacketAck(pkt);
+    if (SeqAfter(fwd, ack))
+        SkipTo(fwd);
+
+    /* seq 0 is a probe of the sender's forward ack, which carries no data */
     if (seq == ack) {
-        ++ack;
+        ack = SeqNext(ack);
         SendToUpperLayer(pkt);
-    } else if (seq > ack) {
+    } else if (seq != 0 && SeqAfter(seq, ack)) {
         InsertIntoBuffer(pkt);
     }
 
     while (!buffer.empty()) {
         packet &front = buffer.front();
-        unsigned int front_seq = *(unsigned int *) &front.data[1];
+        unsigned int front_seq = PacketSeq(&front);
         if (front_seq == ack) {
             SendToUpperLayer(&front);
-            ++ack;
+            ack = SeqNext(ack);
+            buffer.pop_front();
+        } else if (SeqBefore(front_seq, ack)) {
+            /* delivered directly after a skip, this copy is stale */
             buffer.pop_front();
         } else break;
     }
@@ -157,8 +201,203 @@ void Receiver_FromLowerLayer(struct packet *pkt) {
     printf("Receiver send ack pkt to sender(ack = %d)\n", ack);
 #endif
     memset(&ack_pkt, 0, sizeof(packet));
-    *(unsigned int *) &ack_pkt.data[1] = seq;
-    *(unsigned int *) &ack_pkt.data[5] = ack;
-    *(unsigned short *) &ack_pkt.data[9] = checksum((unsigned short *) &ack_pkt, header_size);
-    Receiver_ToLowerLayer(&ack_pkt);
+    SetPacketSeq(&ack_pkt, seq);
+    SetPacketAck(&ack_pkt, ack);
+    SetPacketConn(&ack_pkt, PacketConn(pkt));
+    /* Echo a congestion mark back to the sender, for every packet that carried one */
+    if (Receiver_isCongestionMarked())
+        SetAckFlags(&ack_pkt, ACK_FLAG_ECE);
+    SealPacket(&ack_pkt);
+    Receiver_ToLowerLayer(&ack_pkt, PacketLength(&ack_pkt));
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  connection table
+  []------------------------------------------------------------------------[]*/
+
+/* The state of a connection in the table of Receiver_Demux(), half a cache line: the reorder buffer is only allocated
+   while packets wait in it, so an idle connection costs its slot alone */
+struct ConnSlot {
+    unsigned int id;                /* 0 for an empty slot */
+    unsigned int ack;
+    unsigned long long pkts_skipped;
+    double last_active;
+    std::list <packet> *buffer;
+};
+
+/* Open addressing with linear probing over a power of two of slots, at most three quarters of them in use. Evictions
+   shift the slots behind back into place instead of leaving tombstones in them, so lookups never get longer with
+   churn.
+
+   An evicted connection leaves its ack behind in a map by its id, so that one made again on a retransmission of a
+   packet it has already delivered starts at that ack and takes the packet for a duplicate. The sender of a connection
+   never gives up on a packet, so no time is safe to forget it after: a tombstone is only dropped when its connection
+   is made again, and the map holds one for every connection evicted and not back yet */
+#define TABLE_MIN_SLOTS 1024
+
+struct ConnTable {
+    std::vector <ConnSlot> slots;
+    std::unordered_map <unsigned int, unsigned int> tombstones;
+    int shift = 64;                 /* the hash is the top bits of the product, as many as index the slots */
+    size_t used = 0;
+    size_t peak = 0;
+    size_t buffers = 0;
+    long long lookups = 0;
+    long long probes = 0;
+    long long created = 0;
+    long long evicted = 0;
+    long long resumed = 0;          /* connections made again from their tombstone */
+    long long corrupted = 0;
+};
+
+RUNNING_STATE ConnTable table;
+
+/* Fibonacci hashing, so that consecutive ids land far apart */
+static inline size_t HomeSlot(unsigned int id) {
+    return (size_t) ((id * 0x9e3779b97f4a7c15ULL) >> table.shift);
+}
+
+/* The slot of the id, or the empty slot where it would go */
+static size_t FindSlot(unsigned int id) {
+    size_t mask = table.slots.size() - 1;
+    size_t i = HomeSlot(id);
+    while (table.slots[i].id != 0 && table.slots[i].id != id)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static void GrowTable() {
+    std::vector <ConnSlot> old;
+    old.swap(table.slots);
+    size_t size = std::max(old.size() * 2, (size_t) TABLE_MIN_SLOTS);
+    table.slots.assign(size, ConnSlot());
+    table.shift = 64;
+    for (size_t n = size; n > 1; n >>= 1)
+        --table.shift;
+    for (ConnSlot &slot : old)
+        if (slot.id != 0)
+            table.slots[FindSlot(slot.id)] = slot;
+}
+
+/* Empty slot i, and move back every slot of the run behind it that may go at or before i */
+static void EraseSlot(size_t i) {
+    size_t mask = table.slots.size() - 1;
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (table.slots[j].id == 0)
+            break;
+        size_t home = HomeSlot(table.slots[j].id);
+        /* home is cyclically outside (i, j], so the slot at j stays reachable from it at i */
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            table.slots[i] = table.slots[j];
+            i = j;
+        }
+    }
+    table.slots[i] = ConnSlot();
+}
+
+/**
+ * @brief Pass a packet to the connection its header names, as Receiver_FromLowerLayer() would to a receiver of its
+ * own. The connection is made on its first packet, starting at the forward ack it carries, so that one evicted while
+ * its sender was idle picks up where it left off, or at the ack of its tombstone if that is further on.
+ */
+void Receiver_Demux(struct packet *pkt) {
+    /* a corrupted id must not make a connection, the handler checks the packet again */
+    unsigned short sum = PacketChecksum(pkt);
+    if (!PacketChecksumValid(pkt)) {
+        ++table.corrupted;
+        return;
+    }
+    Layout::SetChecksum(pkt->data, sum);
+    unsigned int id = PacketConn(pkt);
+    if (id == 0) return;
+
+    if (table.slots.empty())
+        GrowTable();
+    ++table.lookups;
+    size_t i = FindSlot(id);
+    table.probes += ((i - HomeSlot(id)) & (table.slots.size() - 1)) + 1;
+    if (table.slots[i].id == 0) {
+        if ((table.used + 1) * 4 > table.slots.size() * 3) {
+            GrowTable();
+            i = FindSlot(id);
+        }
+        ConnSlot &fresh = table.slots[i];
+        fresh.id = id;
+        fresh.ack = PacketAck(pkt) != 0 ? PacketAck(pkt) : RDT_FIRST_SEQ;
+        auto grave = table.tombstones.find(id);
+        if (grave != table.tombstones.end()) {
+            fresh.ack = SeqMax(fresh.ack, grave->second);
+            table.tombstones.erase(grave);
+            ++table.resumed;
+        }
+        fresh.pkts_skipped = 0;
+        fresh.buffer = nullptr;
+        ++table.used;
+        ++table.created;
+        table.peak = std::max(table.peak, table.used);
+    }
+    ConnSlot &slot = table.slots[i];
+    slot.last_active = GetSimulationTime();
+
+    /* the running state is the scratch the connection runs on */
+    ack = slot.ack;
+    pkts_skipped = slot.pkts_skipped;
+    if (slot.buffer != nullptr)
+        buffer.swap(*slot.buffer);
+    Receiver_FromLowerLayer(pkt);
+    slot.ack = ack;
+    slot.pkts_skipped = pkts_skipped;
+    if (!buffer.empty()) {
+        if (slot.buffer == nullptr) {
+            slot.buffer = new std::list <packet>();
+            ++table.buffers;
+        }
+        buffer.swap(*slot.buffer);
+    } else if (slot.buffer != nullptr) {
+        delete slot.buffer;
+        slot.buffer = nullptr;
+        --table.buffers;
+    }
+}
+
+bool Receiver_HasConnection(unsigned int id) {
+    return id != 0 && !table.slots.empty() && table.slots[FindSlot(id)].id == id;
+}
+
+/**
+ * @brief Evict the connections idle for idle_time, each leaving its tombstone. One with packets waiting behind a hole is
+ * not idle: they have been acked selectively, and the sender would never send them again.
+ */
+int Receiver_Evict(double idle_time) {
+    double before = GetSimulationTime() - idle_time;
+    std::vector <unsigned int> idle;
+    for (ConnSlot &slot : table.slots)
+        if (slot.id != 0 && slot.last_active < before && slot.buffer == nullptr) {
+            idle.push_back(slot.id);
+            table.tombstones[slot.id] = slot.ack;
+        }
+    for (unsigned int id : idle) {
+        EraseSlot(FindSlot(id));
+        --table.used;
+    }
+    table.evicted += idle.size();
+    return idle.size();
+}
+
+void Receiver_TableStats(struct receiver_table_stats *stats) {
+    stats->connections = table.used;
+    stats->peak_connections = table.peak;
+    stats->slots = table.slots.size();
+    stats->slot_size = sizeof(ConnSlot);
+    stats->tombstones = table.tombstones.size();
+    stats->buffers = table.buffers;
+    stats->lookups = table.lookups;
+    stats->probes = table.probes;
+    stats->created = table.created;
+    stats->evicted = table.evicted;
+    stats->resumed = table.resumed;
+    stats->corrupted = table.corrupted;
 }
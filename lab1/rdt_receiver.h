@@ -18,12 +18,18 @@
 /* get simulation time (in seconds) */
 double GetSimulationTime();
 
-/* pass a packet to the lower layer at the receiver */
-void Receiver_ToLowerLayer(struct packet *pkt);
+/* pass a packet to the lower layer at the receiver, only the first size 
+   bytes of the packet are carried over the link; implementations that always 
+   send a full packet can leave size out */
+void Receiver_ToLowerLayer(struct packet *pkt, int size = RDT_PKTSIZE);
 
 /* deliver a message to the upper layer at the receiver */
 void Receiver_ToUpperLayer(struct message *msg);
 
+/* check whether the packet being passed to Receiver_FromLowerLayer() has been 
+   marked congestion experienced on the way, return true if it has */
+bool Receiver_isCongestionMarked();
+
 
 /*[]------------------------------------------------------------------------[]
   |  routines to be changed/enhanced by you
@@ -43,4 +49,59 @@ void Receiver_Final();
    receiver */
 void Receiver_FromLowerLayer(struct packet *pkt);
 
+
+/*[]------------------------------------------------------------------------[]
+  |  routines for drivers running several receivers
+  []------------------------------------------------------------------------[]*/
+
+/* the state of a receiver, for drivers running several of them.  the running
+   receiver's state is the one the handlers above work on; Receiver_SwapState()
+   exchanges it with the one in s, so the state saved in s starts running
+   and the one that was running is saved in s in its place.  a new state is
+   that of a receiver that has not seen any event yet.  built with
+   -DRDT_PARALLEL, each thread has its own running receiver */
+struct receiver_state;
+struct receiver_state *Receiver_NewState();
+void Receiver_FreeState(struct receiver_state *s);
+void Receiver_SwapState(struct receiver_state *s);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines for drivers serving many senders at one receiver
+  []------------------------------------------------------------------------[]*/
+
+/* a receiver that tells its senders apart by the connection id in the header
+   (see Sender_SetConnId(), built with -DRDT_CONN_ID).  Receiver_Demux() finds
+   the state of the packet's connection in a hash table, making it on the
+   first packet, and runs Receiver_FromLowerLayer() on it; the running state
+   is only its scratch.  a connection keeps a reorder buffer only while
+   packets wait in it, and Receiver_Evict() drops those without one that have
+   been idle for idle_time or longer, returning how many.  an evicted
+   connection leaves a tombstone with its ack, and one made again starts
+   there, or at the forward ack of its first packet if that is further on,
+   so a retransmission of a packet it has delivered is not delivered again.
+   a tombstone lasts until its connection is made again, however long that
+   takes, since a sender never gives up on a packet.
+   the table belongs to the running state, one per thread with
+   -DRDT_PARALLEL */
+struct receiver_table_stats {
+    size_t connections;         /* in the table */
+    size_t peak_connections;
+    size_t slots;               /* of slot_size bytes */
+    size_t slot_size;
+    size_t tombstones;          /* of connections evicted and not made again */
+    size_t buffers;             /* reorder buffers allocated */
+    long long lookups;          /* one per packet demultiplexed */
+    long long probes;           /* slots the lookups looked at */
+    long long created;
+    long long evicted;
+    long long resumed;          /* made again from a tombstone */
+    long long corrupted;        /* packets dropped before the lookup */
+};
+void Receiver_Demux(struct packet *pkt);
+bool Receiver_HasConnection(unsigned int id);
+int Receiver_Evict(double idle_time);
+void Receiver_TableStats(struct receiver_table_stats *stats);
+
+
 #endif  /* _RDT_RECEIVER_H_ */
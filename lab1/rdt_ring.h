@@ -0,0 +1,196 @@
+/*
+ * FILE: rdt_ring.h
+ * DESCRIPTION: Lock-free single-producer single-consumer packet rings, shared
+ *       by the backends that pass packets through memory: between processes
+ *       in a shared mapping (rdt_shm) or between threads (rdt_mt).  A
+ *       consumer waiting for packets either spins on its rings (busy-poll)
+ *       or sleeps on a futex until a producer publishes some.
+ * NOTE: Linux only.
+ */
+
+
+#ifndef _RDT_RING_H_
+#define _RDT_RING_H_
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <algorithm>
+#include <atomic>
+
+#include "rdt_struct.h"
+
+
+/* the fields written by different processes or threads are kept on
+   different cache lines, so they do not bounce between the cores */
+#define CACHE_LINE 64
+
+/* packets a ring holds, a power of two */
+#define RING_SLOTS 4096
+
+static_assert(std::atomic<unsigned int>::is_always_lock_free,
+	      "the rings need lock-free atomics to be shared between processes");
+
+double GetSimulationTime();
+
+
+struct ring_slot {
+    int size;
+    double sent_time;           /* when the producer pushed it */
+    struct packet pkt;
+};
+
+/* a single-producer single-consumer ring.  head is only written by the
+   producer, tail is only written by the consumer */
+struct ring {
+    alignas(CACHE_LINE) std::atomic<unsigned int> head;
+    alignas(CACHE_LINE) std::atomic<unsigned int> tail;
+    alignas(CACHE_LINE) struct ring_slot slots[RING_SLOTS];
+};
+
+/* what a consumer sleeps on.  it may take packets from several rings, so the
+   futex word is its own rather than a ring's: a producer publishing to a
+   sleeping consumer bumps seq and wakes it */
+struct ring_waiter {
+    alignas(CACHE_LINE) std::atomic<unsigned int> seq;
+    std::atomic<unsigned int> sleeping;
+};
+
+/* the local ends of a ring, with the other side's index cached so that the
+   shared one is only read when the cached one runs out */
+struct ring_producer {
+    struct ring *r;
+    struct ring_waiter *consumer;
+    unsigned int head;
+    unsigned int cached_tail;
+};
+struct ring_consumer {
+    struct ring *r;
+    unsigned int tail;
+    unsigned int cached_head;
+};
+
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline long futex(std::atomic<unsigned int> *addr, int op, unsigned int val,
+			 const struct timespec *timeout)
+{
+    return syscall(SYS_futex, (unsigned int*) addr, op, val, timeout, NULL, 0);
+}
+
+static inline void ring_attach(struct ring_producer *p, struct ring *r, struct ring_waiter *consumer)
+{
+    p->r = r;
+    p->consumer = consumer;
+    p->head = p->cached_tail = 0;
+}
+
+static inline void ring_attach(struct ring_consumer *c, struct ring *r)
+{
+    c->r = r;
+    c->tail = c->cached_head = 0;
+}
+
+/* write a packet into the next free slot, return false if the ring is full.
+   the consumer does not see it before ring_publish() */
+static inline bool ring_push(struct ring_producer *p, const struct packet *pkt, int size, double now)
+{
+    if (p->head - p->cached_tail == RING_SLOTS) {
+	p->cached_tail = p->r->tail.load(std::memory_order_acquire);
+	if (p->head - p->cached_tail == RING_SLOTS)
+	    return false;
+    }
+    struct ring_slot *slot = &p->r->slots[p->head & (RING_SLOTS-1)];
+    slot->size = size;
+    slot->sent_time = now;
+    memcpy(slot->pkt.data, pkt->data, size);
+    p->head ++;
+    return true;
+}
+
+/* wake the consumer up whether or not it has anything to take */
+static inline void ring_wake(struct ring_waiter *w)
+{
+    w->seq.fetch_add(1, std::memory_order_release);
+    futex(&w->seq, FUTEX_WAKE, 1, NULL);
+}
+
+/* make the pushed packets visible to the consumer, and wake it up if it
+   sleeps on the futex */
+static inline void ring_publish(struct ring_producer *p, bool busy_poll)
+{
+    if (p->r->head.load(std::memory_order_relaxed)==p->head)
+	return;
+    p->r->head.store(p->head, std::memory_order_release);
+    if (!busy_poll) {
+	/* pairs with the fence in ring_wait(): either the consumer sees the
+	   new head, or this sees it sleeping */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (p->consumer->sleeping.load(std::memory_order_relaxed))
+	    ring_wake(p->consumer);
+    }
+}
+
+/* the next packet published by the producer, NULL if there is none */
+static inline struct ring_slot *ring_peek(struct ring_consumer *c)
+{
+    if (c->tail==c->cached_head) {
+	c->cached_head = c->r->head.load(std::memory_order_acquire);
+	if (c->tail==c->cached_head)
+	    return NULL;
+    }
+    return &c->r->slots[c->tail & (RING_SLOTS-1)];
+}
+
+/* give the slots taken so far back to the producer */
+static inline void ring_release(struct ring_consumer *c)
+{
+    c->r->tail.store(c->tail, std::memory_order_release);
+}
+
+static inline bool rings_empty(struct ring_consumer *rings, int n)
+{
+    for (int i=0; i<n; i++)
+	if (rings[i].r->head.load(std::memory_order_acquire)!=rings[i].tail)
+	    return false;
+    return true;
+}
+
+/* wait until a producer publishes a packet to one of the n rings, done is
+   set, or the deadline (-1 for none) has passed */
+static inline void ring_wait(struct ring_waiter *w, struct ring_consumer *rings, int n,
+			     const std::atomic<unsigned int> *done, double deadline,
+			     bool busy_poll)
+{
+    if (busy_poll) {
+	while (rings_empty(rings, n) && !done->load(std::memory_order_relaxed) &&
+	       (deadline<0 || GetSimulationTime()<deadline))
+	    cpu_relax();
+	return;
+    }
+
+    w->sleeping.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    unsigned int seq = w->seq.load(std::memory_order_relaxed);
+    if (rings_empty(rings, n) && !done->load(std::memory_order_relaxed)) {
+	struct timespec timeout, *ptimeout = NULL;
+	if (deadline>=0) {
+	    double wait = std::max(deadline - GetSimulationTime(), 0.0);
+	    timeout.tv_sec = (time_t) wait;
+	    timeout.tv_nsec = (long) ((wait-timeout.tv_sec)*1e9);
+	    ptimeout = &timeout;
+	}
+	futex(&w->seq, FUTEX_WAIT, seq, ptimeout);
+    }
+    w->sleeping.store(0, std::memory_order_relaxed);
+}
+
+#endif  /* _RDT_RING_H_ */
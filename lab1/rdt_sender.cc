@@ -1,16 +1,10 @@
 /*
  * FILE: rdt_sender.cc
  * DESCRIPTION: Reliable data transfer sender.
- * NOTE: This implementation assumes there is no packet loss, corruption, or 
- *       reordering.  You will need to enhance it to deal with all these 
- *       situations.  In this implementation, the packet format is laid out as 
- *       the following:
- *       
- *       |<-  1 byte  ->|<-             the rest            ->|
- *       | payload size |<-             payload             ->|
- *
- *       The first byte of each packet indicates the size of the payload
- *       (excluding this single-byte header)
+ * NOTE: The packet format, a header of flag and payload size, seq, ack and
+ *       checksum (and a connection id with -DRDT_CONN_ID) followed by the
+ *       payload, is laid out by PacketLayout<RDT_PKTSIZE> in rdt_packet.h,
+ *       together with the accessors and the checksum the sender uses.
  */
 
 
@@ -21,40 +15,331 @@
 #include <iostream>
 #include <list>
 #include <algorithm>
-#include <unordered_map>
+#include <iterator>
+#include <vector>
 
 #include "rdt_struct.h"
+#include "rdt_packet.h"
 #include "rdt_sender.h"
+#include "rdt_profile.h"
 
 //#define DEBUG
 #define AIMD
+#define RACK
+/* DCTCP-style reaction to congestion marks echoed by the receiver, needs AIMD */
+#define ECN
+/* the weight of the latest window in the estimate of the fraction marked */
+#define ECN_GAIN (1.0 / 16)
+/* several paths to the receiver, each with a window of its own, needs AIMD and RACK */
+#define MULTIPATH
+/* the retransmission timeout of a path whose round trip has not been measured yet */
+#define PATH_INITIAL_RTO 1.0
+/* packets acked behind a hole that a slower path has yet to fill, beyond which no path takes a new one */
+#define PATH_REORDER_LIMIT 4096
 #define DUP_UPPERBOUND 3
 #define TIMEOUT 0.3
+/* the retransmission timeout doubles on every timeout in a row, up to this many times TIMEOUT */
+#define MAX_BACKOFF 4
+/* the minimum round trip is that of the last this many seconds, so that a packet reordered ahead in both directions
+   does not shrink the reordering window for good */
+#define MIN_RTT_WINDOW 10.0
+/* memory the buffer may hold before the upper layer is pushed back (in bytes) */
+#define BUFFER_BUDGET (64 * 1024)
+
+/* What a block of the timer chain is waiting for */
+enum {
+    TIMER_RETRANSMIT,   /* the packet with the seq is presumed lost */
+    TIMER_REORDER,      /* the reordering window of RACK has passed */
+    TIMER_TAIL_PROBE    /* no ack has come back for the tail of a burst */
+};
+
+struct WindowSlot;
+typedef std::list <WindowSlot>::iterator SlotIter;
 
 struct TimerChainBlock {
-    TimerChainBlock(unsigned int seq, double expire_time) : seq(seq), expire_time(expire_time) {}
+    TimerChainBlock(unsigned int seq, double expire_time, int kind, SlotIter slot)
+            : seq(seq), expire_time(expire_time), kind(kind), slot(slot) {}
+
+    /* Whether the block guards a packet of the window, rather than being a probe or a RACK timer */
+    bool GuardsSlot() const { return kind == TIMER_RETRANSMIT && seq != 0; }
 
     unsigned int seq;
     double expire_time;
+    int kind;
+    SlotIter slot;          /* the slot it guards, if it does */
+};
+
+/* A block of the chain that can be removed without looking for it. The iterator stays valid until the block is
+   erased, and through a swap of the chain with another state */
+struct TimerHandle {
+    bool armed = false;
+    std::list <TimerChainBlock>::iterator block;
 };
 
-std::list <TimerChainBlock> timer_chain;
+/* A packet together with the delivery constraints of the message it carries. */
+struct WindowSlot {
+    WindowSlot(const packet &pkt, double deadline, int max_retransmit)
+            : pkt(pkt), deadline(deadline), max_retransmit(max_retransmit), retransmit(0), sacked(false),
+              on_paths(0), sent_time(0), dup_ack(0), path(0) {}
+
+    packet pkt;
+    double deadline;        /* absolute simulation time, 0 means no deadline */
+    int max_retransmit;     /* -1 means unlimited */
+    int retransmit;         /* how many times the packet has been retransmitted */
+    bool sacked;            /* the receiver has echoed its seq */
+    unsigned int on_paths;  /* the paths it is in flight on, a bit each, with several paths */
+    double sent_time;       /* when the packet has been transmitted the last time */
+    int dup_ack;            /* acks received while the receiver is waiting for this packet */
+    int path;               /* the path its round trip is sampled on, with several paths */
+    TimerHandle timer;      /* its retransmission timer */
+#ifdef RACK
+    /* its place in the order of transmission, while it is in flight */
+    bool in_sent_order = false;
+    std::list <std::list <WindowSlot>::iterator>::iterator sent_pos;
+#endif
+};
+
+/* The window holds no more than the buffer may, so that the sender never holds more than twice the budget */
+constexpr unsigned int WINDOW_LIMIT = std::max<size_t>(BUFFER_BUDGET / sizeof(WindowSlot), 8);
+
+#ifdef MULTIPATH
+/* A path to the receiver, when there are several. Its window grows and shrinks like the single one, on the packets
+   the path delivers and loses, and it keeps a round trip and a RACK state of its own, since a packet sent later on a
+   faster path says nothing about an earlier one on a slower path. */
+struct PathState {
+    unsigned int window_size = 2;
+    unsigned int ssthresh = 16;
+    unsigned int in_flight = 0;
+    double srtt = 0;
+    double rttvar = 0;
+    double min_rtt = PATH_INITIAL_RTO;
+    double min_rtt_time = 0;
+    double rack_xmit_time = -1;
+    unsigned int rack_seq = 0;
+    double rack_rtt = 0;
+    double last_reduction = -TIMEOUT;
+    /* the credit of the path under weighted round-robin */
+    double wrr_credit = 0;
+
+    /* statistics */
+    unsigned long long sent = 0;
+    unsigned long long retransmitted = 0;
+    unsigned long long lost = 0;
+};
+
+#endif
+
+/* the state of a sender.  the running one lives in "running" and the code
+   below reaches it under the plain names, a driver running several senders
+   swaps the others in and out with Sender_SwapState() */
+struct sender_state {
+    std::list <TimerChainBlock> timer_chain;
+    std::list <WindowSlot> window;
+    std::queue <WindowSlot> buffer;
+    unsigned int seq = RDT_FIRST_SEQ - 1;
+    unsigned int current_ack = RDT_FIRST_SEQ;
+    /* the greatest seq abandoned, the receiver has to ack past it; it trails the ack once the receiver has, so that
+       it never falls half of the sequence space behind */
+    unsigned int last_abandoned = RDT_FIRST_SEQ - 1;
+    /* stamped on every packet in a build with connection ids */
+    unsigned int conn_id = 0;
+
+    /* the upper layer has been told to wait for Sender_UpperLayerWritable() */
+    bool upper_layer_blocked = false;
+    size_t peak_memory = 0;
+    /* the retransmission timeout is this many times its own, until a packet is delivered again */
+    unsigned int rto_backoff = 1;
+
+#ifdef RACK
+    /* RACK: the most recently sent packet known to be delivered, and its rtt */
+    double rack_xmit_time = -1;
+    unsigned int rack_seq = 0;
+    double rack_rtt = 0;
+    double min_rtt = TIMEOUT;
+    double min_rtt_time = 0;
+    double srtt = 0;
+    double rttvar = 0;
+    /* the reordering window grows when retransmissions turn out to be spurious, and is reset after 16 recoveries */
+    int reo_wnd_mult = 1;
+    int reo_wnd_persist = 0;
+    /* the window is halved at most once a round trip */
+    double last_reduction = -TIMEOUT;
+    /* the slots in flight and not yet delivered, the least recently sent first, as RACK keeps them */
+    std::list <SlotIter> sent_order;
+    TimerHandle reorder_timer;
+    TimerHandle probe_timer;
+#endif
+
+    /* retransmission statistics */
+    unsigned long long retransmit_timeout = 0;
+    unsigned long long retransmit_dup_ack = 0;
+    unsigned long long retransmit_rack = 0;
+    unsigned long long tail_loss_probes = 0;
 
-std::list <packet> window;
-std::queue <packet> buffer;
-std::unordered_map<int, int> dup_ack;
-unsigned int seq = 0;
-unsigned int current_ack = 1;
+    /* partial reliability statistics */
+    unsigned long long pkts_on_time = 0;
+    unsigned long long pkts_late = 0;
+    unsigned long long pkts_expired = 0;
+    /* a transmission of every packet abandoned unacknowledged, what delivering it would have taken at the least */
+    unsigned long long bytes_saved_estimate = 0;
 #ifdef AIMD
-unsigned int window_size = 2;
-unsigned int ssthresh = 16;
+    unsigned int window_size = 2;
+    unsigned int ssthresh = 16;
 #else
-unsigned int window_size = 8;
+    unsigned int window_size = 8;
+#endif
+#ifdef ECN
+    /* the fraction of acks echoing a mark, estimated once per window of data; the acks of the current window and
+       the seq that ends it */
+    double ecn_alpha = 1;
+    unsigned int ecn_acks = 0;
+    unsigned int ecn_marked_acks = 0;
+    unsigned int ecn_window_end = RDT_FIRST_SEQ - 1;
+    /* congestion statistics */
+    unsigned long long ecn_echoes = 0;
+    unsigned long long ecn_reductions = 0;
 #endif
+#ifdef MULTIPATH
+    /* the paths to the receiver, a single one unless the driver has several */
+    std::vector <PathState> paths;
+#endif
+};
+
+/* member by member, so that the containers swap their insides instead of
+   being moved through a temporary */
+static void swap_state(struct sender_state &a, struct sender_state &b) {
+    using std::swap;
+    swap(a.timer_chain, b.timer_chain);
+    swap(a.window, b.window);
+    swap(a.buffer, b.buffer);
+    swap(a.seq, b.seq);
+    swap(a.current_ack, b.current_ack);
+    swap(a.last_abandoned, b.last_abandoned);
+    swap(a.conn_id, b.conn_id);
+    swap(a.upper_layer_blocked, b.upper_layer_blocked);
+    swap(a.peak_memory, b.peak_memory);
+    swap(a.rto_backoff, b.rto_backoff);
+#ifdef RACK
+    swap(a.rack_xmit_time, b.rack_xmit_time);
+    swap(a.rack_seq, b.rack_seq);
+    swap(a.rack_rtt, b.rack_rtt);
+    swap(a.min_rtt, b.min_rtt);
+    swap(a.min_rtt_time, b.min_rtt_time);
+    swap(a.srtt, b.srtt);
+    swap(a.rttvar, b.rttvar);
+    swap(a.reo_wnd_mult, b.reo_wnd_mult);
+    swap(a.reo_wnd_persist, b.reo_wnd_persist);
+    swap(a.last_reduction, b.last_reduction);
+    swap(a.sent_order, b.sent_order);
+    swap(a.reorder_timer, b.reorder_timer);
+    swap(a.probe_timer, b.probe_timer);
+#endif
+    swap(a.retransmit_timeout, b.retransmit_timeout);
+    swap(a.retransmit_dup_ack, b.retransmit_dup_ack);
+    swap(a.retransmit_rack, b.retransmit_rack);
+    swap(a.tail_loss_probes, b.tail_loss_probes);
+    swap(a.pkts_on_time, b.pkts_on_time);
+    swap(a.pkts_late, b.pkts_late);
+    swap(a.pkts_expired, b.pkts_expired);
+    swap(a.bytes_saved_estimate, b.bytes_saved_estimate);
+    swap(a.window_size, b.window_size);
+#ifdef AIMD
+    swap(a.ssthresh, b.ssthresh);
+#endif
+#ifdef ECN
+    swap(a.ecn_alpha, b.ecn_alpha);
+    swap(a.ecn_acks, b.ecn_acks);
+    swap(a.ecn_marked_acks, b.ecn_marked_acks);
+    swap(a.ecn_window_end, b.ecn_window_end);
+    swap(a.ecn_echoes, b.ecn_echoes);
+    swap(a.ecn_reductions, b.ecn_reductions);
+#endif
+#ifdef MULTIPATH
+    swap(a.paths, b.paths);
+#endif
+}
+
+/* built with -DRDT_PARALLEL, every thread has a running state of its own,
+   for drivers that run senders on several threads at once */
+#ifdef RDT_PARALLEL
+#define RUNNING_STATE static thread_local
+#else
+#define RUNNING_STATE static
+#endif
+
+RUNNING_STATE struct sender_state running;
+
+RUNNING_STATE std::list <TimerChainBlock> &timer_chain = running.timer_chain;
+RUNNING_STATE std::list <WindowSlot> &window = running.window;
+RUNNING_STATE std::queue <WindowSlot> &buffer = running.buffer;
+RUNNING_STATE unsigned int &seq = running.seq;
+RUNNING_STATE unsigned int &current_ack = running.current_ack;
+RUNNING_STATE unsigned int &last_abandoned = running.last_abandoned;
+RUNNING_STATE unsigned int &conn_id = running.conn_id;
+RUNNING_STATE bool &upper_layer_blocked = running.upper_layer_blocked;
+RUNNING_STATE size_t &peak_memory = running.peak_memory;
+RUNNING_STATE unsigned int &rto_backoff = running.rto_backoff;
+#ifdef RACK
+RUNNING_STATE double &rack_xmit_time = running.rack_xmit_time;
+RUNNING_STATE unsigned int &rack_seq = running.rack_seq;
+RUNNING_STATE double &rack_rtt = running.rack_rtt;
+RUNNING_STATE double &min_rtt = running.min_rtt;
+RUNNING_STATE double &min_rtt_time = running.min_rtt_time;
+RUNNING_STATE double &srtt = running.srtt;
+RUNNING_STATE double &rttvar = running.rttvar;
+RUNNING_STATE int &reo_wnd_mult = running.reo_wnd_mult;
+RUNNING_STATE int &reo_wnd_persist = running.reo_wnd_persist;
+RUNNING_STATE double &last_reduction = running.last_reduction;
+RUNNING_STATE std::list <SlotIter> &sent_order = running.sent_order;
+RUNNING_STATE TimerHandle &reorder_timer = running.reorder_timer;
+RUNNING_STATE TimerHandle &probe_timer = running.probe_timer;
+#endif
+RUNNING_STATE unsigned long long &retransmit_timeout = running.retransmit_timeout;
+RUNNING_STATE unsigned long long &retransmit_dup_ack = running.retransmit_dup_ack;
+RUNNING_STATE unsigned long long &retransmit_rack = running.retransmit_rack;
+RUNNING_STATE unsigned long long &tail_loss_probes = running.tail_loss_probes;
+RUNNING_STATE unsigned long long &pkts_on_time = running.pkts_on_time;
+RUNNING_STATE unsigned long long &pkts_late = running.pkts_late;
+RUNNING_STATE unsigned long long &pkts_expired = running.pkts_expired;
+RUNNING_STATE unsigned long long &bytes_saved_estimate = running.bytes_saved_estimate;
+RUNNING_STATE unsigned int &window_size = running.window_size;
+#ifdef AIMD
+RUNNING_STATE unsigned int &ssthresh = running.ssthresh;
+#endif
+#ifdef ECN
+RUNNING_STATE double &ecn_alpha = running.ecn_alpha;
+RUNNING_STATE unsigned int &ecn_acks = running.ecn_acks;
+RUNNING_STATE unsigned int &ecn_marked_acks = running.ecn_marked_acks;
+RUNNING_STATE unsigned int &ecn_window_end = running.ecn_window_end;
+RUNNING_STATE unsigned long long &ecn_echoes = running.ecn_echoes;
+RUNNING_STATE unsigned long long &ecn_reductions = running.ecn_reductions;
+#endif
+#ifdef MULTIPATH
+RUNNING_STATE std::vector <PathState> &paths = running.paths;
+#endif
+
+struct sender_state *Sender_NewState() {
+    return new sender_state();
+}
+
+void Sender_FreeState(struct sender_state *s) {
+    delete s;
+}
+
+void Sender_SwapState(struct sender_state *s) {
+    swap_state(running, *s);
+}
+
+void Sender_SetConnId(unsigned int id) {
+    conn_id = id;
+}
 
 /* sender initialization, called once at the very beginning */
 void Sender_Init() {
     fprintf(stdout, "At %.2fs: sender initializing ...\n", GetSimulationTime());
+#ifdef MULTIPATH
+    paths.assign(std::min(Sender_NumPaths(), MAX_PATHS), PathState());
+#endif
 }
 
 /* sender finalization, called once at the very end.
@@ -63,79 +348,385 @@ void Sender_Init() {
    memory you allocated in Sender_init(). */
 void Sender_Final() {
     fprintf(stdout, "At %.2fs: sender finalizing ...\n", GetSimulationTime());
+    fprintf(stdout, "\tpeak memory held by the window and the buffer is %zu bytes\n", peak_memory);
+    fprintf(stdout, "\t%llu retransmissions: %llu on timeout, %llu on duplicate acks, %llu by RACK, %llu tail loss "
+                    "probes\n",
+            retransmit_timeout + retransmit_dup_ack + retransmit_rack + tail_loss_probes,
+            retransmit_timeout, retransmit_dup_ack, retransmit_rack, tail_loss_probes);
+    if (pkts_expired > 0 || pkts_late > 0) {
+        unsigned long long total = pkts_on_time + pkts_late + pkts_expired;
+        fprintf(stdout, "\t%llu of %llu packets acknowledged before their deadline (%.2f%%)\n"
+                        "\t%llu packets expired unacknowledged, saving an estimated %llu bytes of link traffic\n",
+                pkts_on_time, total, total ? pkts_on_time * 100.0 / total : 100.0,
+                pkts_expired, bytes_saved_estimate);
+    }
+#ifdef ECN
+    if (ecn_echoes > 0)
+        fprintf(stdout, "\t%llu acks echoed congestion marks, %llu window reductions on them, alpha ended at %.3f\n",
+                ecn_echoes, ecn_reductions, ecn_alpha);
+#endif
+#ifdef MULTIPATH
+    if (paths.size() > 1)
+        for (size_t i = 0; i < paths.size(); ++i)
+            fprintf(stdout, "\tpath %zu: %llu packets sent (%llu retransmissions), %llu lost, window ended at %u, "
+                            "srtt %.3fs\n",
+                    i, paths[i].sent, paths[i].retransmitted, paths[i].lost, paths[i].window_size, paths[i].srtt);
+#endif
+}
+
+/**
+ * @brief The link as the only path, for the drivers that know of no others. A driver with several paths, like rdt_sim
+ * or a plugin's host, defines Sender_NumPaths() and Sender_ToPath() of its own, which take the place of these.
+ */
+__attribute__((weak)) int Sender_NumPaths() { return 1; }
+
+__attribute__((weak)) void Sender_ToPath(int path, struct packet *pkt, int size) { Sender_ToLowerLayer(pkt, size); }
+
+/* Whether there are several paths to spread the packets over */
+inline bool Multipath() {
+#ifdef MULTIPATH
+    return paths.size() > 1;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief The forward cumulative ack: every seq below it has either been acknowledged or abandoned, so the receiver
+ * may skip over any gap before it.
+ */
+inline unsigned int ForwardAck() {
+    if (!window.empty())
+        return PacketSeq(&window.front().pkt);
+    if (!buffer.empty())
+        return PacketSeq(&buffer.front().pkt);
+    return SeqNext(seq);
+}
+
+/* The forward ack may have moved since the packet was filled, so refresh it together with the checksum */
+inline void RefreshForwardAck(packet *pkt) {
+    SetPacketAck(pkt, ForwardAck());
+    SealPacket(pkt);
+}
+
+/* Restart the physical timer for the head of the chain */
+inline void RestartTimer() {
+    if (timer_chain.empty()) {
+        Sender_StopTimer();
+        return;
+    }
+    /* the simulator ignores timers set for the past */
+    Sender_StartTimer(std::max(timer_chain.front().expire_time - GetSimulationTime(), 0.0));
+}
+
+/* Insert a block into the chain, which is kept ordered by expire time. Most timers expire after all the others,
+   so the place is looked for from the back */
+std::list <TimerChainBlock>::iterator AddTimer(unsigned int seq, double expire_time, int kind,
+                                               SlotIter slot = SlotIter()) {
+    auto iter = timer_chain.end();
+    while (iter != timer_chain.begin() && std::prev(iter)->expire_time > expire_time)
+        --iter;
+    bool new_head = iter == timer_chain.begin();
+    iter = timer_chain.emplace(iter, seq, expire_time, kind, slot);
+    if (new_head)
+        RestartTimer();
+    return iter;
 }
 
-inline unsigned short checksum(unsigned short *data, int size) {
-    long long sum = 0;
-    while (size > 1) {
-        sum += *data++;
-        size -= 2;
+/* Remove a block, found already */
+void EraseTimer(std::list <TimerChainBlock>::iterator block) {
+    bool head_removed = block == timer_chain.begin();
+    timer_chain.erase(block);
+    if (head_removed)
+        RestartTimer();
+}
+
+/* Remove the block of the handle, if it has one */
+void DisarmTimer(TimerHandle &handle) {
+    if (!handle.armed)
+        return;
+    EraseTimer(handle.block);
+    handle.armed = false;
+}
+
+/* Give the handle a block expiring at expire_time, in place of the one it has */
+void ArmTimer(TimerHandle &handle, unsigned int seq, double expire_time, int kind, SlotIter slot = SlotIter()) {
+    DisarmTimer(handle);
+    handle.block = AddTimer(seq, expire_time, kind, slot);
+    handle.armed = true;
+}
+
+/* Remove the first block of the kind, or every block of it if all is set. Only the timers of the forward probes are
+   looked for this way, the others have handles */
+void RemoveTimer(unsigned int seq, int kind, bool all = false) {
+    bool head_removed = false;
+    for (auto iter = timer_chain.begin(); iter != timer_chain.end();) {
+        if (iter->kind == kind && (kind != TIMER_RETRANSMIT || iter->seq == seq)) {
+            head_removed |= iter == timer_chain.begin();
+            iter = timer_chain.erase(iter);
+            if (!all) break;
+        } else ++iter;
     }
+    if (head_removed)
+        RestartTimer();
+}
 
-    if (size > 0) {
-        char left_over[2] = {0};
-        left_over[0] = *(char *) data;
-        sum += *(unsigned short *) left_over;
+/* The slot has just been (re)transmitted: it goes to the back of the order of transmission, unless it has been
+   delivered already and is only probing */
+inline void NoteSent(SlotIter slot) {
+#ifdef RACK
+    if (slot->sacked)
+        return;
+    if (slot->in_sent_order)
+        sent_order.erase(slot->sent_pos);
+    slot->sent_pos = sent_order.insert(sent_order.end(), slot);
+    slot->in_sent_order = true;
+#endif
+}
+
+/* The slot is no longer in flight: out of the order of transmission */
+inline void LeaveSentOrder(WindowSlot &slot) {
+#ifdef RACK
+    if (slot.in_sent_order) {
+        sent_order.erase(slot.sent_pos);
+        slot.in_sent_order = false;
     }
+#endif
+}
 
-    while (sum >> 16)
-        sum = (sum & 0xffff) + (sum >> 16);
-    return ~sum;
+/* The slot leaves the window, and nothing is kept for it */
+inline void ReleaseSlot(WindowSlot &slot) {
+    DisarmTimer(slot.timer);
+    LeaveSentOrder(slot);
 }
 
 inline void SendToLower(packet *pkt) {
+    RefreshForwardAck(pkt);
 #ifdef DEBUG
-    printf("Sender send pkt(seq = %d, checksum = %d, size = %d)\n", *(unsigned int *) &pkt->data[1],
-           *(unsigned short *) &pkt->data[9], pkt->data[0]);
+    printf("Sender send pkt(seq = %d, checksum = %d, size = %d)\n", PacketSeq(pkt), PacketChecksum(pkt),
+           PacketSize(pkt));
 #endif
-    if (timer_chain.empty()) {
-        ASSERT(!Sender_isTimerSet());
-        Sender_StartTimer(TIMEOUT);
+    /* Only the header and the payload go over the link */
+    Sender_ToLowerLayer(pkt, PacketLength(pkt));
+}
+
+#ifdef MULTIPATH
+/* The retransmission timeout of a path */
+inline double PathTimeout(const PathState &path) {
+    if (path.srtt <= 0)
+        return PATH_INITIAL_RTO;
+    return std::max(TIMEOUT, path.srtt + 4 * path.rttvar);
+}
+
+inline bool PathHasRoom(const PathState &path) {
+    return path.in_flight < path.window_size;
+}
+
+/* A scheduler picks the paths of a new packet among those with room in their window, as a mask of them, and the one
+   of them its round trip is to be sampled on. The mask is 0 when no path has room. */
+typedef unsigned int (*PathScheduler)(int *primary);
+
+/* min-RTT: the path with the shortest round trip, any path not measured yet first */
+unsigned int ScheduleMinRtt(int *primary) {
+    int best = -1;
+    for (int i = 0; i < (int) paths.size(); ++i)
+        if (PathHasRoom(paths[i]) && (best < 0 || paths[i].srtt < paths[best].srtt))
+            best = i;
+    *primary = best;
+    return best < 0 ? 0 : 1u << best;
+}
+
+/* Smooth weighted round-robin, each path weighted by the rate its window makes for over its round trip */
+unsigned int ScheduleWeightedRoundRobin(int *primary) {
+    double total = 0;
+    int best = -1;
+    for (int i = 0; i < (int) paths.size(); ++i) {
+        if (!PathHasRoom(paths[i]))
+            continue;
+        double weight = paths[i].window_size / (paths[i].srtt > 0 ? paths[i].srtt : PATH_INITIAL_RTO);
+        paths[i].wrr_credit += weight;
+        total += weight;
+        if (best < 0 || paths[i].wrr_credit > paths[best].wrr_credit)
+            best = i;
     }
+    *primary = best;
+    if (best < 0)
+        return 0;
+    paths[best].wrr_credit -= total;
+    return 1u << best;
+}
+
+/* Redundant: a copy on every path with room, the round trip sampled on the shortest of them */
+unsigned int ScheduleRedundant(int *primary) {
+    unsigned int mask = 0;
+    for (int i = 0; i < (int) paths.size(); ++i)
+        if (PathHasRoom(paths[i]))
+            mask |= 1u << i;
+    ScheduleMinRtt(primary);
+    return mask;
+}
+
+static const struct {
+    const char *name;
+    PathScheduler schedule;
+} schedulers[] = {
+    {"minrtt", ScheduleMinRtt},
+    {"wrr", ScheduleWeightedRoundRobin},
+    {"redundant", ScheduleRedundant},
+};
 
-    timer_chain.emplace_back(*(unsigned int *) &pkt->data[1], GetSimulationTime() + TIMEOUT);
+/* the scheduler of every sender, chosen by the driver before any of them runs */
+static PathScheduler path_scheduler = ScheduleMinRtt;
+
+bool Sender_SetScheduler(const char *name) {
+    for (const auto &scheduler : schedulers)
+        if (strcmp(scheduler.name, name) == 0) {
+            path_scheduler = scheduler.schedule;
+            return true;
+        }
+    return false;
+}
+
+/* Take the packet of the slot out of flight on the paths it has been sent on */
+inline void LeavePaths(WindowSlot &slot) {
+    for (size_t i = 0; i < paths.size(); ++i)
+        if (slot.on_paths & (1u << i))
+            --paths[i].in_flight;
+    slot.on_paths = 0;
+}
+
+/**
+ * @brief Send the packet of the slot on every path of the mask, under a single retransmission timer that waits for
+ * the slowest of them.
+ * @param primary the path the round trip of the packet is sampled on
+ */
+void TransmitOnPaths(SlotIter slot_iter, unsigned int mask, int primary) {
+    ASSERT(mask != 0);
+    WindowSlot &slot = *slot_iter;
+    LeavePaths(slot);
+    slot.path = primary;
+    slot.sent_time = GetSimulationTime();
+    RefreshForwardAck(&slot.pkt);
+    double timeout = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!(mask & (1u << i)))
+            continue;
+        timeout = std::max(timeout, PathTimeout(paths[i]));
+        ++paths[i].sent;
+        if (slot.retransmit > 0)
+            ++paths[i].retransmitted;
+        /* A packet already delivered is only probing, and takes no room */
+        if (!slot.sacked)
+            ++paths[i].in_flight;
+        Sender_ToPath(i, &slot.pkt, PacketLength(&slot.pkt));
+    }
+    if (!slot.sacked)
+        slot.on_paths = mask;
 
-    Sender_ToLowerLayer(pkt);
+    NoteSent(slot_iter);
+    ArmTimer(slot.timer, PacketSeq(&slot.pkt), GetSimulationTime() + timeout * rto_backoff, TIMER_RETRANSMIT,
+             slot_iter);
 }
 
-inline void SendOrBuffer(packet *pkt) {
-    if (window.size() < window_size) {
-        window.push_back(*pkt);
+/* The paths to retransmit a lost packet on, whether or not they have room: the one with the shortest round trip
+   other than the path it has been lost on, or every path for the redundant scheduler */
+unsigned int AlternatePaths(const WindowSlot &slot, int *primary) {
+    int best = -1;
+    for (int i = 0; i < (int) paths.size(); ++i)
+        if (i != slot.path && (best < 0 || paths[i].srtt < paths[best].srtt))
+            best = i;
+    *primary = best;
+    if (path_scheduler == ScheduleRedundant)
+        return (paths.size() == MAX_PATHS ? 0u : 1u << paths.size()) - 1;
+    return 1u << best;
+}
+#else
+bool Sender_SetScheduler(const char *name) {
+    return false;
+}
+#endif
+
+inline void TransmitSlot(SlotIter slot) {
+#ifdef MULTIPATH
+    if (Multipath()) {
+        int primary;
+        unsigned int mask = path_scheduler(&primary);
+        TransmitOnPaths(slot, mask, primary);
+        return;
+    }
+#endif
+    slot->sent_time = GetSimulationTime();
+    NoteSent(slot);
+    /* A packet is guarded by a single retransmission timer, however many times it has been sent */
+    ArmTimer(slot->timer, PacketSeq(&slot->pkt), GetSimulationTime() + TIMEOUT * rto_backoff, TIMER_RETRANSMIT, slot);
+    SendToLower(&slot->pkt);
+}
+
+/* Whether the window has room for a new packet, on any of the paths when there are several */
+inline bool WindowHasRoom() {
+#ifdef MULTIPATH
+    if (Multipath())
+        return window.size() < std::min<size_t>(PATH_REORDER_LIMIT, WINDOW_LIMIT) && std::any_of(paths.begin(), paths.end(), PathHasRoom);
+#endif
+    return window.size() < window_size;
+}
+
+/* The packets sent and not known to be delivered yet */
+inline size_t InFlight() {
+#ifdef RACK
+    return sent_order.size();
+#else
+    return std::count_if(window.begin(), window.end(), [](const WindowSlot &slot) { return !slot.sacked; });
+#endif
+}
+
+/* Sampled wherever the window or the buffer grows */
+inline void NotePeakMemory() {
+    peak_memory = std::max(peak_memory, (window.size() + buffer.size()) * sizeof(WindowSlot));
+}
+
+inline void SendOrBuffer(packet *pkt, double deadline, int max_retransmit) {
+    /* Never overtake the packets already buffered */
+    if (WindowHasRoom() && buffer.empty()) {
+        window.emplace_back(*pkt, deadline, max_retransmit);
 #ifdef DEBUG
-        unsigned int seq = *(unsigned int *) &pkt->data[1];
+        unsigned int seq = PacketSeq(pkt);
         printf("Sender send pkt now(seq = %d)\n", seq);
 #endif
-        SendToLower(pkt);
+        TransmitSlot(std::prev(window.end()));
     } else {
 #ifdef DEBUG
         printf("Sender put pkt into buffer(seq = %d)\n", seq);
 #endif
-        buffer.push(*pkt);
+        buffer.emplace(*pkt, deadline, max_retransmit);
     }
+    PROFILE_PEAK(PROF_PEAK_WINDOW, window.size());
+    PROFILE_PEAK(PROF_PEAK_SENDER_BUFFER, buffer.size());
 }
 
-void FillPacket(packet *pkt, int size, int seq, int ack, char *data) {
-    constexpr static int header_size = 11;
+void FillPacket(packet *pkt, int size, unsigned int seq, unsigned int ack, char *data) {
     memset(pkt, 0, sizeof(packet));
-    pkt->data[0] = size;
-    *(unsigned int *) (&pkt->data[1]) = seq;
-    *(unsigned int *) (&pkt->data[5]) = 1;
-    memcpy(pkt->data + header_size, data, size);
-    *(unsigned short *) (&pkt->data[9]) = checksum((unsigned short *) pkt, size + header_size);
+    SetPacketSize(pkt, size);
+    SetPacketSeq(pkt, seq);
+    SetPacketAck(pkt, ack);
+    SetPacketConn(pkt, conn_id);
+    if (size > 0)
+        memcpy(PacketPayload(pkt), data, size);
+    SealPacket(pkt);
 }
 
 /* event handler, called when a message is passed from the upper layer at the 
    sender */
-void Sender_FromUpperLayer(struct message *msg) {
-    /*
-     * struct is as follow
-     * |<- data length(1 byte) ->||<- seq(4 bytes) ->||<- ack(4 bytes) ->||<- checksum(2 bytes) ->|
-     * */
+bool Sender_FromUpperLayer(struct message *msg, double deadline, int max_retransmit) {
+    /* maximum payload size, the header layout is described in rdt_packet.h */
+    constexpr int maxpayload_size = Layout::max_payload;
 
-    int header_size = 11;
-
-    /* maximum payload size */
-    int maxpayload_size = RDT_PKTSIZE - header_size;
+    /* Push back rather than let the buffer grow without bound, but always take a message when nothing is waiting */
+    size_t npkts = (msg->size + maxpayload_size - 1) / maxpayload_size;
+    if (!buffer.empty() && (buffer.size() + npkts) * sizeof(WindowSlot) > BUFFER_BUDGET) {
+        upper_layer_blocked = true;
+        return false;
+    }
 
     /* split the message if it is too big */
 
@@ -147,8 +738,8 @@ void Sender_FromUpperLayer(struct message *msg) {
 
     while (msg->size - cursor > maxpayload_size) {
         /* fill in the packet */
-        FillPacket(&pkt, maxpayload_size, ++seq, 1, msg->data + cursor);
-        SendOrBuffer(&pkt);
+        FillPacket(&pkt, maxpayload_size, seq = SeqNext(seq), 1, msg->data + cursor);
+        SendOrBuffer(&pkt, deadline, max_retransmit);
         /* move the cursor */
         cursor += maxpayload_size;
     }
@@ -156,20 +747,78 @@ void Sender_FromUpperLayer(struct message *msg) {
     /* send out the last packet */
     if (msg->size > cursor) {
         /* fill in the packet */
-        FillPacket(&pkt, msg->size - cursor, ++seq, 1, msg->data + cursor);
-        SendOrBuffer(&pkt);
+        FillPacket(&pkt, msg->size - cursor, seq = SeqNext(seq), 1, msg->data + cursor);
+        SendOrBuffer(&pkt, deadline, max_retransmit);
+    }
+
+    NotePeakMemory();
+    return true;
+}
+
+inline bool SlotExpired(const WindowSlot &slot) {
+    return slot.deadline > 0 && GetSimulationTime() >= slot.deadline;
+}
+
+/* Account for a packet that will never be (re)transmitted again */
+inline void Abandon(WindowSlot &slot) {
+#ifdef MULTIPATH
+    LeavePaths(slot);
+#endif
+    if (!slot.sacked) {
+        ++pkts_expired;
+        bytes_saved_estimate += PacketLength(&slot.pkt);
     }
+    last_abandoned = SeqMax(last_abandoned, PacketSeq(&slot.pkt));
 }
 
-void Retransmit(unsigned int seq) {
+/* A control packet carrying nothing but the forward ack, seq 0 is never used by data */
+void SendForwardProbe() {
+    packet pkt;
+    FillPacket(&pkt, 0, 0, 1, NULL);
+    /* A single probe is awaited at a time, the timer of an earlier one goes */
+    RemoveTimer(0, TIMER_RETRANSMIT, true);
+    AddTimer(0, GetSimulationTime() + TIMEOUT, TIMER_RETRANSMIT);
+    SendToLower(&pkt);
+}
+
+/**
+ * @brief Retransmit the packet of a slot in the window.
+ * @return whether the packet has actually been retransmitted, rather than abandoned.
+ */
+bool RetransmitSlot(SlotIter slot_iter) {
+    PROFILE(PROF_RETRANSMIT);
 #ifdef DEBUG
-    printf("Retransmit to seq = %d\n", seq);
+    printf("Retransmit to seq = %d\n", PacketSeq(&slot_iter->pkt));
+#endif
+    if (SlotExpired(*slot_iter) ||
+        (slot_iter->max_retransmit >= 0 && slot_iter->retransmit >= slot_iter->max_retransmit)) {
+        /* Nobody wants the packet any more, abandon it and let the receiver skip over it */
+        Abandon(*slot_iter);
+        ReleaseSlot(*slot_iter);
+        window.erase(slot_iter);
+        SendForwardProbe();
+        return false;
+    }
+    ++slot_iter->retransmit;
+#ifdef MULTIPATH
+    /* Across several paths, a lost packet goes again on another one */
+    if (Multipath()) {
+        int primary;
+        unsigned int mask = AlternatePaths(*slot_iter, &primary);
+        TransmitOnPaths(slot_iter, mask, primary);
+        return true;
+    }
 #endif
-    auto pkt_iter = std::find_if(window.begin(), window.end(), [seq](const packet &pkt) {
-        return *(unsigned int *) &pkt.data[1] == seq;
+    TransmitSlot(slot_iter);
+    return true;
+}
+
+/* Retransmit the packet with the given seq if it is still in the window */
+bool Retransmit(unsigned int seq) {
+    auto slot_iter = std::find_if(window.begin(), window.end(), [seq](const WindowSlot &slot) {
+        return PacketSeq(&slot.pkt) == seq;
     });
-    if (pkt_iter != window.end())
-        SendToLower(&(*pkt_iter));
+    return slot_iter != window.end() && RetransmitSlot(slot_iter);
 }
 
 /**
@@ -177,123 +826,516 @@ void Retransmit(unsigned int seq) {
  * @param pkt packet received from the receiver
  * @return if the packet is not corrupted, return true, else return false.
  */
-inline bool PacketNotCorrupted(packet *pkt) {
-    constexpr static int header_size = 11;
-    unsigned int size = pkt->data[0];
-    unsigned int pkt_seq = *(unsigned int *) &pkt->data[1];
-    unsigned int pkt_ack = *(unsigned int *) &pkt->data[5];
-    if (size < 0 || size > RDT_PKTSIZE || pkt_ack > seq + 1 || pkt_seq > seq)
+static inline bool PacketNotCorrupted(packet *pkt) {
+    unsigned int pkt_seq = PacketSeq(pkt);
+    unsigned int pkt_ack = PacketAck(pkt);
+    if (SeqAfter(pkt_ack, SeqNext(seq)) || (pkt_seq != 0 && SeqAfter(pkt_seq, seq)))
         return false;
-    int pkt_checksum = *(unsigned short *) &pkt->data[9];
-    /* Set the checksum to zero first, then calculate the checksum */
-    *(unsigned short *) &pkt->data[9] = 0;
-    int real_checksum = checksum((unsigned short *) pkt, pkt->data[0] + header_size);
-#ifdef DEBUG
-    printf("pkt_checksum = %d and real_checksum = %d\n", pkt_checksum, real_checksum);
+    return PacketChecksumValid(pkt);
+}
+
+#ifdef RACK
+/* Take a round trip into the minimum, which forgets a sample MIN_RTT_WINDOW after it has been taken */
+inline void SampleMinRtt(double &min, double &min_time, double rtt) {
+    double now = GetSimulationTime();
+    if (rtt <= min || now - min_time > MIN_RTT_WINDOW) {
+        min = rtt;
+        min_time = now;
+    }
+}
+
+/* RACK: remember the most recently sent packet known to be delivered */
+void RackOnDelivered(const WindowSlot &slot) {
+    double rtt = GetSimulationTime() - slot.sent_time;
+    unsigned int slot_seq = PacketSeq(&slot.pkt);
+    /* The ack of a retransmitted packet may come from an earlier transmission (Karn's algorithm) */
+    if (slot.retransmit == 0) {
+        SampleMinRtt(min_rtt, min_rtt_time, rtt);
+        if (srtt > 0) {
+            rttvar = rttvar * 3 / 4 + std::abs(srtt - rtt) / 4;
+            srtt = srtt * 7 / 8 + rtt / 8;
+        } else {
+            srtt = rtt;
+            rttvar = rtt / 2;
+        }
+    } else if (rtt < min_rtt) {
+        return;
+    }
+    if (slot.sent_time > rack_xmit_time || (slot.sent_time == rack_xmit_time && SeqAfter(slot_seq, rack_seq))) {
+        rack_xmit_time = slot.sent_time;
+        rack_seq = slot_seq;
+        rack_rtt = rtt;
+    }
+}
+#endif
+
+#ifdef MULTIPATH
+/**
+ * @brief The packet of the slot has been delivered: it leaves flight, and the path it has been sent on grows its
+ * window and samples its round trip and its RACK state, the way RackOnDelivered() does for the single path.
+ */
+void PathOnDelivered(WindowSlot &slot) {
+    LeavePaths(slot);
+    PathState &path = paths[slot.path];
+    if (path.window_size < path.ssthresh) {
+        path.window_size <<= 1;
+    } else {
+        ++path.window_size;
+    }
+    path.window_size = std::min(path.window_size, WINDOW_LIMIT);
+
+    double rtt = GetSimulationTime() - slot.sent_time;
+    unsigned int slot_seq = PacketSeq(&slot.pkt);
+    if (slot.retransmit == 0) {
+        SampleMinRtt(path.min_rtt, path.min_rtt_time, rtt);
+        if (path.srtt > 0) {
+            path.rttvar = path.rttvar * 3 / 4 + std::abs(path.srtt - rtt) / 4;
+            path.srtt = path.srtt * 7 / 8 + rtt / 8;
+        } else {
+            path.srtt = rtt;
+            path.rttvar = rtt / 2;
+        }
+    } else if (rtt < path.min_rtt) {
+        return;
+    }
+    if (slot.sent_time > path.rack_xmit_time || (slot.sent_time == path.rack_xmit_time && SeqAfter(slot_seq, path.rack_seq))) {
+        path.rack_xmit_time = slot.sent_time;
+        path.rack_seq = slot_seq;
+        path.rack_rtt = rtt;
+    }
+}
+
+/* A packet sent on the path has been lost: the window of the path starts over after a timeout, and is halved
+   otherwise, at most once a round trip of the path */
+void PathOnLoss(int p, bool timeout) {
+    PathState &path = paths[p];
+    ++path.lost;
+    if (timeout) {
+        path.window_size = 2;
+        return;
+    }
+    if (GetSimulationTime() - path.last_reduction < std::max(path.srtt, path.min_rtt))
+        return;
+    path.last_reduction = GetSimulationTime();
+    path.window_size = std::max(path.window_size >> 1, 1u);
+}
+#endif
+
+/* The receiver has received the packet, no matter whether the ack has moved */
+inline void OnDelivered(WindowSlot &slot) {
+    slot.sacked = true;
+    rto_backoff = 1;
+    LeaveSentOrder(slot);
+    if (slot.deadline > 0 && GetSimulationTime() > slot.deadline)
+        ++pkts_late;
+    else
+        ++pkts_on_time;
+#ifdef RACK
+    RackOnDelivered(slot);
+#endif
+#ifdef MULTIPATH
+    if (Multipath())
+        PathOnDelivered(slot);
 #endif
-    return pkt_checksum == real_checksum;
 }
 
 void StopReceivedPacketTimer(unsigned int seq) {
-    auto iter = std::find_if(timer_chain.begin(), timer_chain.end(), [seq](const TimerChainBlock &another) {
-        return another.seq == seq;
+    PROFILE(PROF_STOP_RECEIVED_PACKET_TIMER);
+    auto slot_iter = std::find_if(window.begin(), window.end(), [seq](const WindowSlot &slot) {
+        return PacketSeq(&slot.pkt) == seq;
     });
-    if (iter == timer_chain.end()) return;
-    if (iter == timer_chain.begin()) {
-        Sender_StopTimer();
-        timer_chain.pop_front();
-        if (!timer_chain.empty()) {
-            Sender_StartTimer(timer_chain.front().expire_time - GetSimulationTime());
+    if (slot_iter != window.end() && !slot_iter->sacked)
+        OnDelivered(*slot_iter);
+#ifdef RACK
+    else if (slot_iter != window.end() && slot_iter->retransmit > 0) {
+        /* Both the original and the retransmission have arrived, the packet was only reordered */
+        reo_wnd_mult = std::min(reo_wnd_mult + 1, 8);
+        reo_wnd_persist = 16;
+    }
+#endif
+
+    if (slot_iter != window.end())
+        DisarmTimer(slot_iter->timer);
+    else if (seq == 0)
+        RemoveTimer(0, TIMER_RETRANSMIT);
+}
+
+#ifdef AIMD
+/* Multiplicative decrease, at most once a round trip for the losses of the same window */
+inline void ReduceWindow() {
+#ifdef RACK
+    if (GetSimulationTime() - last_reduction < std::max(srtt, min_rtt))
+        return;
+    last_reduction = GetSimulationTime();
+#endif
+    /* A window of none would never grow back, no ack being on its way */
+    window_size = std::max(window_size >> 1, 1u);
+}
+#endif
+
+#ifdef ECN
+/**
+ * @brief DCTCP: count the acks echoing a congestion mark, and fold the fraction of them into alpha once a window of
+ * data has been acked. A mark shrinks the window in proportion to alpha, at most once a round trip, and ends slow
+ * start there.
+ * @return whether the ack echoes a mark
+ */
+bool EcnOnAck(packet *pkt, unsigned int ack) {
+    bool echoed = AckFlags(pkt) & ACK_FLAG_ECE;
+    ++ecn_acks;
+    if (echoed) {
+        ++ecn_marked_acks;
+        ++ecn_echoes;
+    }
+    if (SeqAfter(ack, ecn_window_end)) {
+        ecn_alpha = ecn_alpha * (1 - ECN_GAIN) + ECN_GAIN * ecn_marked_acks / ecn_acks;
+        ecn_acks = ecn_marked_acks = 0;
+        ecn_window_end = window.empty() ? seq : PacketSeq(&window.back().pkt);
+    }
+    if (!echoed)
+        return false;
+
+#ifdef RACK
+    if (GetSimulationTime() - last_reduction < std::max(srtt, min_rtt))
+        return true;
+    last_reduction = GetSimulationTime();
+#endif
+    window_size = std::max(2u, (unsigned int) (window_size * (1 - ecn_alpha / 2)));
+    ssthresh = window_size;
+    ++ecn_reductions;
+    return true;
+}
+#endif
+
+#ifdef MULTIPATH
+/**
+ * @brief RACK on every path of its own: a packet is lost once a packet sent after it on the same path has been
+ * delivered and the reordering window of that path has passed.
+ */
+void PathRackDetectLoss() {
+    double now = GetSimulationTime();
+    double wait = 0;
+    std::vector<std::pair<unsigned int, int>> lost;
+    for (const WindowSlot &slot : window) {
+        unsigned int slot_seq = PacketSeq(&slot.pkt);
+        const PathState &path = paths[slot.path];
+        if (slot.sacked || path.rack_xmit_time < 0 || slot.sent_time > path.rack_xmit_time ||
+            (slot.sent_time == path.rack_xmit_time && !SeqBefore(slot_seq, path.rack_seq)))
+            continue;
+        double reo_wnd = std::min(path.min_rtt / 4 * reo_wnd_mult, path.srtt);
+        double remaining = slot.sent_time + path.rack_rtt + reo_wnd - now;
+        if (remaining <= 0)
+            lost.emplace_back(slot_seq, slot.path);
+        else
+            wait = std::max(wait, remaining);
+    }
+
+    for (auto [lost_seq, lost_path] : lost) {
+        if (Retransmit(lost_seq))
+            ++retransmit_rack;
+        PathOnLoss(lost_path, false);
+    }
+    if (!lost.empty() && --reo_wnd_persist <= 0)
+        reo_wnd_mult = 1;
+
+    DisarmTimer(reorder_timer);
+    if (wait > 0)
+        ArmTimer(reorder_timer, 0, now + wait, TIMER_REORDER);
+}
+#endif
+
+#ifdef RACK
+/**
+ * @brief RACK loss detection: a packet is lost once a packet sent after it has been delivered and the reordering
+ * window has passed. Packets still inside the reordering window are checked again by a reorder timer.
+ */
+void RackDetectLoss() {
+#ifdef MULTIPATH
+    if (Multipath()) {
+        PathRackDetectLoss();
+        return;
+    }
+#endif
+    if (rack_xmit_time < 0)
+        return;
+    double now = GetSimulationTime();
+    double reo_wnd = std::min(min_rtt / 4 * reo_wnd_mult, srtt);
+    double wait = 0;
+    /* kept from one call to the next, so that an ack allocates nothing */
+    RUNNING_STATE std::vector<SlotIter> lost;
+    lost.clear();
+    /* The packets in flight are in the order they have been sent, so the scan stops at the first one sent after the
+       most recently delivered */
+    for (SlotIter slot : sent_order) {
+        if (slot->sent_time > rack_xmit_time)
+            break;
+        if (slot->sent_time == rack_xmit_time && !SeqBefore(PacketSeq(&slot->pkt), rack_seq))
+            continue;
+        double remaining = slot->sent_time + rack_rtt + reo_wnd - now;
+        if (remaining <= 0)
+            lost.push_back(slot);
+        else
+            wait = std::max(wait, remaining);
+    }
+
+    /* The losses go again in the order of their seqs, the hole the receiver is waiting on first */
+    std::sort(lost.begin(), lost.end(), [](SlotIter a, SlotIter b) {
+        return SeqBefore(PacketSeq(&a->pkt), PacketSeq(&b->pkt));
+    });
+    for (SlotIter slot : lost) {
+#ifdef DEBUG
+        printf("RACK marks pkt(seq = %d) lost\n", PacketSeq(&slot->pkt));
+#endif
+        if (RetransmitSlot(slot))
+            ++retransmit_rack;
+    }
+    /* A recovery is the losses of a round trip, as in ReduceWindow() */
+    if (!lost.empty() && now - last_reduction >= std::max(srtt, min_rtt)) {
+        if (--reo_wnd_persist <= 0)
+            reo_wnd_mult = 1;
+#ifdef AIMD
+        ReduceWindow();
+#else
+        last_reduction = now;
+#endif
+    }
+
+    DisarmTimer(reorder_timer);
+    if (wait > 0)
+        ArmTimer(reorder_timer, 0, now + wait, TIMER_REORDER);
+}
+
+/**
+ * @brief Arm the tail loss probe, so that the tail of a burst doesn't have to wait for the retransmission timer. The
+ * probe fires a little more than a round trip after the last packet in flight has been sent.
+ */
+void ArmTailLossProbe() {
+    DisarmTimer(probe_timer);
+    /* The round trip of a single path says nothing about when the tail is due over several */
+    if (Multipath())
+        return;
+    auto iter = std::find_if(window.rbegin(), window.rend(), [](const WindowSlot &slot) { return !slot.sacked; });
+    if (srtt <= 0 || iter == window.rend())
+        return;
+    double pto = srtt + 2 * rttvar;
+    if (pto < TIMEOUT)
+        ArmTimer(probe_timer, 0, std::max(iter->sent_time + pto, GetSimulationTime()), TIMER_TAIL_PROBE);
+}
+
+/* Retransmit the last packet in flight to trigger an ack, which lets RACK detect the losses before it */
+void TailLossProbe() {
+    auto iter = std::find_if(window.rbegin(), window.rend(), [](const WindowSlot &slot) { return !slot.sacked; });
+    if (iter == window.rend())
+        return;
+#ifdef DEBUG
+    printf("Tail loss probe(seq = %d)\n", PacketSeq(&iter->pkt));
+#endif
+    if (Retransmit(PacketSeq(&iter->pkt)))
+        ++tail_loss_probes;
+}
+#endif
+
+/**
+ * @brief Abandon every packet whose deadline has passed, both in flight and still buffered.
+ * @return whether any packet has been abandoned.
+ */
+bool DropExpired() {
+    bool dropped = false;
+    for (auto iter = window.begin(); iter != window.end();) {
+        if (!iter->sacked && SlotExpired(*iter)) {
+            Abandon(*iter);
+            ReleaseSlot(*iter);
+            iter = window.erase(iter);
+            dropped = true;
+        } else ++iter;
+    }
+    while (!buffer.empty() && SlotExpired(buffer.front())) {
+        Abandon(buffer.front());
+        buffer.pop();
+        dropped = true;
+    }
+    return dropped;
+}
+
+/* When the sliding window has been moved, the packet buffered may be sent now */
+void FillWindow() {
+    while (WindowHasRoom() && !buffer.empty()) {
+        if (SlotExpired(buffer.front())) {
+            Abandon(buffer.front());
+            buffer.pop();
+            continue;
         }
-    } else {
-        timer_chain.erase(iter);
+        window.push_back(buffer.front());
+        buffer.pop();
+        TransmitSlot(std::prev(window.end()));
+    }
+    NotePeakMemory();
+    PROFILE_PEAK(PROF_PEAK_WINDOW, window.size());
+
+    /* Wake the upper layer up once half of the budget is free again */
+    if (upper_layer_blocked && buffer.size() * sizeof(WindowSlot) <= BUFFER_BUDGET / 2) {
+        upper_layer_blocked = false;
+        Sender_UpperLayerWritable();
     }
 }
 
+/* The least time a copy of a packet takes to be acked */
+inline double RoundTrip() {
+#ifdef RACK
+    return srtt > 0 ? srtt : TIMEOUT;
+#else
+    return TIMEOUT;
+#endif
+}
+
 /* event handler, called when a packet is passed from the lower layer at the 
    sender */
 void Sender_FromLowerLayer(struct packet *pkt) {
+    PROFILE(PROF_SENDER_FROMLOWERLAYER);
     if (!PacketNotCorrupted(pkt)) {
 #ifdef DEBUG
         printf("Sender receive corrupted pkt\n");
 #endif
         return;
     }
-    unsigned int seq = *(unsigned int *) (&pkt->data[1]);
-    unsigned int ack = *(unsigned int *) (&pkt->data[5]);
+    unsigned int seq = PacketSeq(pkt);
+    unsigned int ack = PacketAck(pkt);
 #ifdef DEBUG
-    printf("Received ack from receiver: %d, and dup_ack[%d] = %d\n", ack, ack, dup_ack[ack] + 1);
-#endif
-
-    StopReceivedPacketTimer(seq);
-
-    /* Fast retransmit */
-    if (++dup_ack[ack] >= DUP_UPPERBOUND) {
-        dup_ack[ack] = 0;
-        Retransmit(ack);
-        auto iter = std::find_if(timer_chain.begin(), timer_chain.end(), [ack](const TimerChainBlock &another) {
-            return ack == another.seq;
-        });
-        if (iter != timer_chain.end()) {
-            if (timer_chain.size() == 1) {
-                timer_chain.clear();
-                Sender_StopTimer();
-            } else {
-                timer_chain.erase(iter);
-            }
-        }
-#ifdef AIMD
-        window_size >>= 1;
-#endif
-    }
-#ifdef AIMD
-    if (window_size < ssthresh) {
-        window_size <<= 1;
-    } else {
-        ++window_size;
-    }
+    printf("Received ack from receiver: %d\n", ack);
 #endif
+
+    /* Keep probing until the receiver has skipped over everything abandoned */
+    if (seq != 0 || SeqAfter(ack, last_abandoned))
+        StopReceivedPacketTimer(seq);
+
     /* Move the sliding window, all the packet smaller than ack can be erased safely. */
-    if (ack > current_ack) {
+    if (SeqAfter(ack, current_ack)) {
         while (!window.empty()) {
-            packet &front = window.front();
-            unsigned int front_seq = *(unsigned int *) &front.data[1];
-            if (front_seq < ack) {
+            WindowSlot &front = window.front();
+            unsigned int front_seq = PacketSeq(&front.pkt);
+            if (SeqBefore(front_seq, ack)) {
+                if (!front.sacked)
+                    OnDelivered(front);
+                ReleaseSlot(front);
                 window.pop_front();
             } else break;
         }
         current_ack = ack;
+        /* Nothing before the ack is compared against any more, keep what is behind it close enough to compare */
+        if (SeqBefore(last_abandoned, current_ack))
+            last_abandoned = current_ack - 1;
     }
 
-    /* When the sliding window has been moved, the packet buffered may be sent now */
-    while (window.size() < window_size && !buffer.empty()) {
-        packet &front = buffer.front();
-        SendToLower(&front);
-        window.push_back(front);
-        buffer.pop();
+    /* Fast retransmit, the receiver is waiting for the packet at the front of the window. Across several paths the
+       packets overtake each other all the time, and RACK on every path tells the losses instead. The echo of a forward
+       probe says nothing about the data in flight, here or below */
+    if (seq != 0 && !Multipath() && !window.empty() && PacketSeq(&window.front().pkt) == ack &&
+        ++window.front().dup_ack >= DUP_UPPERBOUND && GetSimulationTime() - window.front().sent_time >= RoundTrip()) {
+        window.front().dup_ack = 0;
+#ifdef DEBUG
+        printf("Fast retransmit(seq = %d)\n", ack);
+#endif
+        if (Retransmit(ack))
+            ++retransmit_dup_ack;
+#ifdef AIMD
+        ReduceWindow();
+#endif
+    }
+#ifdef AIMD
+    /* The window does not grow on an ack echoing a mark, and with several paths their own windows grow instead */
+#ifdef ECN
+    if (seq != 0 && !Multipath() && !EcnOnAck(pkt, ack))
+#else
+    if (seq != 0 && !Multipath())
+#endif
+    {
+        if (window_size < ssthresh) {
+            window_size <<= 1;
+        } else {
+            ++window_size;
+        }
+        window_size = std::min(window_size, WINDOW_LIMIT);
     }
+#endif
+
+#ifdef RACK
+    RackDetectLoss();
+#endif
+
+    bool dropped = DropExpired();
+    FillWindow();
+    /* The receiver may be still waiting for something we have abandoned */
+    if (dropped && !SeqAfter(current_ack, last_abandoned))
+        SendForwardProbe();
+#ifdef RACK
+    ArmTailLossProbe();
+#endif
 }
 
 /* event handler, called when the timer expires */
 void Sender_Timeout() {
-#ifdef AIMD
-    window_size = 2;
-#endif
-
     ASSERT(!timer_chain.empty());
-    TimerChainBlock &front = timer_chain.front();
+    TimerChainBlock front = timer_chain.front();
 #ifdef DEBUG
-    printf("Timeout(seq = %d, current_ack = %d)\n", front.seq, current_ack);
+    printf("Timeout(seq = %d, kind = %d, current_ack = %d)\n", front.seq, front.kind, current_ack);
 #endif
-    if (front.seq >= current_ack) {
-        Retransmit(front.seq);
-    }
     timer_chain.pop_front();
+    /* The block is gone, and the handle that has it with it */
+    if (front.GuardsSlot())
+        front.slot->timer.armed = false;
+    switch (front.kind) {
+#ifdef RACK
+        case TIMER_REORDER:
+            reorder_timer.armed = false;
+            RackDetectLoss();
+            break;
+        case TIMER_TAIL_PROBE:
+            probe_timer.armed = false;
+            TailLossProbe();
+            break;
+#endif
+        default:
+            if (front.seq == 0) {
+                /* A forward probe has been lost, or the receiver has not caught up yet */
+                if (!SeqAfter(current_ack, last_abandoned))
+                    SendForwardProbe();
+            } else {
+#ifdef MULTIPATH
+                /* The path the packet has been lost on, before the retransmission takes another */
+                int lost_path = Multipath() ? front.slot->path : -1;
+#endif
+                if (front.slot != window.begin() && !Multipath() && InFlight() > window_size) {
+                    /* The window has shrunk below what is in flight. Only the packet the receiver is waiting for
+                       goes again, the others wait behind it rather than flood the link */
+                    ArmTimer(front.slot->timer, front.seq, GetSimulationTime() + TIMEOUT * rto_backoff,
+                             TIMER_RETRANSMIT, front.slot);
+                } else {
+                    /* The retransmission already waits for the doubled timeout */
+                    unsigned int last_backoff = rto_backoff;
+                    rto_backoff = std::min<unsigned int>(rto_backoff * 2, MAX_BACKOFF);
+                    if (!RetransmitSlot(front.slot)) {
+                        rto_backoff = last_backoff;
+                        break;
+                    }
+                    ++retransmit_timeout;
+#ifdef AIMD
+                    /* Only a real retransmission is a sign of congestion */
+                    window_size = 2;
+#endif
+#ifdef MULTIPATH
+                    if (lost_path >= 0)
+                        PathOnLoss(lost_path, true);
+#endif
+                }
+            }
+            break;
+    }
+    bool dropped = DropExpired();
+    FillWindow();
+    if (dropped && !SeqAfter(current_ack, last_abandoned))
+        SendForwardProbe();
     /* This is a chain of timer, which is used to simulate multiple timer */
     /* The blocks are ordered by their expire time. */
-    if (!timer_chain.empty()) {
-        double next_expire_time = timer_chain.front().expire_time;
-        double internal = next_expire_time - GetSimulationTime();
-        Sender_StartTimer(internal);
-    }
+    if (!timer_chain.empty())
+        RestartTimer();
 }
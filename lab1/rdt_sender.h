@@ -31,8 +31,27 @@ void Sender_StopTimer();
    return true if the timer is set, return false otherwise */
 bool Sender_isTimerSet();
 
-/* pass a packet to the lower layer at the sender */
-void Sender_ToLowerLayer(struct packet *pkt);
+/* pass a packet to the lower layer at the sender, only the first size bytes 
+   of the packet are carried over the link; implementations that always send 
+   a full packet can leave size out */
+void Sender_ToLowerLayer(struct packet *pkt, int size = RDT_PKTSIZE);
+
+/* tell the upper layer that a message refused by Sender_FromUpperLayer() 
+   can be passed again */
+void Sender_UpperLayerWritable();
+
+/* the number of paths between the sender and the receiver, at least 1.  each 
+   path has a latency, a loss rate and a bandwidth of its own, and the 
+   receiver answers a packet on the path it came by */
+int Sender_NumPaths();
+
+/* the most paths a sender uses, one bit each in its masks of paths; a driver
+   offers no more than this many */
+#define MAX_PATHS 32
+
+/* pass a packet to the lower layer at the sender over the given path, from 0 
+   to Sender_NumPaths()-1; path 0 is the one of Sender_ToLowerLayer() */
+void Sender_ToPath(int path, struct packet *pkt, int size = RDT_PKTSIZE);
 
 
 /*[]------------------------------------------------------------------------[]
@@ -50,8 +69,14 @@ void Sender_Init();
 void Sender_Final();
 
 /* event handler, called when a message is passed from the upper layer at the 
-   sender */
-void Sender_FromUpperLayer(struct message *msg);
+   sender.  deadline is the simulation time after which the message is worthless
+   (0 means it never expires) and max_retransmit bounds the retransmissions of 
+   each of its packets (-1 means unlimited).  expired packets are abandoned and 
+   the receiver is told to skip over them.
+   return true if the message is accepted, return false if the rdt layer has 
+   no room for it; the upper layer should then hold the message until 
+   Sender_UpperLayerWritable() is called. */
+bool Sender_FromUpperLayer(struct message *msg, double deadline = 0, int max_retransmit = -1);
 
 /* event handler, called when a packet is passed from the lower layer at the 
    sender */
@@ -61,4 +86,34 @@ void Sender_FromLowerLayer(struct packet *pkt);
 void Sender_Timeout();
 
 
+/*[]------------------------------------------------------------------------[]
+  |  routines for drivers running several senders
+  []------------------------------------------------------------------------[]*/
+
+/* the state of a sender, for drivers running several of them.  the running
+   sender's state is the one the handlers above work on; Sender_SwapState()
+   exchanges it with the one in s, so the state saved in s starts running
+   and the one that was running is saved in s in its place.  a new state is
+   that of a sender that has not seen any event yet.  built with
+   -DRDT_PARALLEL, each thread has its own running sender */
+struct sender_state;
+struct sender_state *Sender_NewState();
+void Sender_FreeState(struct sender_state *s);
+void Sender_SwapState(struct sender_state *s);
+
+/* the connection id the running sender stamps on its packets, for a receiver
+   serving many senders (see Receiver_Demux()).  0 is no connection, and the
+   id only goes over the link in a build with -DRDT_CONN_ID */
+void Sender_SetConnId(unsigned int id);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines for drivers with several paths
+  []------------------------------------------------------------------------[]*/
+
+/* choose how the sender spreads new packets over the paths: "minrtt" (the 
+   default), "wrr" or "redundant".  return false for an unknown scheduler */
+bool Sender_SetScheduler(const char *name);
+
+
 #endif  /* _RDT_SENDER_H_ */
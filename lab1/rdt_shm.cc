@@ -0,0 +1,489 @@
+/*
+ * FILE: rdt_shm.cc
+ * DESCRIPTION: Runs the reliable data transfer sender and receiver as two
+ *       processes exchanging packets through shared memory, in place of the
+ *       simulator.  The lower layer is a pair of the lock-free rings of
+ *       rdt_ring.h in a memfd mapping, one for each direction.  The
+ *       impairment layer sits in front of each ring.
+ * NOTE: Linux only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_host.h"
+#include "rdt_ring.h"
+
+
+/* most packets taken from the ring before the timers are checked again */
+#define MAX_DRAIN 256
+
+/* the latency of one packet in this many is recorded */
+#define LATENCY_SAMPLE_EVERY 16
+
+/* how long the sender may keep retransmitting after the run is over */
+#define DRAIN_TIMEOUT 10.0
+
+
+/*[]------------------------------------------------------------------------[]
+  |  shared memory layout
+  []------------------------------------------------------------------------[]*/
+
+/* what the receiver process reports back */
+struct shm_result {
+    struct host_stats stats;
+    long long latency_samples;
+    double latency[3];          /* p50, p99 and p99.9 */
+};
+
+struct shm_area {
+    struct ring to_receiver;
+    struct ring to_sender;
+    struct ring_waiter sender_waiter;
+    struct ring_waiter receiver_waiter;
+    alignas(CACHE_LINE) std::atomic<unsigned int> done;
+    struct shm_result receiver_result;
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  gloabal variables, statistics, etc.
+  []------------------------------------------------------------------------[]*/
+
+/* spin on the ring instead of sleeping on the futex */
+bool busy_poll = false;
+
+/* push packets through the rings as fast as possible without the rdt layer,
+   to measure the rings alone */
+bool raw_mode = false;
+
+/* the cores the sender and the receiver are pinned to, -1 for none */
+int sender_cpu = -1;
+int receiver_cpu = -1;
+
+/* whether this process is the sender or the receiver */
+bool is_sender;
+
+struct shm_area *shm = NULL;
+
+/* this process's ends of the rings, and what it sleeps on */
+struct ring_producer out_ring;
+struct ring_consumer in_ring;
+struct ring_waiter *own_waiter;
+
+/* the sender timer, -1 when it is not set */
+double sender_timer = -1;
+
+/* the impairment layer in front of this process's outgoing ring */
+Impairment *channel = NULL;
+
+/* how long the packets taken from the ring spent in it */
+std::vector<double> latency_samples;
+unsigned int pkts_taken = 0;
+
+
+/*[]------------------------------------------------------------------------[]
+  |  helpers
+  []------------------------------------------------------------------------[]*/
+
+/* the p-th percentile of the samples */
+static double percentile(std::vector<double> &samples, double p)
+{
+    if (samples.empty()) return 0;
+    size_t k = (size_t)(p*(samples.size()-1));
+    std::nth_element(samples.begin(), samples.begin()+k, samples.end());
+    return samples[k];
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  transport routines
+  []------------------------------------------------------------------------[]*/
+
+static struct host_stats *own_stats()
+{
+    return is_sender ? &sender_stats : &receiver_stats;
+}
+
+/* start the sender timer with a specified timeout (in seconds).
+   the timer is cancelled with Sender_StopTimer() is called or a new
+   Sender_StartTimer() is called before the current timer expires.
+   Sender_Timeout() will be called when the timer expires. */
+void Sender_StartTimer(double timeout)
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.6fs (Sender): the timer is started (expires at %.6fs).\n",
+		GetSimulationTime(), GetSimulationTime() + timeout);
+
+    sender_timer = GetSimulationTime() + timeout;
+}
+
+/* stop the sender timer */
+void Sender_StopTimer()
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.6fs (Sender): the timer is stopped.\n",
+		GetSimulationTime());
+
+    sender_timer = -1;
+}
+
+/* check whether the sender timer is being set,
+   return true if the timer is set, return false otherwise */
+bool Sender_isTimerSet()
+{
+    return sender_timer>=0;
+}
+
+static void push_out(const struct packet *pkt, int size)
+{
+    if (!ring_push(&out_ring, pkt, size, GetSimulationTime()))
+	own_stats()->pkts_dropped ++;
+}
+
+static void to_lower_layer(struct packet *pkt, int size)
+{
+    struct packet out;
+    if (channel->pass(pkt, size, GetSimulationTime(), &out))
+	push_out(&out, size);
+}
+
+/* pass a packet to the lower layer at the sender, only the first size bytes
+   of the packet are carried over the link */
+void Sender_ToLowerLayer(struct packet *pkt, int size)
+{
+    to_lower_layer(pkt, size);
+}
+
+/* pass a packet to the lower layer at the receiver, only the first size bytes
+   of the packet are carried over the link */
+void Receiver_ToLowerLayer(struct packet *pkt, int size)
+{
+    to_lower_layer(pkt, size);
+}
+
+/* no packet is ever marked congestion experienced */
+bool Receiver_isCongestionMarked()
+{
+    return false;
+}
+
+/* pass the packets published in the incoming ring to the rdt layer, return
+   how many there were */
+static int receive_packets()
+{
+    struct ring_slot *slot;
+    int n = 0;
+    while (n<MAX_DRAIN && (slot = ring_peek(&in_ring))!=NULL) {
+	struct packet pkt;
+	int size = slot->size;
+	if (pkts_taken++ % LATENCY_SAMPLE_EVERY==0)
+	    latency_samples.push_back(GetSimulationTime() - slot->sent_time);
+	memcpy(pkt.data, slot->pkt.data, size);
+	in_ring.tail ++;
+	n ++;
+
+	/* the rest of the packet handed to the rdt layer is zeroed */
+	memset(&pkt.data[size], 0, RDT_PKTSIZE-size);
+	own_stats()->pkts_received ++;
+	if (tracing_level>=1)
+	    fprintf(stdout, "Time %.6fs (%s): the lower layer informs the rdt layer that a packet is received from the link.\n",
+		    GetSimulationTime(), is_sender ? "Sender" : "Receiver");
+	if (is_sender)
+	    Sender_FromLowerLayer(&pkt);
+	else
+	    Receiver_FromLowerLayer(&pkt);
+    }
+    if (n>0)
+	ring_release(&in_ring);
+    return n;
+}
+
+/* the earlier of two deadlines, -1 standing for none */
+static double earlier(double a, double b)
+{
+    if (a<0) return b;
+    if (b<0) return a;
+    return std::min(a, b);
+}
+
+/* the event loop of either process.  the sender passes messages to the rdt
+   layer for run_time seconds and stops once every packet is acknowledged,
+   the receiver stops when the sender is done */
+static void run_side()
+{
+    bool generating = is_sender;
+    for (;;) {
+	int received = receive_packets();
+
+	double now = GetSimulationTime();
+	if (sender_timer>=0 && now>=sender_timer) {
+	    if (tracing_level>=1)
+		fprintf(stdout, "Time %.6fs (Sender): the timer expires.\n", now);
+	    sender_timer = -1;
+	    Sender_Timeout();
+	}
+
+	struct packet pkt;
+	int size;
+	while (channel->release(now, &pkt, &size))
+	    push_out(&pkt, size);
+
+	double due = generating ? host_feed_sender() : -1;
+	if (due<0) generating = false;
+	ring_publish(&out_ring, busy_poll);
+
+	now = GetSimulationTime();
+	if (is_sender && !generating) {
+	    /* done once nothing is left in flight */
+	    if (sender_timer<0 && channel->next_release()<0)
+		break;
+	    if (now>run_time+DRAIN_TIMEOUT) {
+		fprintf(stdout, "Time %.6fs (Sender): gave up waiting for the last acknowledgements.\n", now);
+		break;
+	    }
+	}
+	if (!is_sender && shm->done.load(std::memory_order_acquire))
+	    break;
+
+	if (received==0 && (due<0 || due>now)) {
+	    double deadline = earlier(sender_timer, channel->next_release());
+	    deadline = earlier(deadline, due);
+	    if (is_sender && !generating)
+		deadline = earlier(deadline, run_time+DRAIN_TIMEOUT);
+	    ring_wait(own_waiter, &in_ring, 1, &shm->done, deadline, busy_poll);
+	}
+    }
+}
+
+/* push numbered packets through the ring for run_time seconds, bypassing the
+   rdt layer, and count them at the other side */
+static void run_raw()
+{
+    struct packet pkt;
+    memset(&pkt, 0, sizeof(pkt));
+    unsigned int next = 0;
+
+    if (is_sender) {
+	while (GetSimulationTime()<run_time) {
+	    int pushed = 0;
+	    double now = GetSimulationTime();
+	    for (; pushed<MAX_DRAIN; pushed++) {
+		memcpy(pkt.data, &next, sizeof(next));
+		if (!ring_push(&out_ring, &pkt, RDT_PKTSIZE, now)) break;
+		sender_stats.pkts_sent ++;
+		sender_stats.bytes_sent += RDT_PKTSIZE;
+		next ++;
+	    }
+	    ring_publish(&out_ring, busy_poll);
+	    /* the ring is full, let the receiver catch up */
+	    if (pushed<MAX_DRAIN) {
+		if (busy_poll) cpu_relax();
+		else sched_yield();
+	    }
+	}
+	return;
+    }
+
+    for (;;) {
+	struct ring_slot *slot;
+	int n = 0;
+	while (n<MAX_DRAIN && (slot = ring_peek(&in_ring))!=NULL) {
+	    if (pkts_taken++ % LATENCY_SAMPLE_EVERY==0)
+		latency_samples.push_back(GetSimulationTime() - slot->sent_time);
+	    unsigned int seq;
+	    memcpy(&seq, slot->pkt.data, sizeof(seq));
+	    if (seq!=next)
+		receiver_stats.verification_passed = false;
+	    next ++;
+	    in_ring.tail ++;
+	    n ++;
+	}
+	if (n>0) {
+	    ring_release(&in_ring);
+	    receiver_stats.pkts_received += n;
+	    continue;
+	}
+	if (shm->done.load(std::memory_order_acquire) && ring_peek(&in_ring)==NULL)
+	    break;
+	ring_wait(own_waiter, &in_ring, 1, &shm->done, -1, busy_poll);
+    }
+}
+
+static void pin_to(int cpu)
+{
+    if (cpu<0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)!=0)
+	perror("sched_setaffinity");
+}
+
+/* set up the process-local ends of the rings and the impairment layer */
+static void setup_process(struct ring *out, struct ring_waiter *peer, struct ring *in,
+			  struct ring_waiter *own, int cpu)
+{
+    pin_to(cpu);
+    ring_attach(&out_ring, out, peer);
+    ring_attach(&in_ring, in);
+    own_waiter = own;
+    channel = new Impairment(own_stats(), getpid());
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main control routine
+  []------------------------------------------------------------------------[]*/
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+	{"reorder-delay", required_argument, NULL, 'l'},
+	{"busy-poll", no_argument, NULL, 'p'},
+	{"cpus", required_argument, NULL, 'c'},
+	{"raw", no_argument, NULL, 'R'},
+	{NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:pc:R", long_options, NULL)) != -1) {
+	switch (opt) {
+	case 'l':
+	    reorder_delay = atof(optarg);
+	    if (reorder_delay<0) {
+		fprintf(stderr, "invalid <reorder_delay>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'p':
+	    busy_poll = true;
+	    break;
+	case 'c':
+	    if (sscanf(optarg, "%d,%d", &sender_cpu, &receiver_cpu)!=2 ||
+		sender_cpu<0 || receiver_cpu<0) {
+		fprintf(stderr, "invalid <sender_cpu>,<receiver_cpu>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'R':
+	    raw_mode = true;
+	    break;
+	default:
+	    argc = 0;
+	    break;
+	}
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    host_parse_workload(argc, argv, "[-l <reorder_delay>] [-p] [-c <sender_cpu>,<receiver_cpu>] [-R] ");
+    char backend[256];
+    snprintf(backend, sizeof(backend),
+	     "\t%s while waiting for packets%s\n"
+	     "\tsender on cpu %d, receiver on cpu %d (-1 is not pinned)\n",
+	     busy_poll ? "busy-polling" : "sleeping on a futex",
+	     raw_mode ? ", raw rings without the rdt layer" : "",
+	     sender_cpu, receiver_cpu);
+    host_confirm_workload("Reliable data transfer over shared memory rings", backend);
+
+    /* both rings live in one shared mapping, inherited by the child */
+    int fd = memfd_create("rdt_shm", MFD_CLOEXEC);
+    ASSERT(fd>=0);
+    ASSERT(ftruncate(fd, sizeof(struct shm_area))==0);
+    void *area = mmap(NULL, sizeof(struct shm_area), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT(area!=MAP_FAILED);
+    close(fd);
+    shm = new (area) struct shm_area();
+
+    host_start_clock();
+
+    pid_t pid = fork();
+    ASSERT(pid>=0);
+    if (pid==0) {
+	setup_process(&shm->to_sender, &shm->sender_waiter,
+		      &shm->to_receiver, &shm->receiver_waiter, receiver_cpu);
+	if (raw_mode) {
+	    run_raw();
+	} else {
+	    Receiver_Init();
+	    run_side();
+	    Receiver_Final();
+	}
+	fflush(stdout);
+	struct shm_result *result = &shm->receiver_result;
+	result->stats = receiver_stats;
+	result->latency_samples = latency_samples.size();
+	result->latency[0] = percentile(latency_samples, 0.5);
+	result->latency[1] = percentile(latency_samples, 0.99);
+	result->latency[2] = percentile(latency_samples, 0.999);
+	exit(0);
+    }
+
+    is_sender = true;
+    setup_process(&shm->to_receiver, &shm->receiver_waiter,
+		  &shm->to_sender, &shm->sender_waiter, sender_cpu);
+    if (raw_mode) {
+	run_raw();
+    } else {
+	Sender_Init();
+	run_side();
+	Sender_Final();
+    }
+    double elapsed = GetSimulationTime();
+    fflush(stdout);
+
+    /* tell the receiver, and wake it up if it sleeps */
+    shm->done.store(1, std::memory_order_release);
+    ring_wake(&shm->receiver_waiter);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)!=0) {
+	fprintf(stdout, "## Something is wrong! The receiver process did not report back.\n");
+	return -1;
+    }
+    struct shm_result *result = &shm->receiver_result;
+    receiver_stats = result->stats;
+
+    long long pkts_passed = sender_stats.pkts_received + receiver_stats.pkts_received;
+    if (raw_mode) {
+	fprintf(stdout, "\n");
+	fprintf(stdout, "## Raw rings ran for %.2fs with\n"
+		"\t%lld packets of %d bytes pushed, %lld taken\n"
+		"\t%.3f million packets per second, using %.3fs of CPU\n"
+		"\tpacket latency through the ring is %.2fus at p50, %.2fus at p99 and %.2fus at p99.9\n",
+		elapsed, sender_stats.pkts_sent, RDT_PKTSIZE, receiver_stats.pkts_received,
+		receiver_stats.pkts_received/elapsed/1e6, host_cpu_time(),
+		result->latency[0]*1e6, result->latency[1]*1e6, result->latency[2]*1e6);
+	if (receiver_stats.verification_passed && sender_stats.pkts_sent==receiver_stats.pkts_received) {
+	    fprintf(stdout, "## Congratulations! Every packet came through in order.\n");
+	    return 0;
+	}
+	fprintf(stdout, "## Something is wrong! Packets were lost or reordered in the rings.\n");
+	return -1;
+    }
+
+    host_report(elapsed, host_cpu_time());
+    fprintf(stdout, "\t%.3f million packets per second through the rings\n"
+	    "\tpacket latency through the ring is %.2fus at p50, %.2fus at p99 and %.2fus at p99.9 to the receiver,\n"
+	    "\t%.2fus at p50, %.2fus at p99 and %.2fus at p99.9 back to the sender\n",
+	    pkts_passed/elapsed/1e6,
+	    result->latency[0]*1e6, result->latency[1]*1e6, result->latency[2]*1e6,
+	    percentile(latency_samples, 0.5)*1e6, percentile(latency_samples, 0.99)*1e6,
+	    percentile(latency_samples, 0.999)*1e6);
+    return host_verdict();
+}
@@ -10,13 +10,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dlfcn.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 #include "rdt_struct.h"
+#include "rdt_packet.h"
 #include "rdt_sender.h"
 #include "rdt_receiver.h"
+#include "rdt_coro.h"
+#include "rdt_channel.h"
+#include "rdt_workload.h"
+#include "rdt_hash.h"
+#include "rdt_profile.h"
+#include "rdt_plugin.h"
+#include "rdt_duplex.h"
 
 
 /*[]------------------------------------------------------------------------[]
@@ -41,11 +60,13 @@ class EventChain
 public:
     double sim_time;        /* simulation time */
     Event *head;            /* head event in the chain */
+    int length;             /* events in the chain */
 
 public:
     EventChain() {
 	sim_time = 0;
 	head = NULL;
+	length = 0;
     }
     
     double time() { return sim_time; }
@@ -53,6 +74,7 @@ public:
     /* schedule an event - the event chain is maintained on an increasing order 
        of sched_time */
     void schedule(Event *e) {
+	PROFILE(PROF_SCHEDULE);
 	/* do nothing if the event is schedule for the past */
 	if (e->sched_time<sim_time) return;
 
@@ -62,6 +84,8 @@ public:
 
 	e->next = *ppcur;
 	*ppcur = e;
+	length ++;
+	PROFILE_PEAK(PROF_PEAK_EVENTS, length);
     }
 
     /* cancel an event scheduled for happening in the future */
@@ -70,15 +94,20 @@ public:
 	while ((*ppcur!=NULL) && (*ppcur!=e))
 	    ppcur = &((*ppcur)->next);
 
-	if (*ppcur==e) *ppcur=(*ppcur)->next;
+	if (*ppcur==e) {
+	    *ppcur=(*ppcur)->next;
+	    length --;
+	}
     }
 
     /* advance to the next event */
     Event *next_event() {
+	PROFILE(PROF_NEXT_EVENT);
 	if (head==NULL) return NULL;
 
 	Event *e = head;
 	head = head->next;
+	length --;
 	sim_time = e->sched_time;
 
 	return e;
@@ -91,14 +120,17 @@ public:
   []------------------------------------------------------------------------[]*/
 
 enum {EVENT_SENDER_FROMUPPERLAYER=0, EVENT_SENDER_FROMLOWERLAYER, 
-      EVENT_SENDER_TIMEOUT, EVENT_RECEIVER_FROMLOWERLAYER};
+      EVENT_SENDER_TIMEOUT, EVENT_RECEIVER_FROMLOWERLAYER, EVENT_COROUTINE_RESUME,
+      EVENT_END_FROMLOWERLAYER, EVENT_ACK_DELAY};
 
 /* the event that the upper layer at the sender instructs rdt layer to send out 
    a message */
 class EventSenderFromUpperLayer : public Event
 {
 public:
-    EventSenderFromUpperLayer() { event_type = EVENT_SENDER_FROMUPPERLAYER; }
+    int conn;               /* the connection, 1 for the other way (see ack_delay) */
+public:
+    EventSenderFromUpperLayer() { event_type = EVENT_SENDER_FROMUPPERLAYER; conn = 0; }
 };
 
 /* the event that the lower layer at the sender informs the rdt layer that a 
@@ -115,7 +147,9 @@ public:
 class EventSenderTimeout : public Event
 {
 public:
-    EventSenderTimeout() { event_type = EVENT_SENDER_TIMEOUT; }
+    int conn;
+public:
+    EventSenderTimeout() { event_type = EVENT_SENDER_TIMEOUT; conn = 0; }
 };
 
 /* the event that the lower layer at the receiver informs the rdt layer that a 
@@ -124,8 +158,41 @@ class EventReceiverFromLowerLayer : public Event
 {
 public:
     struct packet pkt;
+    bool marked;            /* congestion experienced in the link queue */
+    int path;               /* the path it has taken (see Sender_ToPath()) */
 public:
-    EventReceiverFromLowerLayer() { event_type = EVENT_RECEIVER_FROMLOWERLAYER; }
+    EventReceiverFromLowerLayer() { event_type = EVENT_RECEIVER_FROMLOWERLAYER; marked = false; path = 0; }
+};
+
+
+/* the event that a packet reaches an end of the link in full duplex (see
+   rdt_duplex.h) */
+class EventEndFromLowerLayer : public Event
+{
+public:
+    struct duplex_packet dp;
+    bool marked;
+public:
+    EventEndFromLowerLayer() { event_type = EVENT_END_FROMLOWERLAYER; marked = false; }
+};
+
+/* the event that the acks held at an end have waited long enough, and go 
+   out in a packet of their own */
+class EventAckDelay : public Event
+{
+public:
+    int end;
+public:
+    EventAckDelay() { event_type = EVENT_ACK_DELAY; }
+};
+
+/* the event that a coroutine of the upper layer is resumed */
+class EventCoroutineResume : public Event
+{
+public:
+    std::coroutine_handle<> handle;
+public:
+    EventCoroutineResume() { event_type = EVENT_COROUTINE_RESUME; }
 };
 
 
@@ -146,6 +213,51 @@ int msg_size;
 /* average one-way packet delivery latency, set to be 100ms */
 const double pkt_latency = 0.1;
 
+/* bandwidth of the link in each direction (in bytes per second), a packet 
+   has to wait until the ones before it have been transmitted; 0 means the 
+   link takes no time to transmit a packet */
+double link_bandwidth = 0;
+double sender_link_busy_until = 0;
+double receiver_link_busy_until = 0;
+
+/* the queue of the sender's link, and of every other path: a packet that 
+   finds more than queue_limit bytes waiting is dropped at the tail (0 means 
+   a round trip of the link, see default_queue_limit()), and one that finds 
+   more than mark_threshold bytes is marked congestion experienced (0 means 
+   never), as in ECN.  the time each packet waits is kept */
+int queue_limit = 0;
+int mark_threshold = 0;
+long long queue_drops = 0;
+long long queue_marks = 0;
+std::vector<double> queue_delays;
+
+/* whether the packet being passed to the receiver has been marked */
+bool receiving_marked = false;
+
+/* the paths between the sender and the receiver besides the link above,
+   which is path 0: each has a latency, a loss rate and a bandwidth of its own,
+   and shares the corruption and out-of-order rates of the link.  the receiver
+   answers a packet on the path it came by.  with several paths, the
+   simulation forks a process per path, with that path alone, and one with
+   them all, and compares their goodput once they are all done.  there are
+   MAX_PATHS of them at most (rdt_sender.h) */
+struct sim_path {
+    ChannelModel *channel;
+    double latency, loss_rate, bandwidth;
+    double sender_busy_until, receiver_busy_until;
+};
+std::vector<struct sim_path> paths;
+const char *scheduler = NULL;
+long long path_pkts[MAX_PATHS];
+int receiving_path = 0;
+
+/* full duplex: with an ack_delay (0 or more), the receiver's end sends
+   messages of its own to the sender's end over a second connection, and
+   the acks held at an end wait for ack_delay on the timer of that end (see
+   rdt_duplex.h) */
+double ack_delay = -1;
+Event *ack_timer[2] = {NULL, NULL};
+
 /* the probability that a packet is not delivered with the normal latency:
    a value of 0.1 means that one in ten packets are not delivered with the 
    normal latency */
@@ -160,6 +272,101 @@ double loss_rate;
    packet can be corrupted */
 double corrupt_rate;
 
+/* the impairment model of the link, the three rates above unless asked for
+   a bursty or trace-driven one: Gilbert-Elliott with ge_p and ge_r (and the
+   loss rates of the good and the bad state), outages of outage_duration
+   every outage_period, or the trace in trace_file.  its decisions can be
+   recorded to record_file, or replayed from replay_file */
+ChannelModel *channel = NULL;
+double ge_p = -1, ge_r, ge_loss_good = 0, ge_loss_bad = 1;
+double outage_period = 0, outage_duration;
+const char *trace_file = NULL;
+const char *record_file = NULL;
+const char *replay_file = NULL;
+
+/* the workload of the upper layer, uniform sizes and intervals unless asked
+   for other sizes (sizes of size_shape), other arrivals (with on and off
+   periods of on_period and off_period), or the trace in workload_file */
+Workload *workload = NULL;
+int sizes = SIZES_UNIFORM, arrivals = ARRIVALS_UNIFORM;
+double size_shape, on_period, off_period;
+const char *workload_file = NULL;
+
+/* file transfer: the upper layer at the sender passes send_file, mapped into 
+   memory, as fast as the rdt layer takes it, in messages of the sizes of the 
+   workload.  the upper layer at the receiver writes it to recv_file, mapped 
+   and sized to match, and both ends hash the stream */
+const char *send_file = NULL;
+const char *recv_file = NULL;
+char *send_map = NULL;
+char *recv_map = NULL;
+long long file_size;
+long long send_dropped = 0, recv_dropped = 0;
+struct stream_hash sent_hash, delivered_hash;
+
+/* snapshot and fork: at checkpoint_time the simulation forks a process per 
+   variant, one after the other, and each carries on from there with the 
+   changes of its variant (see variant()), sharing the warm-up before */
+double checkpoint_time = -1;
+std::vector<const char*> variants;
+
+/* print the profile of a build with -DRDT_PROFILE, and write its call paths 
+   to profile_file */
+bool profile = false;
+const char *profile_file = NULL;
+
+/* report the events handled and the wall time they took, which changes from 
+   run to run unlike the rest of the report */
+bool timing = false;
+long long tot_events = 0;
+
+/* soak mode: a checkpoint every soak_interval of simulation, reporting the
+   throughput since the one before and the resident memory.  the latency
+   samples start over at every checkpoint, so that nothing grows with the
+   length of the run; soak_msgs counts the ones let go */
+double soak_interval = 0;
+double next_soak;
+long long soak_msgs = 0;
+
+/* protocol plugins (see rdt_plugin.h): the simulation forks a process per
+   plugin of protocol_paths from the start, one after the other, each running
+   the same workload over the same channel with the sender and the receiver
+   of its plugin, and compares them once they are all done.  "builtin" stands
+   for the ones linked in, which run unless asked for plugins.  each process
+   passes back a protocol_summary through summary_fd */
+std::vector<const char*> protocol_paths;
+std::vector<const struct rdt_protocol*> protocols;
+const struct rdt_protocol *protocol;
+void *rdt_conn;
+int summary_fd = -1;
+
+struct protocol_summary {
+    double end_time;
+    long long chars_delivered;
+    long long pkts_passed;
+    long long bytes_passed;
+    double latency_p50, latency_p99;
+    double wall_time;
+    bool passed;
+};
+
+/* the random numbers: the workload draws from rand(), the channel from a
+   stream of its own, so the workload stays the same whatever the channel
+   does and however many numbers it takes */
+unsigned int seed;
+unsigned short channel_rng[3];
+
+/* partial reliability: every message expires this long after it is passed to 
+   the rdt layer (0 means never), and each of its packets is retransmitted at 
+   most msg_max_retransmit times (-1 means unlimited) */
+double msg_deadline = 0;
+int msg_max_retransmit = -1;
+
+/* messages are passed from the upper layer in bursts of this many messages, 
+   all arriving at once; bursts are spaced so that the average message arrival 
+   interval stays the same */
+int msg_burst = 1;
+
 /* tracing levels (higher level always prints out more information):
    a tracing level of 0 turns off all traces while a tracing, 
    a tracing level of 1 turns on regular traces,
@@ -167,20 +374,82 @@ double corrupt_rate;
 */
 int tracing_level;
 
+/* the upper layers are coroutines on a connection (see rdt_coro.h) instead of
+   the message arrival event and Receiver_ToUpperLayer() */
+bool coro_mode = false;
+Connection conn;
+
 /* simulation event chain core */
 EventChain sim_core;
 
-/* sender timer event */
-Event *sender_timer = NULL;
+/* sender timer event, of each connection */
+Event *sender_timer[2] = {NULL, NULL};
+
+/* a message refused by the rdt layer, and the message arrival event held back 
+   until the rdt layer can take it, or under request/response until the
+   response has been delivered */
+struct message *pending_msg = NULL;
+Event *blocked_msg_arrival = NULL;
+Event *awaiting_response = NULL;
+double blocked_since;
+double tot_blocked_time = 0;
+
+/* messages are tracked from their generation until their last byte is 
+   delivered, the end offset locates the last byte in the delivered stream */
+struct msg_track {
+    long long end_offset;
+    double gen_time;
+    bool burst_tail;
+};
+std::deque<struct msg_track> msgs_in_flight;
+double pending_msg_gen_time;
+int burst_left = 0;
+std::vector<double> msg_latency;
+std::vector<double> tail_msg_latency;
 
 /* general statistics */
-int tot_chars_sent = 0;
-int tot_chars_delivered = 0;
-int tot_pkts_passed = 0;
+long long tot_chars_sent = 0;
+long long tot_chars_delivered = 0;
+long long tot_pkts_passed = 0;
+long long tot_bytes_passed = 0;
+
+/* the messages are the keystream of stream_key: the offset in the stream of
+   the next message generated, and of the next byte to be verified */
+uint64_t stream_key;
+long long stream_generated = 0;
+long long stream_verified = 0;
 
 /* error flag set by message verification at the receiver */
 bool message_verfication_passed = true;
 
+/* gaps in the delivered stream left by messages abandoned under partial 
+   reliability */
+long long tot_gaps_skipped = 0;
+
+/* under partial reliability, the offsets in the stream of the messages
+   generated from the one being verified on, where the packets that may
+   resume the stream after a gap start */
+std::deque<long long> msg_starts;
+
+/* the upper layers of connection 1 in full duplex, as those above: its
+   messages are the keystream of rev_key, and under request/response each is
+   the response to a request, passed as soon as the request is delivered.
+   the next request waits for the whole response, and the latency of an
+   exchange runs from the request to its response */
+uint64_t rev_key;
+long long rev_generated = 0;
+long long rev_verified = 0;
+long long rev_chars_sent = 0;
+long long rev_chars_delivered = 0;
+struct message *rev_pending_msg = NULL;
+double rev_pending_gen_time;
+Event *rev_blocked_msg_arrival = NULL;
+bool responding = false;
+double request_time;
+std::deque<struct msg_track> rev_msgs_in_flight;
+std::vector<double> rev_msg_latency;
+bool rev_verification_passed = true;
+
 
 /*[]------------------------------------------------------------------------[]
   |  simulation routines
@@ -192,33 +461,197 @@ static double myrandom()
     return(rand()*1.0/RAND_MAX);
 }
 
+/* the random numbers of the workloads */
+double Workload_Random()
+{
+    return myrandom();
+}
+
+/* the random numbers of the impairment models */
+double Channel_Random()
+{
+    return erand48(channel_rng);
+}
+
 /* generate a message 
    NOTE: change this part if you want to generate different messages for 
          testing.  we will certainly use different messages in our grading! */
 static struct message *generate_msg()
 {
-    static char cnt = 0;
-
     struct message *msg = (struct message*) malloc(sizeof(struct message));
     ASSERT(msg!=NULL);
-    msg->size = (int)(myrandom()*2.0*msg_size);
-    if (msg->size==0) msg->size=1;
+    msg->size = workload->size();
+
+    /* the next piece of the file, right where it is mapped */
+    if (send_map!=NULL) {
+	msg->size = (int) std::min((long long) msg->size, file_size - stream_generated);
+	msg->data = send_map + stream_generated;
+	hash_update(&sent_hash, msg->data, msg->size);
+	stream_generated += msg->size;
+	return msg;
+    }
+
     msg->data = (char*) malloc(msg->size);
     ASSERT(msg->data!=NULL);
 
-    for (int i=0; i<msg->size; i+=1) {
-	msg->data[i] = '0' + cnt;
-	cnt = (cnt+1) % 10;
+    Keystream_Fill(stream_key, stream_generated, msg->data, msg->size);
+    if (msg_deadline>0 || msg_max_retransmit>=0)
+	msg_starts.push_back(stream_generated);
+    stream_generated += msg->size;
+
+    return msg;
+}
+
+/* drop the pages of a file mapping that are done with, a window behind 
+   offset, which is where the file is being read or written */
+static void drop_behind(char *map, long long offset, long long *dropped)
+{
+    if (offset - *dropped < 2*TRACE_WINDOW) return;
+    long long page = sysconf(_SC_PAGESIZE);
+    long long upto = (offset - TRACE_WINDOW)/page*page;
+    madvise(map + *dropped, upto - *dropped, MADV_DONTNEED);
+    *dropped = upto;
+}
+
+/* whether the upper layer at the sender has more to pass */
+static bool more_to_send()
+{
+    return sim_core.time() < sim_time && (send_map==NULL || stream_generated<file_size);
+}
+
+/* the time until the next message at the sender, none within a burst or in 
+   a file transfer */
+static double next_interval()
+{
+    if (burst_left>0 || send_map!=NULL) return 0;
+    return msg_burst*workload->interval(sim_core.time());
+}
+
+/* map the files of a file transfer, the one to be received as large as the 
+   one to be sent */
+static void map_files()
+{
+    int fd = open(send_file, O_RDONLY);
+    struct stat st;
+    if (fd<0 || fstat(fd, &st)<0) {
+	perror(send_file);
+	exit(-1);
     }
+    file_size = st.st_size;
+    if (file_size==0) {
+	fprintf(stderr, "%s: nothing to send\n", send_file);
+	exit(-1);
+    }
+    send_map = (char*) mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (send_map==MAP_FAILED) {
+	perror(send_file);
+	exit(-1);
+    }
+    madvise(send_map, file_size, MADV_SEQUENTIAL);
+    close(fd);
+    hash_init(&sent_hash, 0);
+    hash_init(&delivered_hash, 0);
+
+    if (recv_file==NULL) return;
+    fd = open(recv_file, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (fd<0 || ftruncate(fd, file_size)<0) {
+	perror(recv_file);
+	exit(-1);
+    }
+    recv_map = (char*) mmap(NULL, file_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (recv_map==MAP_FAILED) {
+	perror(recv_file);
+	exit(-1);
+    }
+    madvise(recv_map, file_size, MADV_SEQUENTIAL);
+    close(fd);
+}
 
-    tot_chars_sent += msg->size;
+/* unmap the files of a file transfer, cutting the received one down to what 
+   has been delivered */
+static void unmap_files()
+{
+    munmap(send_map, file_size);
+    if (recv_map==NULL) return;
+    munmap(recv_map, file_size);
+    if (truncate(recv_file, tot_chars_delivered)<0)
+	perror(recv_file);
+}
 
-    return msg;
+/* check a variant, a comma-separated list of loss=, corrupt=, outoforder= 
+   and bandwidth= with new values and seed= to draw the channel afresh, and 
+   apply it if asked to */
+static bool variant(const char *spec, bool apply)
+{
+    double loss = loss_rate, corrupt = corrupt_rate, outoforder = outoforder_rate;
+    double bandwidth = link_bandwidth;
+    long long new_seed = -1;
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *item = strtok(buf, ","); item!=NULL; item = strtok(NULL, ",")) {
+	double v;
+	if (sscanf(item, "loss=%lf", &v)==1 && v>=0 && v<=1)
+	    loss = v;
+	else if (sscanf(item, "corrupt=%lf", &v)==1 && v>=0 && v<=1)
+	    corrupt = v;
+	else if (sscanf(item, "outoforder=%lf", &v)==1 && v>=0 && v<=1)
+	    outoforder = v;
+	else if (sscanf(item, "bandwidth=%lf", &v)==1 && v>=0)
+	    bandwidth = v;
+	else if (sscanf(item, "seed=%lf", &v)==1 && v>=0)
+	    new_seed = (long long) v;
+	else
+	    return false;
+    }
+    if (!apply) return true;
+
+    loss_rate = loss;
+    corrupt_rate = corrupt;
+    outoforder_rate = outoforder;
+    channel->set_rates(loss, corrupt, outoforder);
+    link_bandwidth = bandwidth;
+    if (new_seed>=0) {
+	channel_rng[1] = new_seed & 0xffff;
+	channel_rng[2] = (new_seed >> 16) & 0xffff;
+    }
+    return true;
+}
+
+/* fork a process per variant at the checkpoint, the parent only waits for 
+   each in turn and never returns */
+static void fork_variants()
+{
+    for (size_t i=0; i<variants.size(); i++) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid<0) {
+	    perror("fork");
+	    exit(-1);
+	}
+	if (pid==0) {
+	    fprintf(stdout, "\n## Variant %zu from %.2fs: %s\n", i+1, sim_core.time(), 
+		    variants[i][0]!='\0' ? variants[i] : "as given");
+	    variant(variants[i], true);
+	    return;
+	}
+	int status;
+	if (waitpid(pid, &status, 0)<0 || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+	    fprintf(stdout, "## Variant %zu did not complete\n", i+1);
+    }
+    fprintf(stdout, "\n## %zu variants forked at %.2fs\n", variants.size(), sim_core.time());
+    exit(0);
 }
 
 /* free the space of a message */
 static void free_msg(struct message *msg)
 {
+    if (send_map!=NULL) {
+	/* the rdt layer has copied the piece, its pages can go */
+	drop_behind(send_map, stream_generated, &send_dropped);
+	free(msg);
+	return;
+    }
     if (msg->data!=NULL) free(msg->data);
     if (msg!=NULL) free(msg);
 }
@@ -239,17 +672,19 @@ void Sender_StartTimer(double timeout)
 	fprintf(stdout, "Time %.2fs (Sender): the timer is started (expires at %.2fs).\n",
 		sim_core.time(), sim_core.time() + timeout);
 
-    if (sender_timer!=NULL) {
-	sim_core.cancel(sender_timer);
-	delete sender_timer;
-	sender_timer = NULL;
+    Event **timer = &sender_timer[running_conn];
+    if (*timer!=NULL) {
+	sim_core.cancel(*timer);
+	delete *timer;
+	*timer = NULL;
     }
 
     EventSenderTimeout *e = new EventSenderTimeout;
     e->sched_time = sim_core.time() + timeout;
+    e->conn = running_conn;
     sim_core.schedule(e);
 
-    sender_timer = e;
+    *timer = e;
 }
 
 /* stop the sender timer */
@@ -259,10 +694,11 @@ void Sender_StopTimer()
 	fprintf(stdout, "Time %.2fs (Sender): the timer is stopped.\n", 
 		sim_core.time());
 
-    if (sender_timer!=NULL) {
-	sim_core.cancel(sender_timer);
-	delete sender_timer;
-	sender_timer = NULL;
+    Event **timer = &sender_timer[running_conn];
+    if (*timer!=NULL) {
+	sim_core.cancel(*timer);
+	delete *timer;
+	*timer = NULL;
     }
 }
 
@@ -270,81 +706,824 @@ void Sender_StopTimer()
    return true if the timer is set, return false otherwise */
 bool Sender_isTimerSet()
 {
-    return (sender_timer!=NULL);
+    return (sender_timer[running_conn]!=NULL);
 }
 
-/* pass a packet to the lower layer at the sender */
-void Sender_ToLowerLayer(struct packet *pkt)
+/* tell the upper layer that a message refused by Sender_FromUpperLayer() 
+   can be passed again */
+void Sender_UpperLayerWritable()
 {
-    /* packet lost at rate "loss_rate" */
-    if (myrandom()<loss_rate) return;
-
-    EventReceiverFromLowerLayer *e = new EventReceiverFromLowerLayer;
-    memcpy(&e->pkt.data, pkt->data, RDT_PKTSIZE);
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Sender): the rdt layer is writable again.\n",
+		sim_core.time());
 
-    /* packet corrupted at rate "corrupt_rate" */
-    if (myrandom()<corrupt_rate) {
-	for (int i=0; i<RDT_PKTSIZE; i++) {
-	    e->pkt.data[i] = e->pkt.data[i] + (char)(myrandom()*20) - 10;
+    if (coro_mode) {
+	conn.writable();
+	return;
+    }
+    if (running_conn==1) {
+	if (rev_blocked_msg_arrival!=NULL) {
+	    rev_blocked_msg_arrival->sched_time = sim_core.time();
+	    sim_core.schedule(rev_blocked_msg_arrival);
+	    rev_blocked_msg_arrival = NULL;
 	}
+	return;
+    }
+    if (blocked_msg_arrival!=NULL) {
+	blocked_msg_arrival->sched_time = sim_core.time();
+	sim_core.schedule(blocked_msg_arrival);
+	blocked_msg_arrival = NULL;
+	tot_blocked_time += sim_core.time() - blocked_since;
+    }
+}
+
+/* occupy a link of the given bandwidth for the transmission of a packet of 
+   the given size, return the time its last byte leaves the link */
+static double transmit_on_link(int size, double bandwidth, double *busy_until)
+{
+    if (bandwidth<=0) return sim_core.time();
+
+    double start = std::max(sim_core.time(), *busy_until);
+    *busy_until = start + size/bandwidth;
+    return *busy_until;
+}
+
+/* the queue of a link without -Q: what the link carries in a round trip, 
+   but room for 8 full packets at least.  without any limit, retransmissions 
+   would pile up in front of a slow link for ever */
+static int default_queue_limit(double bandwidth)
+{
+    return std::max((int)(2*pkt_latency*bandwidth), 8*RDT_PKTSIZE);
+}
+
+/* queue a packet of the given size for a sender's link of the given 
+   bandwidth, behind the bytes still waiting for it.  return false if the 
+   packet is dropped at the tail, and tell whether it is marked */
+static bool enqueue_on_link(int size, double bandwidth, double busy_until, bool *marked)
+{
+    *marked = false;
+    if (bandwidth<=0) return true;
+
+    double backlog = std::max(busy_until - sim_core.time(), 0.0)*bandwidth;
+    int limit = queue_limit>0 ? queue_limit : default_queue_limit(bandwidth);
+    if (backlog + size > limit) {
+	queue_drops ++;
+	return false;
+    }
+    *marked = mark_threshold>0 && backlog > mark_threshold;
+    queue_marks += *marked;
+    queue_delays.push_back(backlog/bandwidth);
+    return true;
+}
+
+/* pass a packet to the lower layer at the sender, only the first size bytes 
+   of the packet are carried over the link */
+void Sender_ToLowerLayer(struct packet *pkt, int size)
+{
+    ASSERT(size>0 && size<=RDT_PKTSIZE);
+    if (ack_delay>=0) {
+	Duplex_ToLowerLayer(true, pkt, size);
+	return;
     }
+    bool marked;
+    if (!enqueue_on_link(size, link_bandwidth, sender_link_busy_until, &marked)) return;
+
+    /* the packet occupies the link even if it gets lost */
+    double departure = transmit_on_link(size, link_bandwidth, &sender_link_busy_until);
+
+    /* packet lost, by default at rate "loss_rate" */
+    if (channel->lose(departure, CHANNEL_TO_RECEIVER)) return;
+
+    EventReceiverFromLowerLayer *e = new EventReceiverFromLowerLayer;
+    memcpy(&e->pkt.data, pkt->data, size);
+    memset(&e->pkt.data[size], 0, RDT_PKTSIZE-size);
+    e->marked = marked;
+
+    /* packet corrupted, by default at rate "corrupt_rate" */
+    if (channel->corrupt(departure, CHANNEL_TO_RECEIVER))
+	channel->corrupt_bytes(e->pkt.data, size, CHANNEL_TO_RECEIVER);
 
     /* schedule the packet arrival event at the other side */
-    if (myrandom()<outoforder_rate)
-	e->sched_time = sim_core.time() + pkt_latency*2.0*myrandom();
-    else
-	e->sched_time = sim_core.time() + pkt_latency;
+    e->sched_time = departure + channel->latency(departure, CHANNEL_TO_RECEIVER);
     sim_core.schedule(e);
 
     tot_pkts_passed ++;
+    tot_bytes_passed += size;
 }
 
 
-/* pass a packet to the lower layer at the receiver */
-void Receiver_ToLowerLayer(struct packet *pkt)
+/* the number of paths between the sender and the receiver */
+int Sender_NumPaths()
 {
-    /* packet lost at rate "loss_rate" */
-    if (myrandom()<loss_rate) return;
+    return 1 + paths.size();
+}
 
-    EventSenderFromLowerLayer *e = new EventSenderFromLowerLayer;
-    memcpy(&e->pkt.data, pkt->data, RDT_PKTSIZE);
+/* pass a packet to the lower layer at the sender over the given path, path 0 
+   being the link of Sender_ToLowerLayer() */
+void Sender_ToPath(int path, struct packet *pkt, int size)
+{
+    ASSERT(path>=0 && path<Sender_NumPaths());
+    path_pkts[path] ++;
+    if (path==0) {
+	Sender_ToLowerLayer(pkt, size);
+	return;
+    }
 
-    /* packet corrupted at rate "corrupt_rate" */
-    if (myrandom()<corrupt_rate) {
-	for (int i=0; i<RDT_PKTSIZE; i++) {
-	    e->pkt.data[i] = e->pkt.data[i] + (char)(myrandom()*20) - 10;
-	}
+    ASSERT(size>0 && size<=RDT_PKTSIZE);
+    struct sim_path *p = &paths[path-1];
+    bool marked;
+    if (!enqueue_on_link(size, p->bandwidth, p->sender_busy_until, &marked)) return;
+    double departure = transmit_on_link(size, p->bandwidth, &p->sender_busy_until);
+    if (p->channel->lose(departure, CHANNEL_TO_RECEIVER)) return;
+
+    EventReceiverFromLowerLayer *e = new EventReceiverFromLowerLayer;
+    memcpy(&e->pkt.data, pkt->data, size);
+    memset(&e->pkt.data[size], 0, RDT_PKTSIZE-size);
+    e->marked = marked;
+    e->path = path;
+    if (p->channel->corrupt(departure, CHANNEL_TO_RECEIVER))
+	p->channel->corrupt_bytes(e->pkt.data, size, CHANNEL_TO_RECEIVER);
+    e->sched_time = departure + p->channel->latency(departure, CHANNEL_TO_RECEIVER);
+    sim_core.schedule(e);
+
+    tot_pkts_passed ++;
+    tot_bytes_passed += size;
+}
+
+/* pass a packet to the lower layer at the receiver, only the first size bytes 
+   of the packet are carried over the link, or over the path the packet being
+   received has taken */
+void Receiver_ToLowerLayer(struct packet *pkt, int size)
+{
+    ASSERT(size>0 && size<=RDT_PKTSIZE);
+    if (ack_delay>=0) {
+	Duplex_ToLowerLayer(false, pkt, size);
+	return;
+    }
+    ChannelModel *link = channel;
+    double bandwidth = link_bandwidth, *busy_until = &receiver_link_busy_until;
+    if (receiving_path>0) {
+	struct sim_path *p = &paths[receiving_path-1];
+	link = p->channel;
+	bandwidth = p->bandwidth;
+	busy_until = &p->receiver_busy_until;
     }
+    /* the packet occupies the link even if it gets lost */
+    double departure = transmit_on_link(size, bandwidth, busy_until);
+
+    /* packet lost, by default at rate "loss_rate" */
+    if (link->lose(departure, CHANNEL_TO_SENDER)) return;
+
+    EventSenderFromLowerLayer *e = new EventSenderFromLowerLayer;
+    memcpy(&e->pkt.data, pkt->data, size);
+    memset(&e->pkt.data[size], 0, RDT_PKTSIZE-size);
+
+    /* packet corrupted, by default at rate "corrupt_rate" */
+    if (link->corrupt(departure, CHANNEL_TO_SENDER))
+	link->corrupt_bytes(e->pkt.data, size, CHANNEL_TO_SENDER);
 
     /* schedule the packet arrival event at the other side */
-    if (myrandom()<outoforder_rate)
-	e->sched_time = sim_core.time() + pkt_latency*2.0*myrandom();
-    else
-	e->sched_time = sim_core.time() + pkt_latency;	
+    e->sched_time = departure + link->latency(departure, CHANNEL_TO_SENDER);
+    sim_core.schedule(e);
+
+    tot_pkts_passed ++;
+    tot_bytes_passed += size;
+}
+
+/* check whether the packet being passed to the receiver has been marked
+   congestion experienced in the queue of the link */
+bool Receiver_isCongestionMarked()
+{
+    return receiving_marked;
+}
+
+/* resume a suspended coroutine from the event chain at time when */
+void Coro_Schedule(std::coroutine_handle<> h, double when)
+{
+    EventCoroutineResume *e = new EventCoroutineResume;
+    e->handle = h;
+    e->sched_time = when;
     sim_core.schedule(e);
+}
+
+/* carry a packet over the link from an end in full duplex, the receiver's
+   end with a link of the same bandwidth, without a queue limit as in
+   simplex */
+void Duplex_ToLink(struct duplex_packet *dp)
+{
+    int e = dp->from;
+    int wire_size = dp->wire.size();
+    bool marked = false;
+    double *busy_until = e==0 ? &sender_link_busy_until : &receiver_link_busy_until;
+    if (e==0 && !enqueue_on_link(wire_size, link_bandwidth, *busy_until, &marked))
+	return;
+    double departure = transmit_on_link(wire_size, link_bandwidth, busy_until);
+    int dir = e==0 ? CHANNEL_TO_RECEIVER : CHANNEL_TO_SENDER;
+    if (channel->lose(departure, dir))
+	return;
+    if (channel->corrupt(departure, dir))
+	channel->corrupt_bytes(dp->wire.data(), wire_size, dir);
+
+    EventEndFromLowerLayer *ev = new EventEndFromLowerLayer;
+    ev->dp.from = e;
+    ev->dp.data_size = dp->data_size;
+    ev->dp.wire.swap(dp->wire);
+    ev->dp.ack_sizes.swap(dp->ack_sizes);
+    ev->marked = marked;
+    ev->sched_time = departure + channel->latency(departure, dir);
+    sim_core.schedule(ev);
 
     tot_pkts_passed ++;
+    tot_bytes_passed += wire_size;
+}
+
+/* start the timer of the acks held at an end in full duplex */
+void Duplex_StartAckTimer(int end, double timeout)
+{
+    EventAckDelay *e = new EventAckDelay;
+    e->end = end;
+    e->sched_time = sim_core.time() + timeout;
+    sim_core.schedule(e);
+    ack_timer[end] = e;
+}
+
+/* stop the timer of the acks held at an end in full duplex */
+void Duplex_StopAckTimer(int end)
+{
+    if (ack_timer[end]==NULL) return;
+    sim_core.cancel(ack_timer[end]);
+    delete ack_timer[end];
+    ack_timer[end] = NULL;
+}
+
+/* pass a data packet that has reached an end in full duplex to the running
+   receiver */
+void Duplex_ReceiverFromLowerLayer(struct packet *pkt, bool marked)
+{
+    receiving_marked = marked;
+    protocol->receiver_from_lower_layer(rdt_conn, pkt);
+    receiving_marked = false;
+}
+
+/* pass an ack that has reached an end in full duplex to the running sender */
+void Duplex_SenderFromLowerLayer(struct packet *pkt)
+{
+    protocol->sender_from_lower_layer(rdt_conn, pkt);
 }
 
-/* deliver a message to the upper layer at the receiver 
+/* the offset past stream_verified where a message delivered after a gap
+   resumes the stream, -1 if there is none.  the sender cuts every message
+   into packets of the largest payload from its start, so only where those
+   packets start is tried, which passes every skipped packet once; a
+   protocol cutting its packets elsewhere falls back to every skipped byte.
+   the first eight bytes rule out the wrong places */
+static long long find_resume(struct message *msg)
+{
+    int probe = std::min(msg->size, 8);
+    for (size_t i=0; i<msg_starts.size(); i++) {
+	long long end = i+1<msg_starts.size() ? msg_starts[i+1] : stream_generated;
+	for (long long o=msg_starts[i]; o<end && o+msg->size<=stream_generated; o+=Layout::max_payload)
+	    if (o>stream_verified && Keystream_Match(stream_key, o, msg->data, probe) &&
+		Keystream_Match(stream_key, o, msg->data, msg->size))
+		return o;
+    }
+    for (long long o=stream_verified+1; o+msg->size<=stream_generated; o++)
+	if (Keystream_Match(stream_key, o, msg->data, probe) &&
+	    Keystream_Match(stream_key, o, msg->data, msg->size))
+	    return o;
+    return -1;
+}
+
+/* verify a message delivered at the receiver
    NOTE: change the message verification in this function if you changed 
          generate_msg() for testing. */
+static void verify_msg(struct message *msg)
+{
+    /* in a file transfer, the piece goes right where it belongs in the file, 
+       and the hashes tell in the end */
+    if (send_map!=NULL) {
+	if (stream_verified + msg->size > file_size)
+	    message_verfication_passed = false;
+	else if (recv_map!=NULL) {
+	    memcpy(recv_map + stream_verified, msg->data, msg->size);
+	    drop_behind(recv_map, stream_verified + msg->size, &recv_dropped);
+	}
+	hash_update(&delivered_hash, msg->data, msg->size);
+    }
+    /* message verification */
+    else if (!Keystream_Match(stream_key, stream_verified, msg->data, msg->size)) {
+	/* under partial reliability a message may only resume the stream 
+	   somewhere later, after the sender has abandoned some packets */
+	long long resume = -1;
+	if (msg_deadline>0 || msg_max_retransmit>=0)
+	    resume = find_resume(msg);
+	if (resume>=0) {
+	    stream_verified = resume;
+	    tot_gaps_skipped ++;
+	}
+	else
+	    message_verfication_passed = false;
+    }
+    stream_verified += msg->size;
+    while (msg_starts.size()>1 && msg_starts[1]<=stream_verified)
+	msg_starts.pop_front();
+
+    if (tracing_level>=2)
+	for (int i=0; i<msg->size; i++)
+	    fputc(isprint((unsigned char) msg->data[i]) ? msg->data[i] : '.', stdout);
+
+    tot_chars_delivered += msg->size;
+
+    while (!msgs_in_flight.empty() && 
+	   msgs_in_flight.front().end_offset<=tot_chars_delivered) {
+	double latency = sim_core.time() - msgs_in_flight.front().gen_time;
+	msg_latency.push_back(latency);
+	if (msgs_in_flight.front().burst_tail)
+	    tail_msg_latency.push_back(latency);
+	msgs_in_flight.pop_front();
+    }
+
+    /* under request/response, the next request goes out after a think time 
+       once every response is in, and reaches the sender a latency later.  in
+       full duplex, the receiver's end passes the response right away */
+    if (awaiting_response!=NULL && msgs_in_flight.empty() && ack_delay>=0) {
+	if (!responding) {
+	    responding = true;
+	    request_time = sim_core.time() - msg_latency.back();
+	    EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
+	    e->conn = 1;
+	    e->sched_time = sim_core.time();
+	    sim_core.schedule(e);
+	}
+    }
+    else if (awaiting_response!=NULL && msgs_in_flight.empty()) {
+	if (sim_core.time() < sim_time) {
+	    awaiting_response->sched_time = sim_core.time() + 
+		msg_burst*workload->interval(sim_core.time()) + pkt_latency;
+	    sim_core.schedule(awaiting_response);
+	}
+	else
+	    delete awaiting_response;
+	awaiting_response = NULL;
+    }
+}
+
+/* verify a message delivered at the sender's end in full duplex */
+static void verify_reverse_msg(struct message *msg)
+{
+    if (!Keystream_Match(rev_key, rev_verified, msg->data, msg->size))
+	rev_verification_passed = false;
+    rev_verified += msg->size;
+    rev_chars_delivered += msg->size;
+
+    while (!rev_msgs_in_flight.empty() && 
+	   rev_msgs_in_flight.front().end_offset<=rev_chars_delivered) {
+	rev_msg_latency.push_back(sim_core.time() - rev_msgs_in_flight.front().gen_time);
+	rev_msgs_in_flight.pop_front();
+    }
+
+    /* the next request goes out after a think time once the response is in */
+    if (responding && rev_msgs_in_flight.empty()) {
+	responding = false;
+	if (sim_core.time() < sim_time) {
+	    awaiting_response->sched_time = sim_core.time() + 
+		msg_burst*workload->interval(sim_core.time());
+	    sim_core.schedule(awaiting_response);
+	}
+	else
+	    delete awaiting_response;
+	awaiting_response = NULL;
+    }
+}
+
+/* the message arrival event at the receiver's end in full duplex, recurring
+   as at the sender's end, or passing the response to a request */
+static void reverse_msg_arrival(EventSenderFromUpperLayer *e)
+{
+    if (rev_pending_msg==NULL) {
+	struct message *msg = (struct message*) malloc(sizeof(struct message));
+	ASSERT(msg!=NULL);
+	msg->size = workload->size();
+	msg->data = (char*) malloc(msg->size);
+	ASSERT(msg->data!=NULL);
+	Keystream_Fill(rev_key, rev_generated, msg->data, msg->size);
+	rev_generated += msg->size;
+	rev_pending_msg = msg;
+	rev_pending_gen_time = workload->closed_loop() ? request_time : sim_core.time();
+    }
+    if (!protocol->sender_from_upper_layer(rdt_conn, rev_pending_msg, 0, -1)) {
+	rev_blocked_msg_arrival = e;
+	return;
+    }
+    rev_chars_sent += rev_pending_msg->size;
+    struct msg_track track = {rev_chars_sent, rev_pending_gen_time, false};
+    rev_msgs_in_flight.push_back(track);
+    free_msg(rev_pending_msg);
+    rev_pending_msg = NULL;
+
+    if (!workload->closed_loop() && sim_core.time() < sim_time) {
+	e->sched_time = sim_core.time() + workload->interval(sim_core.time());
+	sim_core.schedule(e);
+    }
+    else
+	delete e;
+}
+
+/* deliver a message to the upper layer at the receiver */
 void Receiver_ToUpperLayer(struct message *msg)
 {
-    static char cnt = 0;
+    if (coro_mode)
+	conn.deliver(msg);
+    else if (running_conn==1)
+	verify_reverse_msg(msg);
+    else
+	verify_msg(msg);
+}
 
-    for (int i=0; i<msg->size; i++) {
-	/* message verification */
-	if (msg->data[i] != '0' + cnt) {
-	    message_verfication_passed = false;
+/* the p-th percentile of the samples */
+static double percentile(std::vector<double> &samples, double p)
+{
+    if (samples.empty()) return 0;
+    size_t k = (size_t)(p*(samples.size()-1));
+    std::nth_element(samples.begin(), samples.begin()+k, samples.end());
+    return samples[k];
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  soak mode
+  []------------------------------------------------------------------------[]*/
+
+/* the resident set of the process in bytes, 0 if unknown */
+static long long resident_bytes()
+{
+    long long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp==NULL)
+	return 0;
+    if (fscanf(fp, "%lld %lld", &pages, &resident)!=2)
+	resident = 0;
+    fclose(fp);
+    return resident*sysconf(_SC_PAGESIZE);
+}
+
+/* report the interval since the last checkpoint and start the samples over */
+static void soak_checkpoint()
+{
+    static double last_wall = -1;
+    static long long last_pkts = 0, last_chars = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wall = now.tv_sec + now.tv_nsec*1e-9;
+    if (last_wall<0) {
+	last_wall = wall;
+	return;
+    }
+
+    double elapsed = wall - last_wall;
+    fprintf(stdout, "## Soak at %.0fs: %lld packets, %.0f per second of wall time, "
+	    "%.2fMB delivered per second of simulation, latency %.3fs at p50 and %.3fs "
+	    "at p99, %.1fMB resident, %s\n", sim_core.time(), tot_pkts_passed,
+	    elapsed>0 ? (tot_pkts_passed - last_pkts)/elapsed : 0.0,
+	    (tot_chars_delivered - last_chars)/1e6/soak_interval,
+	    percentile(msg_latency, 0.5), percentile(msg_latency, 0.99),
+	    resident_bytes()/1e6, message_verfication_passed ? "ok" : "WRONG");
+    fflush(stdout);
+    last_wall = wall;
+    last_pkts = tot_pkts_passed;
+    last_chars = tot_chars_delivered;
+
+    soak_msgs += msg_latency.size();
+    msg_latency.clear();
+    tail_msg_latency.clear();
+    rev_msg_latency.clear();
+    queue_delays.clear();
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  coroutine upper layer
+  []------------------------------------------------------------------------[]*/
+
+/* generate a message and pass it to the rdt layer, the way the message
+   arrival event does */
+static Task send_one()
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Sender): the upper layer instructs rdt layer to send out a message.\n", sim_core.time());
+
+    struct message *msg = generate_msg();
+    double gen_time = sim_core.time();
+    co_await conn.send(msg, msg_deadline>0 ? gen_time+msg_deadline : 0, msg_max_retransmit);
+    tot_chars_sent += msg->size;
+    free_msg(msg);
+
+    if (burst_left==0)
+	burst_left = msg_burst;
+    burst_left --;
+    /* offsets don't match the stream any more once gaps are skipped */
+    if (msg_deadline==0 && msg_max_retransmit<0) {
+	struct msg_track track = {tot_chars_sent, gen_time, msg_burst>1 && burst_left==0};
+	msgs_in_flight.push_back(track);
+    }
+}
+
+/* the upper layer at the sender: a message at a time until the end of the
+   simulation, a burst at a time apart */
+static Task sender_app()
+{
+    for (;;) {
+	co_await send_one();
+	if (!more_to_send())
+	    break;
+	co_await conn.sleep(next_interval());
+    }
+}
+
+/* the upper layer at the receiver */
+static Task receiver_app()
+{
+    for (;;) {
+	struct message msg = co_await conn.recv();
+	verify_msg(&msg);
+    }
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  protocol plugins
+  []------------------------------------------------------------------------[]*/
+
+/* the routines above, for the one connection of the simulation */
+static const struct rdt_driver sim_driver = {
+    NULL,
+    [](void*) { return GetSimulationTime(); },
+    [](void*, double timeout) { Sender_StartTimer(timeout); },
+    [](void*) { Sender_StopTimer(); },
+    [](void*) { return Sender_isTimerSet(); },
+    [](void*, struct packet *pkt, int size) { Sender_ToLowerLayer(pkt, size); },
+    [](void*) { Sender_UpperLayerWritable(); },
+    [](void*, struct packet *pkt, int size) { Receiver_ToLowerLayer(pkt, size); },
+    [](void*, struct message *msg) { Receiver_ToUpperLayer(msg); },
+    [](void*) { return Receiver_isCongestionMarked(); },
+    [](void*) { return Sender_NumPaths(); },
+    [](void*, int path, struct packet *pkt, int size) { Sender_ToPath(path, pkt, size); }
+};
+
+/* the sender and the receiver linked in, whose running state is the one
+   connection they have */
+static const struct rdt_protocol builtin_protocol = {
+    RDT_PLUGIN_ABI, RDT_PKTSIZE, "builtin",
+    [](const struct rdt_driver*) -> void* { return NULL; },
+    [](void*) {},
+    [](void*) { Sender_Init(); },
+    [](void*) { Sender_Final(); },
+    [](void*, struct message *msg, double deadline, int max_retransmit) {
+	return Sender_FromUpperLayer(msg, deadline, max_retransmit); },
+    [](void*, struct packet *pkt) { Sender_FromLowerLayer(pkt); },
+    [](void*) { Sender_Timeout(); },
+    [](void*) { Receiver_Init(); },
+    [](void*) { Receiver_Final(); },
+    [](void*, struct packet *pkt) { Receiver_FromLowerLayer(pkt); }
+};
+
+/* the protocol of the plugin at path, or the one linked in for "builtin" */
+static const struct rdt_protocol *load_protocol(const char *path)
+{
+    if (strcmp(path, "builtin")==0)
+	return &builtin_protocol;
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle==NULL) {
+	fprintf(stderr, "%s\n", dlerror());
+	exit(-1);
+    }
+    rdt_plugin_entry entry = (rdt_plugin_entry) dlsym(handle, RDT_PLUGIN_ENTRY);
+    if (entry==NULL) {
+	fprintf(stderr, "%s: not a protocol plugin\n", path);
+	exit(-1);
+    }
+    const struct rdt_protocol *p = entry();
+    if (p->abi!=RDT_PLUGIN_ABI) {
+	fprintf(stderr, "%s: plugin ABI %d, not %d\n", path, p->abi, RDT_PLUGIN_ABI);
+	exit(-1);
+    }
+    if (p->packet_size!=RDT_PKTSIZE) {
+	fprintf(stderr, "%s: built for packets of %d bytes, not %d\n", path,
+		p->packet_size, RDT_PKTSIZE);
+	exit(-1);
+    }
+    return p;
+}
+
+/* fork a process per variant, runs of them in all, and have each child set
+   its variant up with setup(i) and return true to go on with the simulation.
+   the parent waits for each in turn, reads the summary it leaves in the pipe
+   and returns false once all have finished; a variant that does not complete
+   is reported as the label numbered from one */
+static bool fork_variants_over(size_t runs, void (*setup)(size_t i), const char *label,
+			       std::vector<struct protocol_summary> &summaries,
+			       std::vector<bool> &completed)
+{
+    summaries.assign(runs, protocol_summary());
+    completed.assign(runs, false);
+    for (size_t i=0; i<runs; i++) {
+	int fds[2];
+	if (pipe(fds)<0) {
+	    perror("pipe");
+	    exit(-1);
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid<0) {
+	    perror("fork");
+	    exit(-1);
 	}
-	cnt = (cnt+1) % 10;
+	if (pid==0) {
+	    close(fds[0]);
+	    summary_fd = fds[1];
+	    setup(i);
+	    return true;
+	}
+	close(fds[1]);
+	/* the summary is far smaller than a pipe holds, so the child never
+	   blocks on it */
+	int status;
+	if (waitpid(pid, &status, 0)>=0 && WIFEXITED(status) && WEXITSTATUS(status)==0 &&
+	    read(fds[0], &summaries[i], sizeof(summaries[i]))==sizeof(summaries[i]))
+	    completed[i] = true;
+	else
+	    fprintf(stdout, "## %s %zu did not complete\n", label, i+1);
+	close(fds[0]);
+    }
+    return false;
+}
 
-	if (tracing_level>=2)
-	    fputc(msg->data[i], stdout);
+/* fork a process per protocol, the parent compares them at the end and never
+   returns */
+static void fork_protocols()
+{
+    std::vector<struct protocol_summary> summaries;
+    std::vector<bool> completed;
+    if (fork_variants_over(protocols.size(), [](size_t i) {
+		protocol = protocols[i];
+		fprintf(stdout, "\n## Protocol %zu: %s from %s\n", i+1, protocol->name,
+			protocol_paths[i]);
+	    }, "Protocol", summaries, completed))
+	return;
+
+    fprintf(stdout, "\n## %zu protocols side by side\n", protocols.size());
+    fprintf(stdout, "\t%-18s %12s %9s %12s %9s %8s %8s %8s  %s\n", "protocol",
+	    "delivered", "packets", "bytes", "finished", "p50", "p99", "wall", "session");
+    for (size_t i=0; i<protocols.size(); i++) {
+	char name[64];
+	snprintf(name, sizeof(name), "%zu %s", i+1, protocols[i]->name);
+	struct protocol_summary &s = summaries[i];
+	if (!completed[i])
+	    fprintf(stdout, "\t%-18s did not complete\n", name);
+	else
+	    fprintf(stdout, "\t%-18s %12lld %9lld %12lld %8.2fs %7.3fs %7.3fs %7.3fs  %s\n",
+		    name, s.chars_delivered, s.pkts_passed, s.bytes_passed, s.end_time,
+		    s.latency_p50, s.latency_p99, s.wall_time, s.passed ? "ok" : "WRONG");
     }
+    exit(0);
+}
 
-    tot_chars_delivered += msg->size;
+
+/*[]------------------------------------------------------------------------[]
+  |  multiple paths
+  []------------------------------------------------------------------------[]*/
+
+/* fork a process per path with that path alone, then one with all of them,
+   the parent compares them at the end and never returns.  a path alone takes
+   the place of the link */
+static void fork_paths()
+{
+    size_t runs = paths.size() + 2;
+    std::vector<struct protocol_summary> summaries;
+    std::vector<bool> completed;
+    if (fork_variants_over(runs, [](size_t i) {
+		if (i==paths.size()+1) {
+		    fprintf(stdout, "\n## All %zu paths\n", i);
+		    return;
+		}
+		if (i>0) {
+		    channel = paths[i-1].channel;
+		    link_bandwidth = paths[i-1].bandwidth;
+		}
+		paths.clear();
+		fprintf(stdout, "\n## Path %zu alone\n", i);
+	    }, "Run", summaries, completed))
+	return;
+
+    fprintf(stdout, "\n## %zu paths alone and together\n", runs-1);
+    fprintf(stdout, "\t%-18s %12s %10s %9s %8s %8s  %s\n", "paths", "delivered",
+	    "goodput", "finished", "p50", "p99", "session");
+    double best = 0;
+    size_t best_path = 0;
+    for (size_t i=0; i<runs; i++) {
+	char name[64];
+	if (i==runs-1)
+	    snprintf(name, sizeof(name), "all %zu", runs-1);
+	else
+	    snprintf(name, sizeof(name), "path %zu alone", i);
+	struct protocol_summary &s = summaries[i];
+	if (!completed[i]) {
+	    fprintf(stdout, "\t%-18s did not complete\n", name);
+	    continue;
+	}
+	double goodput = s.chars_delivered/s.end_time;
+	fprintf(stdout, "\t%-18s %12lld %8.0f/s %8.2fs %7.3fs %7.3fs  %s\n", name,
+		s.chars_delivered, goodput, s.end_time, s.latency_p50, s.latency_p99,
+		s.passed ? "ok" : "WRONG");
+	if (i<runs-1 && goodput>best) {
+	    best = goodput;
+	    best_path = i;
+	}
+    }
+    if (completed[runs-1] && best>0)
+	fprintf(stdout, "\tall paths together carry %.2f times the goodput of the best "
+		"path alone, path %zu\n", 
+		summaries[runs-1].chars_delivered/summaries[runs-1].end_time/best, best_path);
+    exit(0);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  options that exclude each other
+  []------------------------------------------------------------------------[]*/
+
+/* the options the conflicts below are about, and whether each has been given */
+static const struct given_option {
+    const char *name;
+    bool (*given)();
+} given_options[] = {
+    {"-C", [] { return coro_mode; }},
+    {"-d", [] { return msg_deadline>0; }},
+    {"-r", [] { return msg_max_retransmit>=0; }},
+    {"-G", [] { return ge_p>=0; }},
+    {"-O", [] { return outage_period>0; }},
+    {"-R", [] { return trace_file!=NULL; }},
+    {"-P", [] { return replay_file!=NULL; }},
+    {"-L", [] { return record_file!=NULL; }},
+    {"-z", [] { return sizes!=SIZES_UNIFORM; }},
+    {"-a", [] { return arrivals!=ARRIVALS_UNIFORM; }},
+    {"-a reqresp", [] { return arrivals==ARRIVALS_REQRESP; }},
+    {"-W", [] { return workload_file!=NULL; }},
+    {"-i", [] { return send_file!=NULL; }},
+    {"-o", [] { return recv_file!=NULL; }},
+    {"-K", [] { return checkpoint_time>=0; }},
+    {"-X", [] { return !protocol_paths.empty(); }},
+    {"-M", [] { return !paths.empty(); }},
+    {"-D", [] { return ack_delay>=0; }},
+};
+
+/* an option that cannot be given along with any of those it excludes, the
+   impairment models one at most besides the default */
+#define MAX_EXCLUDED 8
+static const struct option_conflict {
+    const char *option;
+    const char *excludes[MAX_EXCLUDED];
+} option_conflicts[] = {
+    {"-G", {"-O", "-R", "-P"}},
+    {"-O", {"-R", "-P"}},
+    {"-R", {"-P"}},
+    {"-W", {"-z", "-a"}},
+    {"-a reqresp", {"-C", "-d", "-r"}},
+    {"-i", {"-a reqresp", "-d", "-r"}},
+    {"-K", {"-L", "-P", "-o"}},
+    {"-X", {"-C", "-K", "-L", "-o"}},
+    {"-M", {"-C", "-K", "-L", "-o", "-X"}},
+    {"-D", {"-C", "-d", "-r", "-i", "-W", "-K", "-X", "-M"}},
+};
+
+/* whether the option of the given name has been given */
+static bool given(const char *name)
+{
+    for (const struct given_option &o : given_options)
+	if (strcmp(o.name, name)==0)
+	    return o.given();
+    ASSERT(false);
+    return false;
+}
+
+/* exit with the first conflict among the options given, listing everything
+   the option excludes */
+static void check_conflicts()
+{
+    for (const struct option_conflict &c : option_conflicts) {
+	if (!given(c.option)) continue;
+	int n = 0;
+	bool clash = false;
+	while (n<MAX_EXCLUDED && c.excludes[n]!=NULL)
+	    clash |= given(c.excludes[n++]);
+	if (!clash) continue;
+	fprintf(stderr, "%s excludes ", c.option);
+	for (int i=0; i<n; i++)
+	    fprintf(stderr, "%s%s", i==0 ? "" : i==n-1 ? " and " : ", ", c.excludes[i]);
+	fprintf(stderr, "\n");
+	exit(-1);
+    }
 }
 
 
@@ -354,8 +1533,233 @@ void Receiver_ToUpperLayer(struct message *msg)
 
 int main(int argc, char *argv[])
 {
+    static struct option long_options[] = {
+	{"deadline", required_argument, NULL, 'd'},
+	{"max-retransmit", required_argument, NULL, 'r'},
+	{"burst", required_argument, NULL, 'B'},
+	{"bandwidth", required_argument, NULL, 'w'},
+	{"queue-limit", required_argument, NULL, 'Q'},
+	{"ecn", required_argument, NULL, 'E'},
+	{"coroutines", no_argument, NULL, 'C'},
+	{"gilbert-elliott", required_argument, NULL, 'G'},
+	{"outage", required_argument, NULL, 'O'},
+	{"trace", required_argument, NULL, 'R'},
+	{"record", required_argument, NULL, 'L'},
+	{"replay", required_argument, NULL, 'P'},
+	{"seed", required_argument, NULL, 'S'},
+	{"sizes", required_argument, NULL, 'z'},
+	{"arrivals", required_argument, NULL, 'a'},
+	{"workload", required_argument, NULL, 'W'},
+	{"send-file", required_argument, NULL, 'i'},
+	{"recv-file", required_argument, NULL, 'o'},
+	{"checkpoint", required_argument, NULL, 'K'},
+	{"variant", required_argument, NULL, 'V'},
+	{"profile", optional_argument, NULL, 'p'},
+	{"timing", no_argument, NULL, 'T'},
+	{"protocol", required_argument, NULL, 'X'},
+	{"path", required_argument, NULL, 'M'},
+	{"scheduler", required_argument, NULL, 'm'},
+	{"duplex", required_argument, NULL, 'D'},
+	{"soak", required_argument, NULL, 'Z'},
+	{NULL, 0, NULL, 0}
+    };
+    bool seeded = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:r:B:w:Q:E:CG:O:R:L:P:S:z:a:W:i:o:K:V:p::TX:M:m:D:Z:", long_options, NULL)) != -1) {
+	switch (opt) {
+	case 'd':
+	    msg_deadline = atof(optarg);
+	    if (msg_deadline<0) {
+		fprintf(stderr, "invalid <deadline>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'r':
+	    msg_max_retransmit = atoi(optarg);
+	    if (msg_max_retransmit<0) {
+		fprintf(stderr, "invalid <max_retransmit>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'B':
+	    msg_burst = atoi(optarg);
+	    if (msg_burst<=0) {
+		fprintf(stderr, "invalid <burst>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'w':
+	    link_bandwidth = atof(optarg);
+	    if (link_bandwidth<0) {
+		fprintf(stderr, "invalid <bandwidth>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'Q':
+	    queue_limit = atoi(optarg);
+	    if (queue_limit<RDT_PKTSIZE) {
+		fprintf(stderr, "invalid <queue_limit>, at least a packet\n");
+		exit(-1);
+	    }
+	    break;
+	case 'E':
+	    mark_threshold = atoi(optarg);
+	    if (mark_threshold<=0) {
+		fprintf(stderr, "invalid <mark_threshold>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'C':
+	    coro_mode = true;
+	    break;
+	case 'G':
+	    if (sscanf(optarg, "%lf,%lf,%lf,%lf", &ge_p, &ge_r, &ge_loss_good, &ge_loss_bad)<2 ||
+		ge_p<0 || ge_p>1 || ge_r<0 || ge_r>1 || ge_loss_good<0 || ge_loss_good>1 ||
+		ge_loss_bad<0 || ge_loss_bad>1) {
+		fprintf(stderr, "invalid <p>,<r>[,<loss_good>,<loss_bad>]\n");
+		exit(-1);
+	    }
+	    break;
+	case 'O':
+	    if (sscanf(optarg, "%lf,%lf", &outage_period, &outage_duration)!=2 ||
+		outage_period<=0 || outage_duration<=0 || outage_duration>=outage_period) {
+		fprintf(stderr, "invalid <period>,<duration>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'R':
+	    trace_file = optarg;
+	    break;
+	case 'L':
+	    record_file = optarg;
+	    break;
+	case 'P':
+	    replay_file = optarg;
+	    break;
+	case 'S':
+	    seed = strtoul(optarg, NULL, 0);
+	    seeded = true;
+	    break;
+	case 'z':
+	    if (sscanf(optarg, "pareto,%lf", &size_shape)==1 && size_shape>1)
+		sizes = SIZES_PARETO;
+	    else if (sscanf(optarg, "lognormal,%lf", &size_shape)==1 && size_shape>0)
+		sizes = SIZES_LOGNORMAL;
+	    else if (strcmp(optarg, "uniform")==0)
+		sizes = SIZES_UNIFORM;
+	    else {
+		fprintf(stderr, "invalid <sizes>, uniform, pareto,<alpha> (alpha > 1) or "
+			"lognormal,<sigma>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'a':
+	    if (sscanf(optarg, "onoff,%lf,%lf", &on_period, &off_period)==2 && 
+		on_period>0 && off_period>0)
+		arrivals = ARRIVALS_ONOFF;
+	    else if (strcmp(optarg, "poisson")==0)
+		arrivals = ARRIVALS_POISSON;
+	    else if (strcmp(optarg, "reqresp")==0)
+		arrivals = ARRIVALS_REQRESP;
+	    else if (strcmp(optarg, "uniform")==0)
+		arrivals = ARRIVALS_UNIFORM;
+	    else {
+		fprintf(stderr, "invalid <arrivals>, uniform, poisson, onoff,<on>,<off> "
+			"or reqresp\n");
+		exit(-1);
+	    }
+	    break;
+	case 'W':
+	    workload_file = optarg;
+	    break;
+	case 'i':
+	    send_file = optarg;
+	    break;
+	case 'o':
+	    recv_file = optarg;
+	    break;
+	case 'K':
+	    checkpoint_time = atof(optarg);
+	    if (checkpoint_time<0) {
+		fprintf(stderr, "invalid <checkpoint>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'V':
+	    if (!variant(optarg, false)) {
+		fprintf(stderr, "invalid <variant>, a list of loss=, corrupt=, outoforder=, "
+			"bandwidth= and seed=\n");
+		exit(-1);
+	    }
+	    variants.push_back(optarg);
+	    break;
+	case 'p':
+#ifndef RDT_PROFILE
+	    fprintf(stderr, "built without profiling, use rdt_sim_profile (make rdt_sim_profile)\n");
+	    exit(-1);
+#endif
+	    profile = true;
+	    profile_file = optarg;
+	    break;
+	case 'T':
+	    timing = true;
+	    break;
+	case 'X':
+	    protocol_paths.push_back(optarg);
+	    break;
+	case 'M':
+	    {
+		struct sim_path p = {NULL, 0, 0, 0, 0, 0};
+		if (sscanf(optarg, "%lf,%lf,%lf", &p.latency, &p.loss_rate, &p.bandwidth)<2 ||
+		    p.latency<=0 || p.loss_rate<0 || p.loss_rate>=1 || p.bandwidth<0) {
+		    fprintf(stderr, "invalid <latency>,<loss_rate>[,<bandwidth>]\n");
+		    exit(-1);
+		}
+		if (1+paths.size()>=MAX_PATHS) {
+		    fprintf(stderr, "%d paths at most\n", MAX_PATHS);
+		    exit(-1);
+		}
+		paths.push_back(p);
+	    }
+	    break;
+	case 'm':
+	    scheduler = optarg;
+	    if (!Sender_SetScheduler(scheduler)) {
+		fprintf(stderr, "invalid <scheduler>, minrtt, wrr or redundant\n");
+		exit(-1);
+	    }
+	    break;
+	case 'D':
+	    ack_delay = atof(optarg);
+	    if (ack_delay<0) {
+		fprintf(stderr, "invalid <ack_delay>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'Z':
+	    soak_interval = atof(optarg);
+	    if (soak_interval<=0) {
+		fprintf(stderr, "invalid <soak_interval>\n");
+		exit(-1);
+	    }
+	    break;
+	default:
+	    argc = 0;
+	    break;
+	}
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
     if (argc!=8) {
-	fprintf(stderr, "usage: %s <sim_time> <mean_msg_arrivalint> <mean_msg_size> "
+	fprintf(stderr, "usage: %s [-d <deadline>] [-r <max_retransmit>] [-B <burst>] "
+		"[-w <bandwidth> [-Q <queue_limit>] [-E <mark_threshold>]] [-C] [-G <p>,<r>[,<loss_good>,<loss_bad>] | "
+		"-O <period>,<duration> | -R <trace_file> | -P <log_file>] [-L <log_file>] "
+		"[-S <seed>] [-z <sizes>] [-a <arrivals> | -W <workload_trace>] "
+		"[-i <send_file> [-o <recv_file>]] [-K <checkpoint> -V <variant>...] "
+		"[--profile[=<folded_file>]] [-T] [-X <plugin>|builtin...] "
+		"[-M <latency>,<loss_rate>[,<bandwidth>]... [-m <scheduler>]] [-D <ack_delay>] [-Z <soak_interval>] "
+		"<sim_time> <mean_msg_arrivalint> <mean_msg_size> "
 		"<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level>\n", 
 		argv[0]);
 	exit(-1);
@@ -396,6 +1800,58 @@ int main(int argc, char *argv[])
 	fprintf(stderr, "invalid <tracing_level>\n");
 	exit(-1);
     }
+
+    /* options that need others, and those that exclude each other (see
+       option_conflicts) */
+    if ((queue_limit>0 || mark_threshold>0) && link_bandwidth<=0) {
+	fprintf(stderr, "-Q and -E need -w\n");
+	exit(-1);
+    }
+    if (recv_file!=NULL && send_file==NULL) {
+	fprintf(stderr, "-o needs -i\n");
+	exit(-1);
+    }
+    if ((checkpoint_time>=0) != !variants.empty()) {
+	fprintf(stderr, "-K and -V go together\n");
+	exit(-1);
+    }
+    if (scheduler!=NULL && paths.empty()) {
+	fprintf(stderr, "-m needs -M\n");
+	exit(-1);
+    }
+    check_conflicts();
+
+    /* the impairment model */
+    if (ge_p>=0)
+	channel = new GilbertElliott(ge_p, ge_r, ge_loss_good, ge_loss_bad, corrupt_rate,
+				     outoforder_rate, pkt_latency);
+    else if (outage_period>0)
+	channel = new Outage(outage_period, outage_duration, loss_rate, corrupt_rate,
+			     outoforder_rate, pkt_latency);
+    else if (trace_file!=NULL)
+	channel = new TraceChannel(trace_file);
+    else if (replay_file!=NULL)
+	channel = new ChannelReplay(replay_file, loss_rate, corrupt_rate, outoforder_rate,
+				    pkt_latency);
+    else
+	channel = new ChannelModel(loss_rate, corrupt_rate, outoforder_rate, pkt_latency);
+    if (record_file!=NULL)
+	channel = new ChannelRecorder(channel, record_file);
+
+    for (struct sim_path &p : paths)
+	p.channel = new ChannelModel(p.loss_rate, corrupt_rate, outoforder_rate, p.latency);
+    for (const char *path : protocol_paths)
+	protocols.push_back(load_protocol(path));
+    protocol = &builtin_protocol;
+
+    /* the workload */
+    if (workload_file!=NULL)
+	workload = new WorkloadTrace(workload_file);
+    else
+	workload = new Workload(sizes, size_shape, arrivals, on_period, off_period, 
+				msg_size, msg_arrivalint);
+    if (!seeded)
+	seed = getpid()+getppid();
     
     fprintf(stdout, "## Reliable data transfer simulation with:\n"
 	    "\tsimulation time is %.3f seconds\n"
@@ -405,13 +1861,55 @@ int main(int argc, char *argv[])
 	    "\taverage loss rate is %.2f%%\n"
 	    "\taverage corrupt rate is %.2f%%\n"
 	    "\ttracing level is %d\n"
-	    "Please review these inputs and press <enter> to proceed.\n",
+	    "\trandom seed is %u\n",
 	    sim_time, msg_arrivalint, msg_size, outoforder_rate*100.0, 
-	    loss_rate*100.0, corrupt_rate*100.0, tracing_level);
+	    loss_rate*100.0, corrupt_rate*100.0, tracing_level, seed);
+    channel->describe(stdout);
+    workload->describe(stdout);
+    if (link_bandwidth>0) {
+	fprintf(stdout, "\tthe sender's link carries %.0f bytes per second", link_bandwidth);
+	fprintf(stdout, ", queueing %d bytes at most", 
+		queue_limit>0 ? queue_limit : default_queue_limit(link_bandwidth));
+	if (mark_threshold>0)
+	    fprintf(stdout, ", marking the packets behind %d bytes", mark_threshold);
+	fprintf(stdout, "\n");
+    }
+    if (send_file!=NULL)
+	fprintf(stdout, "\t%s is transferred%s%s\n", send_file, 
+		recv_file!=NULL ? " to " : "", recv_file!=NULL ? recv_file : "");
+    if (checkpoint_time>=0)
+	fprintf(stdout, "\t%zu variants are forked at %.2fs\n", variants.size(), 
+		checkpoint_time);
+    for (size_t i=0; i<protocols.size(); i++)
+	fprintf(stdout, "\tprotocol %zu is %s from %s\n", i+1, protocols[i]->name,
+		protocol_paths[i]);
+    for (size_t i=0; i<paths.size(); i++) {
+	fprintf(stdout, "\tpath %zu takes %.3fs and loses %.2f%% of the packets", i+1,
+		paths[i].latency, paths[i].loss_rate*100.0);
+	if (paths[i].bandwidth>0)
+	    fprintf(stdout, ", carrying %.0f bytes per second", paths[i].bandwidth);
+	fprintf(stdout, "\n");
+    }
+    if (!paths.empty())
+	fprintf(stdout, "\tthe sender schedules packets %s\n", scheduler!=NULL ? scheduler : "minrtt");
+    if (soak_interval>0)
+	fprintf(stdout, "\ta soak checkpoint is reported every %.0fs\n", soak_interval);
+    if (ack_delay>0)
+	fprintf(stdout, "\tboth ends send, and acks wait %.3fs for data to ride on\n", ack_delay);
+    else if (ack_delay==0)
+	fprintf(stdout, "\tboth ends send, and acks go out at once in packets of their own\n");
+    fprintf(stdout, "Please review these inputs and press <enter> to proceed.\n");
     fgetc(stdin);
 
-    /* initialize the random number generator */
-    srand(getpid()+getppid());
+    /* initialize the random number generators */
+    srand(seed);
+    channel_rng[0] = 0x330e;
+    channel_rng[1] = seed & 0xffff;
+    channel_rng[2] = seed >> 16;
+    stream_key = seed;
+    rev_key = ~(uint64_t) seed;
+    if (send_file!=NULL)
+	map_files();
 
     /* test the random number generator */
     double randtest_sum = 0.0;
@@ -426,19 +1924,66 @@ int main(int argc, char *argv[])
 	exit(-1);
     }
 
+    /* a process per protocol from here on, when asked for */
+    if (!protocols.empty())
+	fork_protocols();
+    if (!paths.empty())
+	fork_paths();
+
     /* intialize the sender and the receiver */
-    Sender_Init();
-    Receiver_Init();
+    rdt_conn = protocol->open(&sim_driver);
+    protocol->sender_init(rdt_conn);
+    protocol->receiver_init(rdt_conn);
+    if (ack_delay>=0) {
+	Duplex_Init(ack_delay);
+	Duplex_Run(1);
+	protocol->sender_init(rdt_conn);
+	protocol->receiver_init(rdt_conn);
+	Duplex_Run(0);
+	if (!workload->closed_loop()) {
+	    EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
+	    e->conn = 1;
+	    e->sched_time = 0;
+	    sim_core.schedule(e);
+	}
+    }
 
-    /* scheduling a recurring message arrival event */
-    EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
-    e->sched_time = 0;
-    sim_core.schedule(e);
+    /* scheduling a recurring message arrival event, or starting the upper 
+       layer coroutines */
+    if (coro_mode) {
+	static Task sender_task = sender_app(), receiver_task = receiver_app();
+	sender_task.start();
+	receiver_task.start();
+    } else {
+	EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
+	e->sched_time = 0;
+	sim_core.schedule(e);
+    }
 
     /* main simulation cycle */
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    if (soak_interval>0) {
+	soak_checkpoint();
+	next_soak = soak_interval;
+    }
+    PROFILE_BEGIN(PROF_RUN);
     for (;;) {
 	Event *e = sim_core.next_event();
 	if (e==NULL) break;
+	tot_events ++;
+
+	if (checkpoint_time>=0 && sim_core.time()>=checkpoint_time) {
+	    checkpoint_time = -1;
+	    fork_variants();
+	}
+	if (soak_interval>0 && sim_core.time()>=next_soak) {
+	    soak_checkpoint();
+	    while (next_soak<=sim_core.time())
+		next_soak += soak_interval;
+	}
+
+	PROFILE(PROF_EV_FROMUPPERLAYER + e->event_type);
 
 	switch (e->event_type) {
 	case EVENT_SENDER_FROMUPPERLAYER:
@@ -449,14 +1994,47 @@ int main(int argc, char *argv[])
 
 		EventSenderFromUpperLayer *real_e = (EventSenderFromUpperLayer*) e;
 
-		struct message *msg = generate_msg();
-		Sender_FromUpperLayer(msg);
-		free_msg(msg);
+		Duplex_Run(real_e->conn);
+		if (real_e->conn==1) {
+		    reverse_msg_arrival(real_e);
+		    break;
+		}
+
+		/* the upper layer honors backpressure: a refused message is 
+		   held, and no new message is generated until it is taken */
+		if (pending_msg==NULL) {
+		    pending_msg = generate_msg();
+		    pending_msg_gen_time = sim_core.time();
+		}
+		if (!protocol->sender_from_upper_layer(rdt_conn, pending_msg, 
+		    msg_deadline>0 ? sim_core.time()+msg_deadline : 0, 
+		    msg_max_retransmit)) {
+		    if (tracing_level>=1)
+			fprintf(stdout, "Time %.2fs (Sender): the rdt layer pushes back, the message is held.\n", sim_core.time());
+		    blocked_msg_arrival = real_e;
+		    blocked_since = sim_core.time();
+		    break;
+		}
+		tot_chars_sent += pending_msg->size;
+		free_msg(pending_msg);
+		pending_msg = NULL;
+
+		if (burst_left==0)
+		    burst_left = msg_burst;
+		burst_left --;
+		/* offsets don't match the stream any more once gaps are skipped */
+		if (msg_deadline==0 && msg_max_retransmit<0) {
+		    struct msg_track track = {tot_chars_sent, pending_msg_gen_time, 
+			msg_burst>1 && burst_left==0};
+		    msgs_in_flight.push_back(track);
+		}
 
-		/* schedule the recurring event */
-		if (sim_core.time() < sim_time) {
-		    real_e->sched_time = 
-			sim_core.time() + msg_arrivalint*2.0*myrandom();
+		/* schedule the recurring event, or wait for the response to 
+		   the last message of the burst */
+		if (workload->closed_loop() && burst_left==0)
+		    awaiting_response = real_e;
+		else if (more_to_send()) {
+		    real_e->sched_time = sim_core.time() + next_interval();
 		    sim_core.schedule(real_e);
 		}
 		else
@@ -472,7 +2050,8 @@ int main(int argc, char *argv[])
 
 		EventSenderFromLowerLayer *real_e = (EventSenderFromLowerLayer*) e;
 
-		Sender_FromLowerLayer(&real_e->pkt);
+		Duplex_Run(0);
+		protocol->sender_from_lower_layer(rdt_conn, &real_e->pkt);
 
 		delete real_e;
 	    }
@@ -485,10 +2064,12 @@ int main(int argc, char *argv[])
 		}
 
 		EventSenderTimeout *real_e = (EventSenderTimeout*) e;
+		int c = real_e->conn;
 		delete real_e;
-		sender_timer = NULL;
+		sender_timer[c] = NULL;
 
-		Sender_Timeout();
+		Duplex_Run(c);
+		protocol->sender_timeout(rdt_conn);
 	    }
 	    break;
 
@@ -499,34 +2080,196 @@ int main(int argc, char *argv[])
 		}
 
 		EventReceiverFromLowerLayer *real_e = (EventReceiverFromLowerLayer*) e;
-		
-		Receiver_FromLowerLayer(&real_e->pkt);
 
+		receiving_marked = real_e->marked;
+		receiving_path = real_e->path;
+		Duplex_Run(0);
+		protocol->receiver_from_lower_layer(rdt_conn, &real_e->pkt);
+		receiving_marked = false;
+		receiving_path = 0;
+
+		delete real_e;
+	    }
+	    break;
+
+	case EVENT_END_FROMLOWERLAYER:
+	    {
+		EventEndFromLowerLayer *real_e = (EventEndFromLowerLayer*) e;
+
+		if (tracing_level>=1) {
+		    fprintf(stdout, "Time %.2fs (End %d): the lower layer informs the rdt layer that a packet with %s%zu acks is received from the link.\n", sim_core.time(), 1-real_e->dp.from, real_e->dp.data_size>0 ? "data and " : "", real_e->dp.ack_sizes.size());
+		}
+
+		Duplex_FromLink(&real_e->dp, real_e->marked);
 		delete real_e;
 	    }
 	    break;
 
+	case EVENT_ACK_DELAY:
+	    {
+		EventAckDelay *real_e = (EventAckDelay*) e;
+		int end = real_e->end;
+		delete real_e;
+		ack_timer[end] = NULL;
+
+		Duplex_AckTimeout(end);
+	    }
+	    break;
+
+	case EVENT_COROUTINE_RESUME:
+	    {
+		EventCoroutineResume *real_e = (EventCoroutineResume*) e;
+		std::coroutine_handle<> h = real_e->handle;
+		delete real_e;
+
+		h.resume();
+	    }
+	    break;
+
 	default:
 	    fprintf(stderr, "undefined event %d\n", e->event_type);
 	    break;
 	}
     }
 
-    /* finalize the sender and the receiver */
-    Sender_Final();
-    Receiver_Final();
+    PROFILE_END(PROF_RUN);
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall_time = (wall_end.tv_sec - wall_start.tv_sec) + 
+	(wall_end.tv_nsec - wall_start.tv_nsec)*1e-9;
+
+    /* finalize the sender and the receiver, and those of the other way */
+    Duplex_Run(0);
+    protocol->sender_final(rdt_conn);
+    protocol->receiver_final(rdt_conn);
+    if (ack_delay>=0) {
+	fprintf(stdout, "\n## The other way, from the receiver's end\n");
+	Duplex_Run(1);
+	protocol->sender_final(rdt_conn);
+	protocol->receiver_final(rdt_conn);
+	Duplex_Final();
+    }
+    protocol->close(rdt_conn);
 
     fprintf(stdout, "\n");
     fprintf(stdout, "## Simulation completed at time %.2fs with\n" 
-	    "\t%d characters sent\n" 
-	    "\t%d characters delivered\n"
-	    "\t%d packets passed between the sender and the receiver\n", 
-	    sim_core.time(), tot_chars_sent, tot_chars_delivered, tot_pkts_passed);
+	    "\t%lld characters sent\n" 
+	    "\t%lld characters delivered\n"
+	    "\t%lld packets (%lld bytes) passed between the sender and the receiver\n", 
+	    sim_core.time(), tot_chars_sent, tot_chars_delivered, tot_pkts_passed,
+	    tot_bytes_passed);
+    channel->report(stdout);
+    workload->report(stdout);
+    if (send_file!=NULL) {
+	uint64_t sent = hash_final(&sent_hash), delivered = hash_final(&delivered_hash);
+	fprintf(stdout, "\t%lld of %lld bytes of the file transferred, at %.2fMB per "
+		"second of simulation and %.2fMB per second of wall time\n", 
+		tot_chars_delivered, file_size, tot_chars_delivered/1e6/sim_core.time(), 
+		tot_chars_delivered/1e6/wall_time);
+	fprintf(stdout, "\tXXH64 is %016llx at the sender and %016llx at the receiver\n", 
+		(unsigned long long) sent, (unsigned long long) delivered);
+	if (sent!=delivered)
+	    message_verfication_passed = false;
+	unmap_files();
+    }
+    if (!queue_delays.empty()) {
+	double sum = 0;
+	for (double d : queue_delays)
+	    sum += d;
+	fprintf(stdout, "\tqueueing delay at the sender's link is %.3fs on average and %.3fs at "
+		"p99, %lld packets dropped and %lld marked by the queue\n",
+		sum/queue_delays.size(), percentile(queue_delays, 0.99), queue_drops,
+		queue_marks);
+    }
+    if (ack_delay>=0) {
+	fprintf(stdout, "\t%lld characters sent and %lld delivered the other way\n",
+		rev_chars_sent, rev_chars_delivered);
+	if (!rev_msg_latency.empty())
+	    fprintf(stdout, "\t%s is %.3fs at p50 and %.3fs at p99\n",
+		    workload->closed_loop() ? "the round trip of a request and its response" :
+		    "message latency the other way", percentile(rev_msg_latency, 0.5),
+		    percentile(rev_msg_latency, 0.99));
+	Duplex_Report(stdout);
+	if (!rev_verification_passed || rev_chars_sent!=rev_chars_delivered)
+	    message_verfication_passed = false;
+    }
+    if (!paths.empty()) {
+	long long tot = 0;
+	for (int i=0; i<Sender_NumPaths(); i++)
+	    tot += path_pkts[i];
+	for (int i=0; i<Sender_NumPaths(); i++)
+	    fprintf(stdout, "\tpath %d carried %lld packets from the sender (%.1f%%)\n", i,
+		    path_pkts[i], tot ? path_pkts[i]*100.0/tot : 0.0);
+    }
+    if (workload->closed_loop())
+	fprintf(stdout, "\t%lld responses completed, %.2f per second\n",
+		soak_msgs + (long long) msg_latency.size(),
+		(soak_msgs + msg_latency.size())/sim_core.time());
+    if (!msg_latency.empty())
+	fprintf(stdout, "\tmessage latency is %.3fs at p50 and %.3fs at p99\n",
+		percentile(msg_latency, 0.5), percentile(msg_latency, 0.99));
+    if (!tail_msg_latency.empty())
+	fprintf(stdout, "\tlatency of the last message of a burst is %.3fs at p50 "
+		"and %.3fs at p99\n", percentile(tail_msg_latency, 0.5), 
+		percentile(tail_msg_latency, 0.99));
+    if (coro_mode)
+	tot_blocked_time = conn.blocked_time();
+    if (tot_blocked_time>0 || blocked_msg_arrival!=NULL) {
+	if (blocked_msg_arrival!=NULL)
+	    tot_blocked_time += sim_core.time() - blocked_since;
+	fprintf(stdout, "\tthe upper layer was pushed back for %.2fs\n", 
+		tot_blocked_time);
+    }
 
-    if (message_verfication_passed && (tot_chars_sent==tot_chars_delivered))
+    if (timing)
+	fprintf(stdout, "\t%lld events handled in %.3fs of wall time, %.0f per second\n", 
+		tot_events, wall_time, tot_events/wall_time);
+
+    if (coro_mode)
+	fprintf(stdout, "\t%lld coroutine suspensions, %lld coroutine frames of which %lld "
+		"came from the heap\n", conn.suspensions, frame_stats.allocs, 
+		frame_stats.fresh);
+
+    if (msg_deadline>0 || msg_max_retransmit>=0) {
+	fprintf(stdout, "\t%.2f%% of the characters delivered, leaving %lld gaps "
+		"under partial reliability\n",
+		tot_chars_sent ? tot_chars_delivered*100.0/tot_chars_sent : 100.0, 
+		tot_gaps_skipped);
+	if (message_verfication_passed)
+	    fprintf(stdout, "## Congratulations! This session is error-free and in order.\n");
+	else
+	    fprintf(stdout, "## Something is wrong! This session is NOT error-free and in order.\n");
+    }
+    else if (message_verfication_passed && (tot_chars_sent==tot_chars_delivered))
 	fprintf(stdout, "## Congratulations! This session is error-free, loss-free, and in order.\n");
     else
 	fprintf(stdout, "## Something is wrong! This session is NOT error-free, loss-free, and in order.\n");
 
+#ifdef RDT_PROFILE
+    if (profile) {
+	Profile_Report(stdout, wall_time);
+	if (profile_file!=NULL) {
+	    FILE *fp = fopen(profile_file, "w");
+	    if (fp==NULL) {
+		perror(profile_file);
+		exit(-1);
+	    }
+	    Profile_Folded(fp);
+	    fclose(fp);
+	}
+    }
+#endif
+
+    /* pass the summary on, to be compared with the other protocols or paths */
+    if (summary_fd>=0) {
+	struct protocol_summary s = {sim_core.time(), tot_chars_delivered, tot_pkts_passed,
+	    tot_bytes_passed, percentile(msg_latency, 0.5), percentile(msg_latency, 0.99),
+	    wall_time, message_verfication_passed &&
+	    (msg_deadline>0 || msg_max_retransmit>=0 || tot_chars_sent==tot_chars_delivered)};
+	fflush(stdout);
+	if (write(summary_fd, &s, sizeof(s))!=sizeof(s))
+	    perror("write");
+	close(summary_fd);
+    }
+
     return 0;
 }
@@ -23,8 +23,11 @@ struct message {
 };
 
 /* a packet is a data unit passed between rdt layer and the lower layer, each 
-   packet has a fixed size */
+   packet has a fixed size. it can be overridden at build time, e.g. 
+   -DRDT_PKTSIZE=1500 */
+#ifndef RDT_PKTSIZE
 #define RDT_PKTSIZE 128
+#endif
 
 struct packet {
     char data[RDT_PKTSIZE];
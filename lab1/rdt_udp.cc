@@ -0,0 +1,516 @@
+/*
+ * FILE: rdt_udp.cc
+ * DESCRIPTION: Runs the reliable data transfer sender and receiver as two
+ *       processes talking over UDP sockets on 127.0.0.1, in place of the
+ *       simulator.  Time is real time, the sender timer is a timerfd, and
+ *       packets are sent and received in batches through sendmmsg() and
+ *       recvmmsg().  Loss, corruption and reordering are introduced by the
+ *       sending side before a packet reaches its socket.
+ * NOTE: Linux only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_host.h"
+
+
+/* most packets handed to a single sendmmsg() or recvmmsg() call */
+#define MAX_BATCH 64
+
+/* socket buffers, large enough for a full window of packets in flight */
+#define SOCKET_BUFFER (4*1024*1024)
+
+/* how long the sender may keep retransmitting after the run is over */
+#define DRAIN_TIMEOUT 10.0
+
+
+/*[]------------------------------------------------------------------------[]
+  |  gloabal variables, statistics, etc.
+  []------------------------------------------------------------------------[]*/
+
+/* packets per sendmmsg() or recvmmsg() call */
+int batch_size = MAX_BATCH;
+
+/* whether this process is the sender or the receiver */
+bool is_sender;
+
+/* the UDP socket connected to the other process, and the epoll instance
+   watching it together with the timers */
+int sock_fd = -1;
+int epoll_fd = -1;
+
+/* the sender timer, the next message arrival, and the release of the packets
+   held back by the impairment layer, with the time the last two are armed
+   for */
+int sender_timer_fd = -1;
+int arrival_fd = -1;
+int delay_fd = -1;
+bool sender_timer_set = false;
+double arrival_armed = -1;
+double delay_armed = -1;
+
+/* the impairment layer in front of this process's socket */
+Impairment *channel = NULL;
+
+/* the batch of outgoing packets */
+struct mmsghdr tx_msgs[MAX_BATCH];
+struct iovec tx_iov[MAX_BATCH];
+struct packet tx_pkts[MAX_BATCH];
+int tx_count = 0;
+
+/* statistics of a process, the receiver passes its own to the sender at the
+   end */
+struct udp_result {
+    struct host_stats stats;
+    long long send_calls;
+    long long recv_calls;
+};
+long long send_calls = 0;
+long long recv_calls = 0;
+
+
+/*[]------------------------------------------------------------------------[]
+  |  transport routines
+  []------------------------------------------------------------------------[]*/
+
+static struct host_stats *own_stats()
+{
+    return is_sender ? &sender_stats : &receiver_stats;
+}
+
+/* arm a timerfd to expire at the given time, the timer fires right away for
+   a time in the past, and is disarmed for a negative one */
+static void arm_timer(int fd, double when)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (when>=0) {
+	double timeout = std::max(when - GetSimulationTime(), 1e-9);
+	spec.it_value.tv_sec = (time_t) timeout;
+	spec.it_value.tv_nsec = (long) ((timeout-spec.it_value.tv_sec)*1e9);
+    }
+    ASSERT(timerfd_settime(fd, 0, &spec, NULL)==0);
+}
+
+/* arm a timerfd unless it is already armed for that time */
+static void rearm_timer(int fd, double when, double *armed)
+{
+    if (when==*armed) return;
+    arm_timer(fd, when);
+    *armed = when;
+}
+
+/* consume the expiration of a timerfd, return false if the timer has been
+   rearmed or disarmed since it expired */
+static bool ack_timer(int fd)
+{
+    uint64_t expirations;
+    return read(fd, &expirations, sizeof(expirations))==sizeof(expirations);
+}
+
+/* start the sender timer with a specified timeout (in seconds).
+   the timer is cancelled with Sender_StopTimer() is called or a new
+   Sender_StartTimer() is called before the current timer expires.
+   Sender_Timeout() will be called when the timer expires. */
+void Sender_StartTimer(double timeout)
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.6fs (Sender): the timer is started (expires at %.6fs).\n",
+		GetSimulationTime(), GetSimulationTime() + timeout);
+
+    arm_timer(sender_timer_fd, GetSimulationTime() + timeout);
+    sender_timer_set = true;
+}
+
+/* stop the sender timer */
+void Sender_StopTimer()
+{
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.6fs (Sender): the timer is stopped.\n",
+		GetSimulationTime());
+
+    arm_timer(sender_timer_fd, -1);
+    sender_timer_set = false;
+}
+
+/* check whether the sender timer is being set,
+   return true if the timer is set, return false otherwise */
+bool Sender_isTimerSet()
+{
+    return sender_timer_set;
+}
+
+/* send out the batch of outgoing packets */
+static void flush_tx()
+{
+    int sent = 0;
+    while (sent<tx_count) {
+	int n = sendmmsg(sock_fd, tx_msgs+sent, tx_count-sent, 0);
+	send_calls ++;
+	if (n<0) {
+	    if (errno==EINTR) continue;
+	    /* the socket buffer is full, or the other process is gone: the
+	       rest of the batch is lost */
+	    own_stats()->pkts_dropped += tx_count-sent;
+	    break;
+	}
+	sent += n;
+    }
+    tx_count = 0;
+}
+
+/* add a packet to the batch of outgoing packets */
+static void queue_tx(struct packet *pkt, int size)
+{
+    memcpy(tx_pkts[tx_count].data, pkt->data, size);
+    tx_iov[tx_count].iov_len = size;
+    tx_count ++;
+    if (tx_count>=batch_size)
+	flush_tx();
+}
+
+/* send out the packets held back by the impairment layer whose time has
+   come */
+static void release_delayed()
+{
+    struct packet pkt;
+    int size;
+    while (channel->release(GetSimulationTime(), &pkt, &size))
+	queue_tx(&pkt, size);
+}
+
+static void to_lower_layer(struct packet *pkt, int size)
+{
+    struct packet out;
+    if (channel->pass(pkt, size, GetSimulationTime(), &out))
+	queue_tx(&out, size);
+}
+
+/* pass a packet to the lower layer at the sender, only the first size bytes
+   of the packet are carried over the link */
+void Sender_ToLowerLayer(struct packet *pkt, int size)
+{
+    to_lower_layer(pkt, size);
+}
+
+/* pass a packet to the lower layer at the receiver, only the first size bytes
+   of the packet are carried over the link */
+void Receiver_ToLowerLayer(struct packet *pkt, int size)
+{
+    to_lower_layer(pkt, size);
+}
+
+/* no packet is ever marked congestion experienced */
+bool Receiver_isCongestionMarked()
+{
+    return false;
+}
+
+/* pass every packet waiting in the socket to the rdt layer, a batch at a
+   time */
+static void receive_packets()
+{
+    static struct mmsghdr rx_msgs[MAX_BATCH];
+    static struct iovec rx_iov[MAX_BATCH];
+    static struct packet rx_pkts[MAX_BATCH];
+
+    for (;;) {
+	for (int i=0; i<batch_size; i++) {
+	    rx_iov[i].iov_base = rx_pkts[i].data;
+	    rx_iov[i].iov_len = RDT_PKTSIZE;
+	    memset(&rx_msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+	    rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+	    rx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	int n = recvmmsg(sock_fd, rx_msgs, batch_size, MSG_DONTWAIT, NULL);
+	recv_calls ++;
+	if (n<=0) break;
+
+	for (int i=0; i<n; i++) {
+	    int size = rx_msgs[i].msg_len;
+	    if (size<=0) continue;
+	    /* the rest of the packet handed to the rdt layer is zeroed */
+	    memset(&rx_pkts[i].data[size], 0, RDT_PKTSIZE-size);
+	    own_stats()->pkts_received ++;
+	    if (tracing_level>=1)
+		fprintf(stdout, "Time %.6fs (%s): the lower layer informs the rdt layer that a packet is received from the link.\n",
+			GetSimulationTime(), is_sender ? "Sender" : "Receiver");
+	    if (is_sender)
+		Sender_FromLowerLayer(&rx_pkts[i]);
+	    else
+		Receiver_FromLowerLayer(&rx_pkts[i]);
+	}
+	if (n<batch_size) break;
+    }
+}
+
+static int make_timer()
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ASSERT(fd>=0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    ASSERT(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)==0);
+    return fd;
+}
+
+static int make_socket(struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ASSERT(fd>=0);
+    int buffer = SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port = 0;
+    ASSERT(bind(fd, (struct sockaddr*) addr, sizeof(*addr))==0);
+    socklen_t len = sizeof(*addr);
+    ASSERT(getsockname(fd, (struct sockaddr*) addr, &len)==0);
+    return fd;
+}
+
+/* set up the epoll instance, the outgoing batch, the impairment layer and
+   the timers of this process, sock is connected to the other process */
+static void setup_process(int sock, struct sockaddr_in *peer)
+{
+    sock_fd = sock;
+    ASSERT(connect(sock_fd, (struct sockaddr*) peer, sizeof(*peer))==0);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT(epoll_fd>=0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = sock_fd;
+    ASSERT(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev)==0);
+    delay_fd = make_timer();
+
+    for (int i=0; i<MAX_BATCH; i++) {
+	tx_iov[i].iov_base = tx_pkts[i].data;
+	memset(&tx_msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+	tx_msgs[i].msg_hdr.msg_iov = &tx_iov[i];
+	tx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    channel = new Impairment(own_stats(), getpid());
+}
+
+/* the receiver process: runs until the sender closes the control pipe, then
+   writes its statistics to the result pipe */
+static void run_receiver(int ctrl_fd, int result_fd)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = ctrl_fd;
+    ASSERT(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctrl_fd, &ev)==0);
+
+    Receiver_Init();
+
+    bool done = false;
+    while (!done) {
+	rearm_timer(delay_fd, channel->next_release(), &delay_armed);
+
+	struct epoll_event events[8];
+	int n = epoll_wait(epoll_fd, events, 8, -1);
+	if (n<0 && errno!=EINTR) {
+	    perror("epoll_wait");
+	    break;
+	}
+	for (int i=0; i<n; i++) {
+	    int fd = events[i].data.fd;
+	    if (fd==sock_fd) {
+		receive_packets();
+	    } else if (fd==delay_fd) {
+		if (ack_timer(delay_fd))
+		    release_delayed();
+	    } else if (fd==ctrl_fd) {
+		done = true;
+	    }
+	}
+	flush_tx();
+    }
+
+    Receiver_Final();
+    fflush(stdout);
+    struct udp_result result = {receiver_stats, send_calls, recv_calls};
+    if (write(result_fd, &result, sizeof(result))!=sizeof(result))
+	perror("write result");
+}
+
+/* the sender process: passes messages to the rdt layer for run_time seconds,
+   then waits until every packet is acknowledged */
+static void run_sender()
+{
+    sender_timer_fd = make_timer();
+    arrival_fd = make_timer();
+
+    Sender_Init();
+
+    bool generating = true;
+    for (;;) {
+	double due = generating ? host_feed_sender() : -1;
+	if (due<0) generating = false;
+	flush_tx();
+
+	double now = GetSimulationTime();
+	if (!generating) {
+	    /* done once nothing is left in flight */
+	    if (!Sender_isTimerSet() && channel->next_release()<0)
+		break;
+	    if (now>run_time+DRAIN_TIMEOUT) {
+		fprintf(stdout, "Time %.6fs (Sender): gave up waiting for the last acknowledgements.\n", now);
+		break;
+	    }
+	}
+
+	/* poll without waiting while messages can be passed right away */
+	int timeout = -1;
+	if (!generating)
+	    timeout = 100;
+	else if (due<=now)
+	    timeout = 0;
+	rearm_timer(arrival_fd, generating && due>now ? due : -1, &arrival_armed);
+	rearm_timer(delay_fd, channel->next_release(), &delay_armed);
+
+	struct epoll_event events[8];
+	int n = epoll_wait(epoll_fd, events, 8, timeout);
+	if (n<0 && errno!=EINTR) {
+	    perror("epoll_wait");
+	    break;
+	}
+	for (int i=0; i<n; i++) {
+	    int fd = events[i].data.fd;
+	    if (fd==sock_fd) {
+		receive_packets();
+	    } else if (fd==delay_fd) {
+		if (ack_timer(delay_fd))
+		    release_delayed();
+	    } else if (fd==arrival_fd) {
+		ack_timer(arrival_fd);
+	    } else if (fd==sender_timer_fd) {
+		/* a timer restarted or stopped since the expiration is ignored */
+		if (!ack_timer(sender_timer_fd) || !sender_timer_set) continue;
+		if (tracing_level>=1)
+		    fprintf(stdout, "Time %.6fs (Sender): the timer expires.\n", GetSimulationTime());
+		sender_timer_set = false;
+		Sender_Timeout();
+	    }
+	}
+    }
+
+    Sender_Final();
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main control routine
+  []------------------------------------------------------------------------[]*/
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+	{"reorder-delay", required_argument, NULL, 'l'},
+	{"batch", required_argument, NULL, 'b'},
+	{NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:b:", long_options, NULL)) != -1) {
+	switch (opt) {
+	case 'l':
+	    reorder_delay = atof(optarg);
+	    if (reorder_delay<0) {
+		fprintf(stderr, "invalid <reorder_delay>\n");
+		exit(-1);
+	    }
+	    break;
+	case 'b':
+	    batch_size = atoi(optarg);
+	    if (batch_size<=0 || batch_size>MAX_BATCH) {
+		fprintf(stderr, "invalid <batch>, at most %d\n", MAX_BATCH);
+		exit(-1);
+	    }
+	    break;
+	default:
+	    argc = 0;
+	    break;
+	}
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    host_parse_workload(argc, argv, "[-l <reorder_delay>] [-b <batch>] ");
+    char backend[128];
+    snprintf(backend, sizeof(backend), "\tup to %d packets per sendmmsg()/recvmmsg()\n", batch_size);
+    host_confirm_workload("Reliable data transfer over UDP loopback", backend);
+
+    /* one socket for each side, connected to each other */
+    struct sockaddr_in sender_addr, receiver_addr;
+    int sender_sock = make_socket(&sender_addr);
+    int receiver_sock = make_socket(&receiver_addr);
+
+    /* the sender closes the control pipe when it is done, and the receiver
+       answers with its statistics on the result pipe */
+    int ctrl_pipe[2], result_pipe[2];
+    ASSERT(pipe(ctrl_pipe)==0 && pipe(result_pipe)==0);
+
+    host_start_clock();
+
+    pid_t pid = fork();
+    ASSERT(pid>=0);
+    if (pid==0) {
+	close(sender_sock);
+	close(ctrl_pipe[1]);
+	close(result_pipe[0]);
+	setup_process(receiver_sock, &sender_addr);
+	run_receiver(ctrl_pipe[0], result_pipe[1]);
+	exit(0);
+    }
+
+    close(receiver_sock);
+    close(ctrl_pipe[0]);
+    close(result_pipe[1]);
+    is_sender = true;
+    setup_process(sender_sock, &receiver_addr);
+    run_sender();
+    double elapsed = GetSimulationTime();
+    fflush(stdout);
+
+    close(ctrl_pipe[1]);
+    struct udp_result result;
+    bool received = read(result_pipe[0], &result, sizeof(result))==sizeof(result);
+    waitpid(pid, NULL, 0);
+    if (!received) {
+	fprintf(stdout, "## Something is wrong! The receiver process did not report back.\n");
+	return -1;
+    }
+    receiver_stats = result.stats;
+
+    host_report(elapsed, host_cpu_time());
+    fprintf(stdout, "\t%.1f packets per sendmmsg() and %.1f per recvmmsg() on average\n",
+	    (double) (sender_stats.pkts_sent - sender_stats.pkts_lost
+		      + receiver_stats.pkts_sent - receiver_stats.pkts_lost)
+		/ std::max(send_calls + result.send_calls, 1LL),
+	    (double) (sender_stats.pkts_received + receiver_stats.pkts_received)
+		/ std::max(recv_calls + result.recv_calls, 1LL));
+    return host_verdict();
+}
@@ -0,0 +1,268 @@
+/*
+ * FILE: rdt_workload.cc
+ * DESCRIPTION: The workloads and the keystream of rdt_workload.h.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rdt_workload.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  distributions
+  []------------------------------------------------------------------------[]*/
+
+/* a random number in [0,1) */
+static double open_random()
+{
+    double u;
+    do u = Workload_Random(); while (u>=1.0);
+    return u;
+}
+
+/* an exponential random number of the given mean */
+static double exponential(double mean)
+{
+    return -mean*log(1.0 - open_random());
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  synthetic workloads
+  []------------------------------------------------------------------------[]*/
+
+Workload::Workload(int sizes, double size_shape, int arrivals, double on, double off,
+		   int mean_size, double mean_interval)
+    : sizes(sizes), size_shape(size_shape), arrivals(arrivals), on(on), off(off),
+      mean_size(mean_size), mean_interval(mean_interval), on_until(-1), messages(0),
+      truncated(0), bytes(0)
+{
+}
+
+int Workload::size()
+{
+    double x;
+    switch (sizes) {
+    case SIZES_PARETO:
+	/* the scale that makes the mean come out right */
+	x = mean_size*(size_shape-1)/size_shape * pow(1.0 - open_random(), -1.0/size_shape);
+	break;
+    case SIZES_LOGNORMAL:
+	{
+	    double mu = log(mean_size) - size_shape*size_shape/2;
+	    double z = sqrt(-2*log(1.0 - open_random())) * cos(2*M_PI*Workload_Random());
+	    x = exp(mu + size_shape*z);
+	}
+	break;
+    default:
+	x = (int)(Workload_Random()*2.0*mean_size);
+	break;
+    }
+    if (x>WORKLOAD_MAX_SIZE) {
+	x = WORKLOAD_MAX_SIZE;
+	truncated ++;
+    }
+    int size = sizes==SIZES_UNIFORM ? (int) x : (int) (x+0.5);
+    if (size==0) size = 1;
+    messages ++;
+    bytes += size;
+    return size;
+}
+
+double Workload::interval(double now)
+{
+    switch (arrivals) {
+    case ARRIVALS_POISSON:
+    case ARRIVALS_REQRESP:
+	return exponential(mean_interval);
+    case ARRIVALS_ONOFF:
+	{
+	    /* the rate during an on period makes up for the off periods */
+	    double on_interval = mean_interval*on/(on+off);
+	    if (on_until<0)
+		on_until = now + exponential(on);
+	    double t = now + exponential(on_interval);
+	    /* none before the on period ends: the intervals being memoryless,
+	       start over at the next on period */
+	    while (t>=on_until) {
+		double start = on_until + exponential(off);
+		on_until = start + exponential(on);
+		t = start + exponential(on_interval);
+	    }
+	    return t - now;
+	}
+    default:
+	return mean_interval*2.0*Workload_Random();
+    }
+}
+
+void Workload::describe(FILE *fp)
+{
+    if (sizes==SIZES_PARETO)
+	fprintf(fp, "\tmessage sizes are Pareto with shape %.2f\n", size_shape);
+    else if (sizes==SIZES_LOGNORMAL)
+	fprintf(fp, "\tmessage sizes are lognormal with shape %.2f\n", size_shape);
+    if (arrivals==ARRIVALS_POISSON)
+	fprintf(fp, "\tmessages arrive as a Poisson process\n");
+    else if (arrivals==ARRIVALS_ONOFF)
+	fprintf(fp, "\tmessages arrive as a Poisson process during on periods of %.3fs, "
+		"between off periods of %.3fs\n", on, off);
+    else if (arrivals==ARRIVALS_REQRESP)
+	fprintf(fp, "\tmessages are responses, each request after the response before "
+		"and a think time\n");
+}
+
+void Workload::report(FILE *fp)
+{
+    if (sizes!=SIZES_UNIFORM)
+	report_sizes(fp);
+}
+
+void Workload::report_sizes(FILE *fp)
+{
+    if (messages==0)
+	return;
+    fprintf(fp, "\t%lld messages of %.1f bytes on average", messages, bytes*1.0/messages);
+    if (truncated>0)
+	fprintf(fp, ", %lld of them cut off at %d bytes", truncated, WORKLOAD_MAX_SIZE);
+    fprintf(fp, "\n");
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  trace-driven workload
+  []------------------------------------------------------------------------[]*/
+
+WorkloadTrace::WorkloadTrace(const char *path)
+    : Workload(SIZES_UNIFORM, 0, ARRIVALS_UNIFORM, 0, 0, 0, 0), path(path), next(0),
+      dropped(0), wraps(0)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd<0) {
+	perror(path);
+	exit(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st)<0) {
+	perror(path);
+	exit(-1);
+    }
+    map_size = st.st_size;
+    if (map_size<sizeof(struct trace_header) + sizeof(struct workload_record)) {
+	fprintf(stderr, "%s: not a workload trace, or an empty one\n", path);
+	exit(-1);
+    }
+    map = (char*) mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map==MAP_FAILED) {
+	perror(path);
+	exit(-1);
+    }
+    close(fd);
+
+    const struct trace_header *h = (const struct trace_header*) map;
+    if (memcmp(h->magic, WORKLOAD_MAGIC, sizeof(h->magic))!=0 ||
+	h->version!=WORKLOAD_VERSION) {
+	fprintf(stderr, "%s: not a version %d workload trace\n", path, WORKLOAD_VERSION);
+	exit(-1);
+    }
+    records = (const struct workload_record*) (map + sizeof(struct trace_header));
+    num_records = (map_size - sizeof(struct trace_header))/sizeof(struct workload_record);
+    madvise(map, map_size, MADV_SEQUENTIAL);
+}
+
+WorkloadTrace::~WorkloadTrace()
+{
+    munmap(map, map_size);
+}
+
+int WorkloadTrace::size()
+{
+    if (next==num_records) {
+	next = 0;
+	dropped = 0;
+	wraps ++;
+    }
+    int size = records[next].size;
+    if (size>WORKLOAD_MAX_SIZE) {
+	size = WORKLOAD_MAX_SIZE;
+	truncated ++;
+    }
+    if (size==0) size = 1;
+    messages ++;
+    bytes += size;
+    return size;
+}
+
+double WorkloadTrace::interval(double now)
+{
+    double interval = records[next++].interval*1e-6;
+
+    /* drop the whole pages of the window behind */
+    size_t offset = (const char*) &records[next] - map;
+    if (offset - dropped >= 2*TRACE_WINDOW) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t upto = (offset - TRACE_WINDOW)/page*page;
+	madvise(map + dropped, upto - dropped, MADV_DONTNEED);
+	dropped = upto;
+    }
+    return interval;
+}
+
+void WorkloadTrace::describe(FILE *fp)
+{
+    fprintf(fp, "\tmessage sizes and intervals replayed from %s (%zu messages)\n",
+	    path, num_records);
+}
+
+void WorkloadTrace::report(FILE *fp)
+{
+    report_sizes(fp);
+    if (wraps>0)
+	fprintf(fp, "\tthe workload trace started over %lld times\n", wraps);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  keystream
+  []------------------------------------------------------------------------[]*/
+
+/* splitmix64 of the word index, eight bytes of the stream at a time */
+static inline uint64_t keystream_word(uint64_t key, long long word)
+{
+    uint64_t z = key + (uint64_t) word*0x9e3779b97f4a7c15ull;
+    z = (z ^ (z>>30))*0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z>>27))*0x94d049bb133111ebull;
+    return z ^ (z>>31);
+}
+
+void Keystream_Fill(uint64_t key, long long offset, char *data, int size)
+{
+    int i = 0;
+    while (i<size) {
+	long long k = offset + i;
+	uint64_t w = keystream_word(key, k>>3);
+	for (int b=k&7; b<8 && i<size; b++, i++)
+	    data[i] = (char) (w>>(8*b));
+    }
+}
+
+bool Keystream_Match(uint64_t key, long long offset, const char *data, int size)
+{
+    int i = 0;
+    while (i<size) {
+	long long k = offset + i;
+	uint64_t w = keystream_word(key, k>>3);
+	for (int b=k&7; b<8 && i<size; b++, i++)
+	    if (data[i]!=(char) (w>>(8*b)))
+		return false;
+    }
+    return true;
+}
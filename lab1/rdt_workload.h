@@ -0,0 +1,142 @@
+/*
+ * FILE: rdt_workload.h
+ * DESCRIPTION: Workloads of the upper layer at the sender, deciding how large
+ *       each message is and when the next one comes.  Sizes are uniform in
+ *       [1, 2*mean] by default, or follow a heavy tail:
+ *
+ *       pareto,<alpha>       Pareto with shape alpha > 1
+ *       lognormal,<sigma>    lognormal with shape sigma
+ *
+ *       and messages arrive at uniform intervals in [0, 2*mean] by default,
+ *       or as:
+ *
+ *       poisson              exponential intervals
+ *       onoff,<on>,<off>     Poisson during on periods, nothing during off
+ *                            periods, both exponential with the given means
+ *       reqresp              request/response: every message is a response,
+ *                            and the next request only goes out once it has
+ *                            been delivered, after an exponential think time
+ *
+ *       All of them keep the mean size and the mean interval of the command
+ *       line.  A WorkloadTrace replays both from a workload trace (see
+ *       rdt_mktrace.cc) instead, mapped into memory and streamed through.
+ *
+ *       The bytes of the messages are the keystream of the seed, so that the
+ *       receiver can check every byte it gets at a constant cost per byte.
+ */
+
+
+#ifndef _RDT_WORKLOAD_H_
+#define _RDT_WORKLOAD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rdt_channel.h"
+
+
+/* a workload trace is WORKLOAD_MAGIC and a version (in a trace_header),
+   followed by a workload_record per message in the byte order of the
+   machine */
+#define WORKLOAD_MAGIC "RDTWKLD1"
+#define WORKLOAD_VERSION 1
+
+struct workload_record {
+    uint32_t interval;          /* since the message before, in microseconds */
+    uint32_t size;
+};
+
+/* heavy tails are cut off at this size */
+#define WORKLOAD_MAX_SIZE (1<<20)
+
+/* the size distributions and the arrival processes */
+enum {SIZES_UNIFORM=0, SIZES_PARETO, SIZES_LOGNORMAL};
+enum {ARRIVALS_UNIFORM=0, ARRIVALS_POISSON, ARRIVALS_ONOFF, ARRIVALS_REQRESP};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  routines that the driver provides
+  []------------------------------------------------------------------------[]*/
+
+/* a random number in [0,1] */
+double Workload_Random();
+
+
+/*[]------------------------------------------------------------------------[]
+  |  workloads
+  []------------------------------------------------------------------------[]*/
+
+/* for every message, size() is asked first and then interval(), the time
+   from now until the next message.  under request/response, the interval
+   is the think time, counted from when the message has been delivered */
+class Workload
+{
+public:
+    Workload(int sizes, double size_shape, int arrivals, double on, double off,
+	     int mean_size, double mean_interval);
+    virtual ~Workload() {}
+
+    virtual int size();
+    virtual double interval(double now);
+
+    /* whether the next message waits for the delivery of the one before */
+    bool closed_loop() { return arrivals==ARRIVALS_REQRESP; }
+
+    /* a line each for the inputs and the report of the simulator, nothing
+       for the default workload */
+    virtual void describe(FILE *fp);
+    virtual void report(FILE *fp);
+
+protected:
+    /* the line of the report on the sizes */
+    void report_sizes(FILE *fp);
+
+    int sizes;
+    double size_shape;
+    int arrivals;
+    double on, off;
+    int mean_size;
+    double mean_interval;
+    double on_until;            /* the end of the current on period */
+    long long messages;
+    long long truncated;        /* sizes cut off at WORKLOAD_MAX_SIZE */
+    long long bytes;
+};
+
+/* every message takes the size and the interval of the next record of the
+   trace.  the trace starts over when it runs out */
+class WorkloadTrace : public Workload
+{
+public:
+    WorkloadTrace(const char *path);
+    ~WorkloadTrace();
+
+    int size();
+    double interval(double now);
+    void describe(FILE *fp);
+    void report(FILE *fp);
+
+private:
+    const char *path;
+    char *map;
+    size_t map_size;
+    const struct workload_record *records;
+    size_t num_records;
+    size_t next;                /* the record of the next message */
+    size_t dropped;             /* bytes of the mapping dropped so far */
+    long long wraps;
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  keystream
+  []------------------------------------------------------------------------[]*/
+
+/* byte k of the stream of key is byte k%8 of a hash of k/8 */
+void Keystream_Fill(uint64_t key, long long offset, char *data, int size);
+
+/* whether data is the stream of key from offset on */
+bool Keystream_Match(uint64_t key, long long offset, const char *data, int size);
+
+#endif  /* _RDT_WORKLOAD_H_ */